@@ -0,0 +1,391 @@
+#!/usr/bin/env python3
+#
+# Copyright Joyent, Inc. and other Node contributors. All rights reserved.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to
+# deal in the Software without restriction, including without limitation the
+# rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+"""Compile a head.dfa description into the tables of http_parser_dfa.h.
+
+Usage: gen_dfa.py DESCRIPTION HTTP_PARSER_H [OUTPUT]
+
+See contrib/head.dfa for the format. http_parser.h supplies the method
+names for @methods. The description is compiled twice, for strict and
+non-strict builds, and the output picks one with HTTP_PARSER_STRICT.
+"""
+
+import re
+import sys
+
+# Must match the DFA_* cases in http_parser_scan_head()
+ACTIONS = ['mark', 'url', 'status', 'field', 'value',
+           'major', 'minor', 'code', 'done', 'method']
+START_TYPES = ['request', 'response', 'both']
+DEFAULT_ERROR = 'HPE_INVALID_CONSTANT'
+
+
+class DescriptionError(Exception):
+    pass
+
+
+def parse_byte_spec(spec):
+    """Return the set of bytes a class SPEC stands for."""
+    escapes = {'\\s': 0x20, '\\t': 0x09, '\\r': 0x0d, '\\n': 0x0a}
+
+    def one(s):
+        if s in escapes:
+            return escapes[s]
+        if re.fullmatch(r'\\x[0-9a-fA-F]{2}', s):
+            return int(s[2:], 16)
+        if len(s) == 1:
+            return ord(s)
+        raise DescriptionError('bad character %r' % s)
+
+    m = re.fullmatch(r'(\\x[0-9a-fA-F]{2}|[^\\])-(\\x[0-9a-fA-F]{2}|[^\\])',
+                     spec)
+    if m:
+        lo, hi = one(m.group(1)), one(m.group(2))
+        if lo > hi:
+            raise DescriptionError('empty range %r' % spec)
+        return set(range(lo, hi + 1))
+    return {one(spec)}
+
+
+def read_methods(header):
+    """Return [(enum value, name)] from HTTP_METHOD_MAP in http_parser.h."""
+    text = open(header).read()
+    body = re.search(r'#define HTTP_METHOD_MAP\(XX\)(.*?)\n\n', text, re.S)
+    if not body:
+        raise DescriptionError('no HTTP_METHOD_MAP in %s' % header)
+    return [(int(num), string) for num, _, string in
+            re.findall(r'XX\(\s*(\d+),\s*(\w+),\s*([^)\s]+)\s*\)',
+                       body.group(1))]
+
+
+class Description(object):
+    def __init__(self, path, methods, strict):
+        self.classes = {}
+        self.errors = {}
+        self.starts = {}
+        self.rules = {}                 # state -> [(input, next, action, arg)]
+        self.lenient = {}               # state -> (next, action)
+        self.order = []                 # states in order of appearance
+        self.methods = methods
+        self.strict = strict
+        self.conditions = []            # enclosing `if`s, as [taken, seen else]
+        for lineno, line in enumerate(open(path), 1):
+            try:
+                self.parse_line(line)
+            except DescriptionError as e:
+                raise DescriptionError('%s:%d: %s' % (path, lineno, e))
+        if self.conditions:
+            raise DescriptionError('%s: missing endif' % path)
+
+    def state(self, name):
+        if name not in self.rules:
+            self.rules[name] = []
+            self.order.append(name)
+        return name
+
+    def method(self, name):
+        for num, method in self.methods:
+            if method == name:
+                return num
+        raise DescriptionError('unknown method %r' % name)
+
+    def parse_line(self, line):
+        if line.startswith('#') or not line.strip():
+            return
+        words = line.split()
+        if words[0] == 'if':
+            if words[1:] != ['strict']:
+                raise DescriptionError('only `if strict` is supported')
+            self.conditions.append([self.strict, False])
+            return
+        if words[0] in ('else', 'endif'):
+            if len(words) != 1 or not self.conditions or \
+               (words[0] == 'else' and self.conditions[-1][1]):
+                raise DescriptionError('unexpected %s' % words[0])
+            if words[0] == 'else':
+                self.conditions[-1] = [not self.conditions[-1][0], True]
+            else:
+                self.conditions.pop()
+            return
+        if not all(taken for taken, _ in self.conditions):
+            return
+        if words[0] == 'class':
+            bytes_ = set()
+            for spec in words[2:]:
+                bytes_ |= parse_byte_spec(spec)
+            self.classes[words[1]] = bytes_
+        elif words[0] == 'error':
+            for name in words[2:]:
+                self.errors[name] = words[1]
+        elif words[0] == 'start':
+            if words[1] not in START_TYPES:
+                raise DescriptionError('bad parser type %r' % words[1])
+            self.starts[words[1]] = self.state(words[2])
+        elif words[0] == 'lenient':
+            if len(words) not in (3, 4):
+                raise DescriptionError('bad lenient rule')
+            action = words[3] if len(words) == 4 else None
+            if action is not None and action not in ACTIONS[:-1]:
+                raise DescriptionError('unknown action %r' % action)
+            self.lenient[self.state(words[1])] = (self.state(words[2]), action)
+        else:
+            m = re.fullmatch(r'(\w+)\s+("[^"]+"|\S+)\s+(\w+)'
+                             r'(?:\s+(\w+)(?:\s+(\S+))?)?', line.strip())
+            if not m:
+                raise DescriptionError('bad rule')
+            state, input_, next_, action, name = m.groups()
+            if action is not None and action not in ACTIONS:
+                raise DescriptionError('unknown action %r' % action)
+            if action == 'method' and input_ != '@methods':
+                if name is None or not input_.startswith('"'):
+                    raise DescriptionError('method NAME goes with a literal')
+                arg = self.method(name)
+            elif name is not None:
+                raise DescriptionError('only method takes an argument')
+            elif (input_ == '@methods') != (action == 'method'):
+                raise DescriptionError('@methods goes with action method')
+            else:
+                arg = None
+            if not input_.startswith('"') and input_ != '@methods' and \
+               input_ not in self.classes:
+                raise DescriptionError('unknown class %r' % input_)
+            self.state(state)
+            self.rules[state].append((input_, self.state(next_), action, arg))
+
+
+class Machine(object):
+    """The byte-level automaton: literals expanded into prefix trees."""
+
+    def __init__(self, desc):
+        self.names = ['<error>']
+        self.index = {}
+        self.trans = [{}]               # state -> {byte: (next, action)}
+        self.errors = ['HPE_OK']
+        self.lenient = [None]
+        self.shared = {}                # literal tree node -> state
+        for name in desc.order:
+            self.add(name, desc.errors.get(name, DEFAULT_ERROR))
+        for name in desc.order:
+            if not desc.rules[name]:
+                raise DescriptionError('state %s has no rules' % name)
+            self.expand(desc, name)
+        for name, (next_, action) in desc.lenient.items():
+            self.lenient[self.index[name]] = (self.index[next_], action, None)
+
+    def add(self, name, error):
+        self.index[name] = len(self.names)
+        self.names.append(name)
+        self.trans.append({})
+        self.errors.append(error)
+        self.lenient.append(None)
+        return self.index[name]
+
+    def take(self, state, byte, target):
+        table = self.trans[state]
+        if byte not in table:
+            table[byte] = target
+
+    def expand(self, desc, name):
+        s = self.index[name]
+        literals = []
+        for input_, next_, action, arg in desc.rules[name]:
+            if input_.startswith('"'):
+                literals.append((input_[1:-1], next_, action, arg))
+        # A method spelled out as a literal overrides its @methods entry
+        spelled = set(text for text, _, _, _ in literals)
+        for input_, next_, action, arg in desc.rules[name]:
+            if input_ == '@methods':
+                for num, method in desc.methods:
+                    if method + ' ' not in spelled:
+                        literals.append((method + ' ', next_, action, num))
+        expanded = False
+        for input_, next_, action, arg in desc.rules[name]:
+            if input_.startswith('"') or input_ == '@methods':
+                # All of a state's literals go in one tree, which claims
+                # its bytes at the position of the first of them
+                if not expanded:
+                    self.expand_literals(name, s, self.errors[s], literals)
+                    expanded = True
+            else:
+                for byte in sorted(desc.classes[input_]):
+                    self.take(s, byte, (self.index[next_], action, None))
+
+    def expand_literals(self, name, s, error, literals):
+        words = {}
+        for text, next_, action, arg in literals:
+            if text in words:
+                raise DescriptionError('%s: literal %r twice' % (name, text))
+            words[text] = (self.index[next_], action, arg)
+        nodes = {'': s}
+        fresh = set()
+        for text in sorted(words):
+            for i in range(1, len(text)):
+                prefix = text[:i]
+                if prefix in words:
+                    raise DescriptionError('%s: %r is a prefix of %r' %
+                                           (name, prefix, text))
+                if prefix in nodes:
+                    continue
+                # Trees of different states share the nodes that lead to
+                # the same places, e.g. the methods of start_req and
+                # start_both
+                key = (error, frozenset((t[i:], target)
+                                        for t, target in words.items()
+                                        if t.startswith(prefix)))
+                if key not in self.shared:
+                    self.shared[key] = self.add('%s "%s' % (name, prefix),
+                                                error)
+                    fresh.add(prefix)
+                nodes[prefix] = self.shared[key]
+        for prefix, node in sorted(nodes.items()):
+            if prefix and prefix not in fresh:
+                continue
+            for text, target in sorted(words.items()):
+                if text.startswith(prefix) and len(text) > len(prefix):
+                    byte = ord(text[len(prefix)])
+                    if len(text) == len(prefix) + 1:
+                        self.take(node, byte, target)
+                    else:
+                        self.take(node, byte,
+                                  (nodes[text[:len(prefix) + 1]], None, None))
+
+    def classes(self):
+        """Group bytes that every state treats the same way."""
+        columns = {}
+        byte_class = []
+        for byte in range(256):
+            column = tuple(t.get(byte) for t in self.trans)
+            if column not in columns:
+                columns[column] = len(columns)
+            byte_class.append(columns[column])
+        return byte_class, sorted(columns, key=columns.get)
+
+
+def action_code(action, arg):
+    if action is None:
+        return 0
+    if action == 'method':
+        return ACTIONS.index('method') + 1 + arg
+    return ACTIONS.index(action) + 1
+
+
+def emit_tables(desc, machine, out):
+    byte_class, columns = machine.classes()
+    nstates = len(machine.names)
+    bits = max(8, (nstates - 1).bit_length())
+    max_action = ACTIONS.index('method') + 1 + max(m for m, _ in desc.methods)
+    if max_action >> (16 - bits):
+        raise DescriptionError('%d states and %d actions do not fit in 16 bits'
+                               % (nstates, max_action))
+    for t in START_TYPES:
+        if t not in desc.starts:
+            raise DescriptionError('no start state for %s' % t)
+
+    def cell(target):
+        if target is None:
+            return 0
+        next_, action, arg = target
+        return next_ | action_code(action, arg) << bits
+
+    w = out.write
+    w('/* %d states, %d character classes */\n' % (nstates - 1, len(columns)))
+    w('#define DFA_STATE_BITS %d\n' % bits)
+    w('#define DFA_CLASSES %d\n' % len(columns))
+    for t in START_TYPES:
+        w('#define DFA_START_%s %d\n' %
+          (t.upper(), machine.index[desc.starts[t]]))
+    w('\n')
+
+    w('/* Byte -> character class */\n')
+    w('static const uint8_t dfa_class[256] = {\n')
+    for row in range(0, 256, 16):
+        w('  %s,\n' % ', '.join('%2d' % c for c in byte_class[row:row + 16]))
+    w('};\n\n')
+
+    w('/* [state][class] -> next state | enum dfa_action << DFA_STATE_BITS,\n'
+      ' * where DFA_METHOD + m picks method m. State 0 rejects every byte.\n'
+      ' */\n')
+    w('static const uint16_t dfa_next[][DFA_CLASSES] = {\n')
+    for s in range(nstates):
+        cells = [cell(column[s]) for column in columns]
+        lines = [', '.join('0x%04x' % c for c in cells[i:i + 8])
+                 for i in range(0, len(cells), 8)]
+        w('  /* %d: %s */\n' % (s, machine.names[s]))
+        w('  { %s },\n' % ',\n    '.join(lines))
+    w('};\n\n')
+
+    w('/* The error set when a state rejects a byte */\n')
+    w('static const uint8_t dfa_error[] = {\n')
+    for s in range(nstates):
+        w('  %s,\n' % machine.errors[s])
+    w('};\n\n')
+
+    w('/* What a state does instead of rejecting a byte when the parser has\n'
+      ' * lenient_http_headers set; 0 if it rejects it anyway\n'
+      ' */\n')
+    w('static const uint16_t dfa_lenient[] = {\n')
+    for s in range(nstates):
+        w('  0x%04x,\n' % cell(machine.lenient[s]))
+    w('};\n')
+
+
+def emit(variants, out):
+    w = out.write
+    w('/* Generated from contrib/head.dfa by contrib/gen_dfa.py. Do not edit. */\n')
+    w('#ifndef http_parser_dfa_h\n#define http_parser_dfa_h\n\n')
+
+    w('enum dfa_action\n')
+    for i, action in enumerate(['none'] + ACTIONS):
+        w('  %s DFA_%s%s\n' % ('{' if i == 0 else ',', action.upper(),
+                              ' = 0' if i == 0 else ''))
+    w('  };\n\n')
+
+    for i, (desc, machine) in enumerate(variants):
+        w('#if HTTP_PARSER_STRICT\n' if i == 0 else '\n#else\n')
+        emit_tables(desc, machine, out)
+    w('#endif\n\n')
+    w('#endif /* http_parser_dfa_h */\n')
+
+
+def main(argv):
+    if len(argv) not in (3, 4):
+        sys.stderr.write(__doc__)
+        return 2
+    try:
+        methods = read_methods(argv[2])
+        variants = []
+        for strict in (True, False):
+            desc = Description(argv[1], methods, strict)
+            variants.append((desc, Machine(desc)))
+        if len(argv) == 4:
+            with open(argv[3], 'w') as out:
+                emit(variants, out)
+        else:
+            emit(variants, sys.stdout)
+    except DescriptionError as e:
+        sys.stderr.write('gen_dfa.py: %s\n' % e)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
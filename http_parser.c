@@ -25,6 +25,22 @@
 #include <string.h>
 #include <limits.h>
 
+/* Compile with -DHTTP_PARSER_DFA_CHECK=1 to have http_parser_execute_head()
+ * check http_parser_scan_head() against it on every message head it sees.
+ */
+#ifndef HTTP_PARSER_DFA_CHECK
+# define HTTP_PARSER_DFA_CHECK 0
+#endif
+
+#if HTTP_PARSER_DFA_CHECK
+# include <stdlib.h>
+#endif
+
+/* Searched along the include path, so a build may put freshly generated
+ * tables ahead of the checked in ones */
+#include <http_parser_dfa.h>
+#define DFA_STATE_MASK ((1u << DFA_STATE_BITS) - 1)
+
 #ifndef ULLONG_MAX
 # define ULLONG_MAX ((uint64_t) -1) /* 2^64-1 */
 #endif
@@ -59,32 +75,79 @@ do {                                                                 \
 do {                                                                 \
   parser->nread = nread;                                             \
   parser->state = CURRENT_STATE();                                   \
+  SYNC_OUT();                                                        \
   return (V);                                                        \
 } while (0);
 #define REEXECUTE()                                                  \
   goto reexecute;                                                    \
 
+/* execute() keeps these parser fields in locals. Write them back before
+ * anything outside the function can look at the parser, and read them
+ * again afterwards.
+ */
+#define SYNC_OUT()                                                   \
+  (parser->header_state = p_header_state,                            \
+   parser->index = p_index,                                          \
+   parser->flags = p_flags,                                          \
+   parser->content_length = p_content_length)
+#define SYNC_IN()                                                    \
+  (p_header_state = (enum header_states) parser->header_state,       \
+   p_index = parser->index,                                          \
+   p_flags = parser->flags,                                          \
+   p_content_length = parser->content_length)
+
 
 #ifdef __GNUC__
 # define LIKELY(X) __builtin_expect(!!(X), 1)
 # define UNLIKELY(X) __builtin_expect(!!(X), 0)
+# define ALWAYS_INLINE inline __attribute__((always_inline))
 #else
 # define LIKELY(X) (X)
 # define UNLIKELY(X) (X)
+# define ALWAYS_INLINE inline
+#endif
+
+/* Marks a fall through into a CASE() label, where GCC can't see the usual
+ * comment.
+ */
+#if defined(__GNUC__) && __GNUC__ >= 7
+# define FALLTHROUGH __attribute__((fallthrough))
+#else
+# define FALLTHROUGH do { } while (0)
 #endif
 
 
-/* Run the notify callback FOR, returning ER if it fails */
+/* Run the notify callback FOR, returning ER if it fails. A new message
+ * also clears the header index, if there is one, and the start and end of
+ * a message go into the batch, if there is one. There are no chunk
+ * callbacks when dechunking or collecting body ranges.
+ */
 #define CALLBACK_NOTIFY_(FOR, ER)                                    \
 do {                                                                 \
   assert(HTTP_PARSER_ERRNO(parser) == HPE_OK);                       \
                                                                      \
-  if (LIKELY(settings->on_##FOR)) {                                  \
+  if (head && HPE_CB_##FOR == HPE_CB_message_begin) {                \
+    head_reset(head);                                                \
+  }                                                                  \
+  if (batch && (HPE_CB_##FOR == HPE_CB_message_begin ||              \
+                HPE_CB_##FOR == HPE_CB_message_complete)) {          \
+    parser->state = CURRENT_STATE();                                 \
+    SYNC_OUT();                                                      \
+    batch_message(batch, parser, HPE_CB_##FOR, (ER));                \
+    if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {                       \
+      return (ER);                                                   \
+    }                                                                \
+  }                                                                  \
+  if (LIKELY(settings->on_##FOR) &&                                  \
+      !(collect_body && (HPE_CB_##FOR == HPE_CB_chunk_header ||      \
+                         HPE_CB_##FOR == HPE_CB_chunk_complete))) {  \
     parser->state = CURRENT_STATE();                                 \
+    SYNC_OUT();                                                      \
     if (UNLIKELY(0 != settings->on_##FOR(parser))) {                 \
       SET_ERRNO(HPE_CB_##FOR);                                       \
     }                                                                \
     UPDATE_STATE(parser->state);                                     \
+    SYNC_IN();                                                       \
                                                                      \
     /* We either errored above or got paused; get out */             \
     if (UNLIKELY(HTTP_PARSER_ERRNO(parser) != HPE_OK)) {             \
@@ -99,19 +162,37 @@ do {                                                                 \
 /* Run the notify callback FOR and don't consume the current byte */
 #define CALLBACK_NOTIFY_NOADVANCE(FOR)  CALLBACK_NOTIFY_(FOR, p - data)
 
-/* Run data callback FOR with LEN bytes, returning ER if it fails */
+/* Run data callback FOR with LEN bytes, returning ER if it fails. When
+ * indexing the head, everything but the body is recorded in `head` instead,
+ * and when batching, the body is recorded in `batch`.
+ */
 #define CALLBACK_DATA_(FOR, LEN, ER)                                 \
 do {                                                                 \
   assert(HTTP_PARSER_ERRNO(parser) == HPE_OK);                       \
                                                                      \
   if (FOR##_mark) {                                                  \
-    if (LIKELY(settings->on_##FOR)) {                                \
+    if (head && HPE_CB_##FOR != HPE_CB_body) {                       \
+      if (UNLIKELY(0 != head_store(head, HPE_CB_##FOR,               \
+                                   FOR##_mark - data, (LEN),         \
+                                   parser->header_id))) {            \
+        SET_ERRNO(HPE_TOO_MANY_HEADERS);                             \
+        return (ER);                                                 \
+      }                                                              \
+    } else if (batch && HPE_CB_##FOR == HPE_CB_body) {               \
+      if (UNLIKELY(0 != batch_body(batch, FOR##_mark - data,         \
+                                   (LEN)))) {                        \
+        parser->http_errno = HPE_PAUSED;                             \
+        return (ER);                                                 \
+      }                                                              \
+    } else if (LIKELY(settings->on_##FOR)) {                         \
       parser->state = CURRENT_STATE();                               \
+      SYNC_OUT();                                                    \
       if (UNLIKELY(0 !=                                              \
                    settings->on_##FOR(parser, FOR##_mark, (LEN)))) { \
         SET_ERRNO(HPE_CB_##FOR);                                     \
       }                                                              \
       UPDATE_STATE(parser->state);                                   \
+      SYNC_IN();                                                     \
                                                                      \
       /* We either errored above or got paused; get out */           \
       if (UNLIKELY(HTTP_PARSER_ERRNO(parser) != HPE_OK)) {           \
@@ -130,6 +211,63 @@ do {                                                                 \
 #define CALLBACK_DATA_NOADVANCE(FOR)                                 \
     CALLBACK_DATA_(FOR, p - FOR##_mark, p - data)
 
+/* The most body ranges passed to one on_body_ranges call */
+#define BODY_RANGES 32
+
+/* Pass the chunk payloads collected so far to on_body (compacted, when
+ * dechunking) or to on_body_ranges, returning ER if it fails
+ */
+#define BODY_FLUSH(ER)                                               \
+do {                                                                 \
+  if (dechunk_start != dechunk_end || nranges != 0) {                \
+    parser->state = CURRENT_STATE();                                 \
+    SYNC_OUT();                                                      \
+    if (dechunk) {                                                   \
+      if (LIKELY(settings->on_body) &&                               \
+          UNLIKELY(0 != settings->on_body(parser, dechunk_start,     \
+                                          dechunk_end -              \
+                                          dechunk_start))) {         \
+        SET_ERRNO(HPE_CB_body);                                      \
+      }                                                              \
+    } else if (UNLIKELY(0 != settings->on_body_ranges(parser, ranges,\
+                                                      nranges))) {   \
+      SET_ERRNO(HPE_CB_body);                                        \
+    }                                                                \
+    UPDATE_STATE(parser->state);                                     \
+    SYNC_IN();                                                       \
+    dechunk_start = dechunk_end = NULL;                              \
+    nranges = 0;                                                     \
+                                                                     \
+    /* We either errored above or got paused; get out */             \
+    if (UNLIKELY(HTTP_PARSER_ERRNO(parser) != HPE_OK)) {             \
+      return (ER);                                                   \
+    }                                                                \
+  }                                                                  \
+} while (0)
+
+/* Collect LEN chunk payload bytes at AT, which are in `data`, for
+ * BODY_FLUSH(). When dechunking they slide down over the framing of earlier
+ * chunks. The caller flushes a full `ranges` first.
+ */
+#define BODY_RANGE(AT, LEN)                                          \
+do {                                                                 \
+  if (dechunk) {                                                     \
+    char *from = dechunk + ((AT) - data);                            \
+                                                                     \
+    if (dechunk_end == NULL) {                                       \
+      dechunk_start = dechunk_end = from;                            \
+    } else if (dechunk_end != from) {                                \
+      memmove(dechunk_end, from, (size_t) (LEN));                    \
+    }                                                                \
+    dechunk_end += (LEN);                                            \
+  } else {                                                           \
+    assert(nranges < ARRAY_SIZE(ranges));                            \
+    ranges[nranges].at = (AT);                                       \
+    ranges[nranges].length = (size_t) (LEN);                         \
+    nranges++;                                                       \
+  }                                                                  \
+} while (0)
+
 /* Set the mark FOR; non-destructive if mark is already set */
 #define MARK(FOR)                                                    \
 do {                                                                 \
@@ -138,6 +276,35 @@ do {                                                                 \
   }                                                                  \
 } while (0)
 
+/* Feed the URL byte `ch` to parse_url_char(), and to the URL splitter when
+ * there is a header index.
+ */
+#define URL_CHAR()                                                   \
+do {                                                                 \
+  enum state url_from = CURRENT_STATE();                             \
+                                                                     \
+  UPDATE_STATE(parse_url_char(url_from, ch));                        \
+  if (UNLIKELY(CURRENT_STATE() == s_dead)) {                         \
+    SET_ERRNO(HPE_INVALID_URL);                                      \
+    goto error;                                                      \
+  }                                                                  \
+  if (head) {                                                        \
+    url_split_char(&head->url, &head->url_host, url_from,            \
+                   CURRENT_STATE(),                                  \
+                   head->base + (uint32_t) (p - data), ch);          \
+  }                                                                  \
+} while (0)
+
+/* The URL ends before `p` */
+#define URL_END()                                                    \
+do {                                                                 \
+  if (head) {                                                        \
+    url_split_end(&head->url, head->url_host, CURRENT_STATE(),       \
+                  head->base + (uint32_t) (p - data),                \
+                  parser->method == HTTP_CONNECT);                   \
+  }                                                                  \
+} while (0)
+
 /* Don't allow the total size of the HTTP headers (including the status
  * line) to exceed HTTP_MAX_HEADER_SIZE.  This check is here to protect
  * embedders against denial-of-service attacks where the attacker feeds
@@ -177,6 +344,71 @@ static const char *method_strings[] =
   };
 
 
+/* Perfect hash over every method of at most 7 characters in
+ * HTTP_METHOD_MAP, used by match_method_word(). The key is the method and
+ * its trailing space loaded as a little-endian word, the slot is
+ * (key * METHOD_HASH_MAGIC) >> 58. Longer methods always take the
+ * byte-at-a-time path. Regenerate both when adding methods; a stale table
+ * only costs speed, since every hit is verified against method_strings.
+ */
+#define METHOD_HASH_MAGIC 0x1f9086282b5cbc11ULL
+#define METHOD_NONE 0xff
+
+static const unsigned char method_hash[64] =
+  { METHOD_NONE, METHOD_NONE, METHOD_NONE, HTTP_SEARCH
+  , METHOD_NONE, METHOD_NONE, HTTP_SOURCE, HTTP_OPTIONS
+  , METHOD_NONE, METHOD_NONE, HTTP_COPY, METHOD_NONE
+  , METHOD_NONE, HTTP_REPORT, METHOD_NONE, HTTP_PURGE
+  , METHOD_NONE, HTTP_LOCK, HTTP_NOTIFY, METHOD_NONE
+  , HTTP_BIND, METHOD_NONE, METHOD_NONE, METHOD_NONE
+  , METHOD_NONE, METHOD_NONE, HTTP_MOVE, METHOD_NONE
+  , METHOD_NONE, HTTP_REBIND, METHOD_NONE, METHOD_NONE
+  , HTTP_TRACE, METHOD_NONE, METHOD_NONE, HTTP_POST
+  , METHOD_NONE, METHOD_NONE, METHOD_NONE, METHOD_NONE
+  , METHOD_NONE, HTTP_LINK, METHOD_NONE, HTTP_UNLINK
+  , HTTP_ACL, METHOD_NONE, HTTP_DELETE, HTTP_GET
+  , HTTP_UNLOCK, HTTP_CONNECT, METHOD_NONE, HTTP_MKCOL
+  , METHOD_NONE, HTTP_MERGE, METHOD_NONE, METHOD_NONE
+  , HTTP_PATCH, HTTP_PUT, HTTP_UNBIND, METHOD_NONE
+  , METHOD_NONE, METHOD_NONE, METHOD_NONE, HTTP_HEAD
+  };
+
+
+static const char *header_strings[] =
+  { "<unknown>"
+#define XX(num, name, string) , string
+  HTTP_HEADER_MAP(XX)
+#undef XX
+  };
+
+
+/* Perfect hash over HTTP_HEADER_MAP, used by header_lookup(). The key is
+ * the first two and last two bytes of the lowercased name and its length,
+ * the slot is (key * HEADER_HASH_MAGIC) >> 56. Regenerate both when adding
+ * headers; every hit is verified against header_strings.
+ */
+#define HEADER_HASH_MAGIC 0x8a9cbace2b6a176bULL
+
+static const unsigned char header_hash[256] =
+  {  0,  0,  0,  0,  0, 12, 44,  0,  0,  0,  0,  0,  0,  0,  0,  0
+  ,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 39,  0, 46, 29, 45,  0
+  ,  0,  0, 54, 65,  0,  0, 25,  0, 38,  0,  0, 17,  4,  0,  0,  0
+  ,  0,  0, 28,  0,  0,  0,  0,  0,  0, 68,  0,  0,  0,  0, 48, 56
+  ,  0,  0, 51,  0, 24,  0,  0,  0, 34,  0,  0,  1, 61, 41,  0,  0
+  ,  0,  0, 15,  0,  0,  0, 22,  0,  0,  0,  0,  0, 11,  0, 19,  0
+  , 43,  0,  0,  0,  0,  0,  0,  0,  0,  0, 63, 64, 67,  0,  0,  0
+  ,  0,  0, 72,  0,  0, 50,  0,  8,  0, 47,  0, 33,  0,  0, 20,  0
+  , 37,  0,  0,  0,  0,  0,  0,  0,  0, 27,  0,  0,  0,  0,  0,  0
+  ,  0,  0,  0, 71, 13,  0, 14, 66,  0,  0,  0,  0,  0,  0, 59,  0
+  ,  2, 57,  0, 74, 53,  0,  5, 35, 31, 26,  0,  0,  0,  0,  7,  0
+  ,  0,  0,  0,  0, 62,  0,  0,  0,  0,  0,  0,  0, 49,  0,  0,  0
+  ,  0, 58,  0, 36,  0,  0, 21,  0,  0,  0,  0,  0,  0,  0, 55,  0
+  ,  0,  0,  0,  0,  0, 30,  0, 18,  0, 10,  0,  0, 23,  0, 73,  0
+  , 70, 42,  0,  0,  3,  0,  0,  0,  0, 40,  0,  9,  0,  0,  0, 52
+  ,  0, 16, 32,  0,  0,  0,  0,  0, 60,  0,  0,  6, 69,  0,  0,  0
+  };
+
+
 /* Tokens as defined by rfc 2616. Also lowercases them.
  *        token       = 1*<any CHAR except CTLs or separators>
  *     separators     = "(" | ")" | "<" | ">" | "@"
@@ -358,6 +590,34 @@ enum state
 #define PARSING_HEADER(state) (state <= s_headers_done)
 
 
+/* Threaded dispatch.
+ *
+ * Compile with -DHTTP_PARSER_THREADED=1 to have execute() jump straight to
+ * the code for the current state through a table of label addresses (a GNU
+ * C extension) instead of going through the bounds check and jump table of
+ * the switch. The jump lands inside the switch, so `break` and fall through
+ * keep their meaning. GCC won't inline a function with a computed goto, so
+ * in this mode both entry points share one out-of-line copy of execute().
+ */
+#if defined(HTTP_PARSER_THREADED) && HTTP_PARSER_THREADED && \
+  defined(__GNUC__)
+# define THREADED_DISPATCH 1
+# define EXECUTE_INLINE __attribute__((noinline))
+# define CASE(s) case s: L_##s
+# define DISPATCH()                                                  \
+do {                                                                 \
+  if (LIKELY((unsigned int) (CURRENT_STATE() - s_dead) <             \
+             ARRAY_SIZE(dispatch)))                                  \
+    goto *dispatch[CURRENT_STATE() - s_dead];                        \
+} while (0)
+#else
+# define THREADED_DISPATCH 0
+# define EXECUTE_INLINE ALWAYS_INLINE
+# define CASE(s) case s
+# define DISPATCH() do { } while (0)
+#endif
+
+
 enum header_states
   { h_general = 0
   , h_C
@@ -453,175 +713,1477 @@ do {                                                                 \
     goto error;                                                      \
   }                                                                  \
 } while (0)
-# define NEW_MESSAGE() (http_should_keep_alive(parser) ? start_state : s_dead)
+# define NEW_MESSAGE()                                               \
+  (SYNC_OUT(), http_should_keep_alive(parser) ? start_state : s_dead)
 #else
 # define STRICT_CHECK(cond)
 # define NEW_MESSAGE() start_state
 #endif
 
 
-/* Map errno values to strings for human-readable output */
-#define HTTP_STRERROR_GEN(n, s) { "HPE_" #n, s },
-static struct {
-  const char *name;
-  const char *description;
-} http_strerror_tab[] = {
-  HTTP_ERRNO_MAP(HTTP_STRERROR_GEN)
-};
-#undef HTTP_STRERROR_GEN
-
-int http_message_needs_eof(const http_parser *parser);
-
-/* Our URL parser.
+/* Vectorized scanners.
  *
- * This is designed to be shared by http_parser_execute() for URL validation,
- * hence it has a state transition + byte-for-byte interface. In addition, it
- * is meant to be embedded in http_parser_parse_url(), which does the dirty
- * work of turning state transitions URL components for its API.
+ * Most of the bytes we see are in long runs that don't change the state of
+ * the parser (header values, header names, URL paths). On x86 the scanners
+ * below skip over such runs 16 (SSE4.2) or 32 (AVX2) bytes at a time. The
+ * instruction set is picked at runtime; the scalar loops handle the tail of
+ * the buffer and every other platform.
  *
- * This function should only be invoked with non-space characters. It is
- * assumed that the caller cares about (and can detect) the transition between
- * URL and non-URL states by looking for these.
+ * Compile with -DHTTP_PARSER_NO_SIMD to always use the scalar loops.
  */
-static enum state
-parse_url_char(enum state s, const char ch)
+#if !defined(HTTP_PARSER_NO_SIMD) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+# define HTTP_PARSER_SIMD 1
+# include <immintrin.h>
+# define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+# define HTTP_PARSER_SIMD 0
+#endif
+
+enum simd_level
+  { SIMD_NONE = 0
+  , SIMD_SSE42
+  , SIMD_AVX2
+  };
+
+#if HTTP_PARSER_SIMD
+static enum simd_level
+simd_level (void)
 {
-  if (ch == ' ' || ch == '\r' || ch == '\n') {
-    return s_dead;
+  /* Benign race: every thread computes the same value. */
+  static int level = -1;
+
+  if (UNLIKELY(level < 0)) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      level = SIMD_AVX2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+      level = SIMD_SSE42;
+    } else {
+      level = SIMD_NONE;
+    }
   }
 
-#if HTTP_PARSER_STRICT
-  if (ch == '\t' || ch == '\f') {
-    return s_dead;
-  }
-#endif
+  return (enum simd_level) level;
+}
 
-  switch (s) {
-    case s_req_spaces_before_url:
-      /* Proxied requests are followed by scheme of an absolute URI (alpha).
-       * All methods except CONNECT are followed by '/' or '*'.
-       */
+/* Byte ranges rejected by IS_HEADER_CHAR(); CR and LF are included so that
+ * a single compare finds the end of the value as well.
+ */
+static const char header_value_stop_ranges[16] =
+  "\x00\x08" "\x0a\x1f" "\x7f\x7f";
 
-      if (ch == '/' || ch == '*') {
-        return s_req_path;
-      }
+SIMD_TARGET("sse4.2")
+static const char *
+scan_header_value_sse42 (const char *p, const char *end, int lenient)
+{
+  const __m128i ranges =
+    _mm_loadu_si128((const __m128i *) header_value_stop_ranges);
+  const __m128i crlf = _mm_setr_epi8(CR, LF, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0);
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int idx;
+
+    if (lenient) {
+      idx = _mm_cmpestri(crlf, 2, v, 16,
+                         _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                         _SIDD_LEAST_SIGNIFICANT);
+    } else {
+      idx = _mm_cmpestri(ranges, 6, v, 16,
+                         _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                         _SIDD_LEAST_SIGNIFICANT);
+    }
 
-      if (IS_ALPHA(ch)) {
-        return s_req_schema;
-      }
+    if (idx != 16) {
+      return p + idx;
+    }
+  }
 
-      break;
+  return p;
+}
 
-    case s_req_schema:
-      if (IS_ALPHA(ch)) {
-        return s;
-      }
+SIMD_TARGET("avx2")
+static const char *
+scan_header_value_avx2 (const char *p, const char *end, int lenient)
+{
+  const __m256i cr = _mm256_set1_epi8(CR);
+  const __m256i lf = _mm256_set1_epi8(LF);
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i del = _mm256_set1_epi8(127);
+  const __m256i ctl = _mm256_set1_epi8(31);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i stop;
+    unsigned int mask;
+
+    if (lenient) {
+      stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                             _mm256_cmpeq_epi8(v, lf));
+    } else {
+      /* (unsigned) v <= 31 && v != '\t', or v == 127 */
+      stop = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+      stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), stop);
+      stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, del));
+    }
 
-      if (ch == ':') {
-        return s_req_schema_slash;
-      }
+    mask = (unsigned int) _mm256_movemask_epi8(stop);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
 
-      break;
+  return p;
+}
 
-    case s_req_schema_slash:
-      if (ch == '/') {
-        return s_req_schema_slash_slash;
-      }
+/* Token class as a nibble lookup: byte b is a token iff
+ * token_nibble_lo[b & 15] has bit (b >> 4) set. Bytes >= 0x80 have no bit.
+ * Generated from the `tokens` table above; SP is only a token in non-strict
+ * mode, see TOKEN().
+ */
+#if HTTP_PARSER_STRICT
+# define TOKEN_NIBBLE_LO_0 0xe8
+#else
+# define TOKEN_NIBBLE_LO_0 0xec
+#endif
 
-      break;
+static const unsigned char token_nibble_lo[16] =
+  { TOKEN_NIBBLE_LO_0, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc
+  , 0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70 };
 
-    case s_req_schema_slash_slash:
-      if (ch == '/') {
-        return s_req_server_start;
-      }
+#undef TOKEN_NIBBLE_LO_0
 
-      break;
+static const unsigned char token_nibble_hi[16] =
+  { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
+  , 0, 0, 0, 0, 0, 0, 0, 0 };
 
-    case s_req_server_with_at:
-      if (ch == '@') {
-        return s_dead;
-      }
+SIMD_TARGET("sse4.2")
+static const char *
+scan_token_sse42 (const char *p, const char *end, char *out)
+{
+  const __m128i lo_tab = _mm_loadu_si128((const __m128i *) token_nibble_lo);
+  const __m128i hi_tab = _mm_loadu_si128((const __m128i *) token_nibble_hi);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i upper_bias = _mm_set1_epi8(0x80 - 'A');
+  const __m128i upper_max = _mm_set1_epi8(-128 + 'Z' - 'A' + 1);
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i lo = _mm_shuffle_epi8(lo_tab, _mm_and_si128(v, nibble));
+    __m128i hi = _mm_shuffle_epi8(hi_tab,
+                                  _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+    __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero);
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(bad);
+
+    if (out) {
+      /* 'A'..'Z' map to -128..-103 after the bias */
+      __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(v, upper_bias), upper_max);
+      _mm_storeu_si128((__m128i *) out,
+                       _mm_or_si128(v, _mm_and_si128(upper, case_bit)));
+      out += 16;
+    }
 
-    /* fall through */
-    case s_req_server_start:
-    case s_req_server:
-      if (ch == '/') {
-        return s_req_path;
-      }
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
 
-      if (ch == '?') {
-        return s_req_query_string_start;
-      }
+  return p;
+}
 
-      if (ch == '@') {
-        return s_req_server_with_at;
-      }
+SIMD_TARGET("avx2")
+static const char *
+scan_token_avx2 (const char *p, const char *end, char *out)
+{
+  const __m256i lo_tab = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *) token_nibble_lo));
+  const __m256i hi_tab = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *) token_nibble_hi));
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i upper_bias = _mm256_set1_epi8(0x80 - 'A');
+  const __m256i upper_max = _mm256_set1_epi8(-128 + 'Z' - 'A' + 1);
+  const __m256i case_bit = _mm256_set1_epi8(0x20);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i lo = _mm256_shuffle_epi8(lo_tab, _mm256_and_si256(v, nibble));
+    __m256i hi = _mm256_shuffle_epi8(
+        hi_tab, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    __m256i bad = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero);
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(bad);
+
+    if (out) {
+      __m256i upper = _mm256_cmpgt_epi8(upper_max,
+                                        _mm256_add_epi8(v, upper_bias));
+      _mm256_storeu_si256((__m256i *) out,
+                          _mm256_or_si256(v, _mm256_and_si256(upper,
+                                                              case_bit)));
+      out += 32;
+    }
 
-      if (IS_USERINFO_CHAR(ch) || ch == '[' || ch == ']') {
-        return s_req_server;
-      }
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
 
-      break;
+  return p;
+}
 
-    case s_req_path:
-      if (IS_URL_CHAR(ch)) {
-        return s;
-      }
+/* IS_URL_CHAR() as range compares: '!'..'~' except '#' and '?'. Non-strict
+ * mode also lets through HT, FF and anything >= 0x80 (negative as int8).
+ */
+SIMD_TARGET("sse4.2")
+static const char *
+scan_url_sse42 (const char *p, const char *end)
+{
+  const __m128i sp = _mm_set1_epi8(' ');
+  const __m128i del = _mm_set1_epi8(127);
+  const __m128i hash = _mm_set1_epi8('#');
+  const __m128i qmark = _mm_set1_epi8('?');
+#if !HTTP_PARSER_STRICT
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i ff = _mm_set1_epi8('\f');
+#endif
 
-      switch (ch) {
-        case '?':
-          return s_req_query_string_start;
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, sp), _mm_cmplt_epi8(v, del));
+    unsigned int mask;
+
+    ok = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v, hash),
+                                       _mm_cmpeq_epi8(v, qmark)), ok);
+#if !HTTP_PARSER_STRICT
+    ok = _mm_or_si128(ok, _mm_cmplt_epi8(v, zero));
+    ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, tab),
+                                       _mm_cmpeq_epi8(v, ff)));
+#endif
 
-        case '#':
-          return s_req_fragment_start;
-      }
+    mask = ~(unsigned int) _mm_movemask_epi8(ok) & 0xffff;
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
 
-      break;
+  return p;
+}
 
-    case s_req_query_string_start:
-    case s_req_query_string:
-      if (IS_URL_CHAR(ch)) {
-        return s_req_query_string;
-      }
+SIMD_TARGET("avx2")
+static const char *
+scan_url_avx2 (const char *p, const char *end)
+{
+  const __m256i sp = _mm256_set1_epi8(' ');
+  const __m256i del = _mm256_set1_epi8(127);
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i qmark = _mm256_set1_epi8('?');
+#if !HTTP_PARSER_STRICT
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i ff = _mm256_set1_epi8('\f');
+#endif
 
-      switch (ch) {
-        case '?':
-          /* allow extra '?' in query string */
-          return s_req_query_string;
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, sp),
+                                  _mm256_cmpgt_epi8(del, v));
+    unsigned int mask;
+
+    ok = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, hash),
+                                             _mm256_cmpeq_epi8(v, qmark)),
+                             ok);
+#if !HTTP_PARSER_STRICT
+    ok = _mm256_or_si256(ok, _mm256_cmpgt_epi8(zero, v));
+    ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+                                             _mm256_cmpeq_epi8(v, ff)));
+#endif
 
-        case '#':
-          return s_req_fragment_start;
-      }
+    mask = ~(unsigned int) _mm256_movemask_epi8(ok);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
 
-      break;
+  return p;
+}
 
-    case s_req_fragment_start:
-      if (IS_URL_CHAR(ch)) {
-        return s_req_fragment;
-      }
+/* IS_HOST_CHAR() as range compares: letters (compared with the case bit
+ * set), digits, '.' and '-', and '_' in non-strict mode. Bytes >= 0x80 are
+ * negative as int8 and fail every range.
+ */
+SIMD_TARGET("sse4.2")
+static const char *
+scan_host_sse42 (const char *p, const char *end)
+{
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i before_a = _mm_set1_epi8('a' - 1);
+  const __m128i after_z = _mm_set1_epi8('z' + 1);
+  const __m128i before_0 = _mm_set1_epi8('0' - 1);
+  const __m128i after_9 = _mm_set1_epi8('9' + 1);
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i dash = _mm_set1_epi8('-');
+#if !HTTP_PARSER_STRICT
+  const __m128i underscore = _mm_set1_epi8('_');
+#endif
 
-      switch (ch) {
-        case '?':
-          return s_req_fragment;
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i lower = _mm_or_si128(v, case_bit);
+    __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(lower, before_a),
+                               _mm_cmplt_epi8(lower, after_z));
+    unsigned int mask;
+
+    ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(v, before_0),
+                                        _mm_cmplt_epi8(v, after_9)));
+    ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, dot),
+                                       _mm_cmpeq_epi8(v, dash)));
+#if !HTTP_PARSER_STRICT
+    ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, underscore));
+#endif
 
-        case '#':
-          return s;
-      }
+    mask = ~(unsigned int) _mm_movemask_epi8(ok) & 0xffff;
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
 
-      break;
+  return p;
+}
 
-    case s_req_fragment:
-      if (IS_URL_CHAR(ch)) {
-        return s;
-      }
+SIMD_TARGET("avx2")
+static const char *
+scan_host_avx2 (const char *p, const char *end)
+{
+  const __m256i case_bit = _mm256_set1_epi8(0x20);
+  const __m256i before_a = _mm256_set1_epi8('a' - 1);
+  const __m256i after_z = _mm256_set1_epi8('z' + 1);
+  const __m256i before_0 = _mm256_set1_epi8('0' - 1);
+  const __m256i after_9 = _mm256_set1_epi8('9' + 1);
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i dash = _mm256_set1_epi8('-');
+#if !HTTP_PARSER_STRICT
+  const __m256i underscore = _mm256_set1_epi8('_');
+#endif
 
-      switch (ch) {
-        case '?':
-        case '#':
-          return s;
-      }
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i lower = _mm256_or_si256(v, case_bit);
+    __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(lower, before_a),
+                                  _mm256_cmpgt_epi8(after_z, lower));
+    unsigned int mask;
+
+    ok = _mm256_or_si256(ok, _mm256_and_si256(_mm256_cmpgt_epi8(v, before_0),
+                                              _mm256_cmpgt_epi8(after_9, v)));
+    ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(v, dot),
+                                             _mm256_cmpeq_epi8(v, dash)));
+#if !HTTP_PARSER_STRICT
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, underscore));
+#endif
 
-      break;
+    mask = ~(unsigned int) _mm256_movemask_epi8(ok);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return p;
+}
+
+/* The bytes http_parser_normalize_path() has to look at: '%', and a '/'
+ * followed by '/' or '.', found by comparing each block with itself one
+ * byte on. With `all_slashes`, any '/' instead of just those.
+ */
+SIMD_TARGET("sse4.2")
+static const char *
+scan_path_sse42 (const char *p, const char *end, int all_slashes)
+{
+  const __m128i pct = _mm_set1_epi8('%');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i dot = _mm_set1_epi8('.');
+
+  for (; end - p >= 17; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i stop = _mm_cmpeq_epi8(v, slash);
+    unsigned int mask;
+
+    if (!all_slashes) {
+      __m128i next = _mm_loadu_si128((const __m128i *) (p + 1));
+      stop = _mm_and_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(next, slash),
+                                              _mm_cmpeq_epi8(next, dot)));
+    }
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, pct));
+
+    mask = (unsigned int) _mm_movemask_epi8(stop);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return p;
+}
+
+SIMD_TARGET("avx2")
+static const char *
+scan_path_avx2 (const char *p, const char *end, int all_slashes)
+{
+  const __m256i pct = _mm256_set1_epi8('%');
+  const __m256i slash = _mm256_set1_epi8('/');
+  const __m256i dot = _mm256_set1_epi8('.');
+
+  for (; end - p >= 33; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i stop = _mm256_cmpeq_epi8(v, slash);
+    unsigned int mask;
+
+    if (!all_slashes) {
+      __m256i next = _mm256_loadu_si256((const __m256i *) (p + 1));
+      stop = _mm256_and_si256(stop,
+                              _mm256_or_si256(_mm256_cmpeq_epi8(next, slash),
+                                              _mm256_cmpeq_epi8(next, dot)));
+    }
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, pct));
+
+    mask = (unsigned int) _mm256_movemask_epi8(stop);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return p;
+}
+
+SIMD_TARGET("sse4.2")
+static const char *
+scan_either_sse42 (const char *p, const char *end, char a, char b)
+{
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return p;
+}
+
+SIMD_TARGET("avx2")
+static const char *
+scan_either_avx2 (const char *p, const char *end, char a, char b)
+{
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return p;
+}
+#endif /* HTTP_PARSER_SIMD */
+
+/* Returns a pointer to the first CR, LF or (unless `lenient`) invalid header
+ * byte in [p, end), or `end` if there is none.
+ */
+static const char *
+scan_header_value (const char *p, const char *end, int lenient)
+{
+#if HTTP_PARSER_SIMD
+  switch (simd_level()) {
+    case SIMD_AVX2:
+      p = scan_header_value_avx2(p, end, lenient);
+      break;
+    case SIMD_SSE42:
+      p = scan_header_value_sse42(p, end, lenient);
+      break;
+    default:
+      break;
+  }
+#endif
+
+  for (; p != end; p++) {
+    if (*p == CR || *p == LF) {
+      break;
+    }
+
+    if (!lenient && !IS_HEADER_CHAR(*p)) {
+      break;
+    }
+  }
+
+  return p;
+}
+
+/* Returns a pointer to the first byte in [p, end) that is not a TOKEN(), or
+ * `end` if there is none. If `out` is not NULL the token is also written to
+ * it, lowercased; `out` must have room for `end - p` bytes.
+ */
+static const char *
+scan_token (const char *p, const char *end, char *out)
+{
+  const char *start = p;
+
+#if HTTP_PARSER_SIMD
+  switch (simd_level()) {
+    case SIMD_AVX2:
+      p = scan_token_avx2(p, end, out);
+      break;
+    case SIMD_SSE42:
+      p = scan_token_sse42(p, end, out);
+      break;
+    default:
+      break;
+  }
+#endif
+
+  if (out) {
+    out += p - start;
+  }
+
+  for (; p != end; p++) {
+    char c = TOKEN(*p);
+
+    if (!c) {
+      break;
+    }
+
+    if (out) {
+      *out++ = c;
+    }
+  }
+
+  return p;
+}
+
+/* Returns a pointer to the first byte in [p, end) that fails IS_URL_CHAR(),
+ * i.e. '?', '#', whitespace or an invalid byte, or `end` if there is none.
+ */
+static const char *
+scan_url (const char *p, const char *end)
+{
+#if HTTP_PARSER_SIMD
+  switch (simd_level()) {
+    case SIMD_AVX2:
+      p = scan_url_avx2(p, end);
+      break;
+    case SIMD_SSE42:
+      p = scan_url_sse42(p, end);
+      break;
+    default:
+      break;
+  }
+#endif
+
+  while (p != end && IS_URL_CHAR(*p)) {
+    p++;
+  }
+
+  return p;
+}
+
+/* Returns a pointer to the first byte in [p, end) that fails
+ * IS_HOST_CHAR(), or `end` if there is none.
+ */
+static const char *
+scan_host (const char *p, const char *end)
+{
+#if HTTP_PARSER_SIMD
+  switch (simd_level()) {
+    case SIMD_AVX2:
+      p = scan_host_avx2(p, end);
+      break;
+    case SIMD_SSE42:
+      p = scan_host_sse42(p, end);
+      break;
+    default:
+      break;
+  }
+#endif
+
+  while (p != end && IS_HOST_CHAR(*p)) {
+    p++;
+  }
+
+  return p;
+}
+
+/* Returns a pointer to the first '%' in [p, end), or '/' if `all_slashes`,
+ * or else '/' followed by '/' or '.'; or `end` if there is none.
+ */
+static const char *
+scan_path (const char *p, const char *end, int all_slashes)
+{
+#if HTTP_PARSER_SIMD
+  switch (simd_level()) {
+    case SIMD_AVX2:
+      p = scan_path_avx2(p, end, all_slashes);
+      break;
+    case SIMD_SSE42:
+      p = scan_path_sse42(p, end, all_slashes);
+      break;
+    default:
+      break;
+  }
+#endif
+
+  for (; p != end; p++) {
+    if (*p == '%') {
+      break;
+    }
+
+    if (*p == '/' &&
+        (all_slashes || (end - p > 1 && (p[1] == '/' || p[1] == '.')))) {
+      break;
+    }
+  }
+
+  return p;
+}
+
+
+/* Word-at-a-time helpers. Loads are assembled byte by byte so that the
+ * result doesn't depend on host endianness; compilers turn this into a
+ * single load on little-endian targets.
+ */
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+
+static uint64_t
+load_le64 (const char *p)
+{
+  const unsigned char *u = (const unsigned char *) p;
+
+  return (uint64_t) u[0]       | (uint64_t) u[1] << 8  |
+         (uint64_t) u[2] << 16 | (uint64_t) u[3] << 24 |
+         (uint64_t) u[4] << 32 | (uint64_t) u[5] << 40 |
+         (uint64_t) u[6] << 48 | (uint64_t) u[7] << 56;
+}
+
+/* Index of the lowest set bit; `x` must not be zero */
+static unsigned int
+ctz64 (uint64_t x)
+{
+#ifdef __GNUC__
+  return (unsigned int) __builtin_ctzll(x);
+#else
+  unsigned int n = 0;
+
+  while (!(x & 1)) {
+    x >>= 1;
+    n++;
+  }
+
+  return n;
+#endif
+}
+
+/* Recognize the request method at `p`, which must have at least 8 readable
+ * bytes. Finds the first space with a SWAR zero-byte test, then looks the
+ * masked word up in method_hash. Returns the length of the method and
+ * stores it in `method`, or returns 0 if the method is longer than 7
+ * characters, unknown, or not followed by a space.
+ */
+static unsigned int
+match_method_word (const char *p, enum http_method *method)
+{
+  uint64_t w = load_le64(p);
+  uint64_t x = w ^ (SWAR_ONES * ' ');
+  uint64_t spaces = (x - SWAR_ONES) & ~x & SWAR_HIGHS;
+  unsigned int n;
+  unsigned char m;
+
+  if (spaces == 0) {
+    return 0;
+  }
+
+  /* The lowest flagged byte is always a real space */
+  n = ctz64(spaces) / 8;
+  if (n < 7) {
+    w &= ((uint64_t) 1 << (8 * (n + 1))) - 1;
+  }
+
+  m = method_hash[(w * METHOD_HASH_MAGIC) >> 58];
+  if (m == METHOD_NONE ||
+      strlen(method_strings[m]) != n ||
+      memcmp(p, method_strings[m], n) != 0) {
+    return 0;
+  }
+
+  *method = (enum http_method) m;
+  return n;
+}
+
+/* High bit of each byte of `x` that is in [m, n], for m >= 1 and n <= 126
+ * (Hacker's Delight 6-1, exact for every byte value)
+ */
+#define SWAR_BETWEEN(x, m, n)                                        \
+  ((SWAR_ONES * (127 + (n) + 1) - ((x) & SWAR_ONES * 127)) & ~(x) &  \
+   (((x) & SWAR_ONES * 127) + SWAR_ONES * (127 - ((m) - 1))) &       \
+   SWAR_HIGHS)
+
+/* "HTTP/1.1" and "HTTP/1.0" as loaded by load_le64() */
+#define HTTP_1_1_WORD 0x312e312f50545448ULL
+#define HTTP_1_0_WORD 0x302e312f50545448ULL
+
+/* Match "HTTP/1.1" or "HTTP/1.0" at `p`, which must have 8 readable bytes,
+ * and store the version. Returns 0 for anything else, which is left to the
+ * byte-at-a-time states.
+ */
+static int
+match_version_word (const char *p, http_parser *parser)
+{
+  uint64_t w = load_le64(p);
+
+  if (w != HTTP_1_1_WORD && w != HTTP_1_0_WORD) {
+    return 0;
+  }
+
+  parser->http_major = 1;
+  parser->http_minor = w == HTTP_1_1_WORD;
+  return 1;
+}
+
+/* Match "HTTP/1.x NNN" at `p` and store the version and status code.
+ * Returns the offset of the last status digit, or 0 if fewer than 12 bytes
+ * are left or they don't match.
+ */
+static unsigned int
+match_status_line (const char *p, const char *end, http_parser *parser)
+{
+  const unsigned char *u = (const unsigned char *) p + 9;
+  uint32_t d;
+
+  if (end - p < 12 || p[8] != ' ' || !match_version_word(p, parser)) {
+    return 0;
+  }
+
+  /* All three digits at once: a byte below '0' wraps and one above '9'
+   * carries into its high bit
+   */
+  d = ((uint32_t) u[0] | (uint32_t) u[1] << 8 | (uint32_t) u[2] << 16) -
+      0x303030;
+  if ((d | (d + 0x767676)) & 0x808080) {
+    return 0;
+  }
+
+  parser->status_code = (d & 0xff) * 100 + (d >> 8 & 0xff) * 10 + (d >> 16);
+  return 11;
+}
+
+/* The value of `n` (1 to 8) decimal digits at the bottom of `w`, first
+ * digit lowest. Shifts the digits to the top and combines pairs of digits,
+ * then of pairs, then of quads, in three multiplies.
+ */
+static uint64_t
+decimal_word_value (uint64_t w, unsigned int n)
+{
+  w &= SWAR_ONES * 0x0f;
+  w <<= 8 * (8 - n);
+
+  w = (w * 10 + (w >> 8)) & 0x00ff00ff00ff00ffULL;
+  w = (w * 100 + (w >> 16)) & 0x0000ffff0000ffffULL;
+  w = (w * 10000 + (w >> 32)) & 0x00000000ffffffffULL;
+  return w;
+}
+
+/* Decode up to 16 decimal digits at `p` a word at a time, for
+ * Content-Length. Needs 8 readable bytes, and 16 to go past the eighth
+ * digit. Returns the number of digits and stores their value, or returns 0
+ * if there is no digit or too few bytes. The caller checks any further
+ * digits for overflow; 16 of them always fit.
+ */
+static unsigned int
+parse_decimal_word (const char *p, const char *end, uint64_t *value)
+{
+  static const uint64_t pow10[9] =
+    { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+  uint64_t w, digits, v;
+  unsigned int n;
+
+  if (end - p < 8) {
+    return 0;
+  }
+
+  w = load_le64(p);
+  digits = SWAR_BETWEEN(w, '0', '9');
+  if (digits != SWAR_HIGHS) {
+    n = ctz64(~digits & SWAR_HIGHS) / 8;
+    if (n != 0) {
+      *value = decimal_word_value(w, n);
+    }
+    return n;
+  }
+
+  v = decimal_word_value(w, 8);
+  n = 0;
+  if (end - p >= 16) {
+    w = load_le64(p + 8);
+    digits = SWAR_BETWEEN(w, '0', '9');
+    n = digits == SWAR_HIGHS ? 8 : ctz64(~digits & SWAR_HIGHS) / 8;
+    if (n != 0) {
+      v = v * pow10[n] + decimal_word_value(w, n);
+    }
+  }
+
+  *value = v;
+  return 8 + n;
+}
+
+/* Decode the port number at `p` a word at a time. Reads at most 8 bytes,
+ * none past `end`. Returns the number of digits and stores the port, or
+ * returns 0 if there is no digit, more than 7 of them or the port doesn't
+ * fit in 16 bits.
+ */
+static unsigned int
+parse_port (const char *p, const char *end, uint16_t *port)
+{
+  char word[8] = { 0 };
+  uint64_t w, digits, v;
+  unsigned int n;
+
+  memcpy(word, p, MIN((size_t) (end - p), sizeof(word)));
+  w = load_le64(word);
+  digits = SWAR_BETWEEN(w, '0', '9');
+  if (digits == SWAR_HIGHS) {
+    return 0;
+  }
+
+  n = ctz64(~digits & SWAR_HIGHS) / 8;
+  if (n == 0) {
+    return 0;
+  }
+
+  v = decimal_word_value(w, n);
+  if (v > 0xffff) {
+    return 0;
+  }
+
+  *port = (uint16_t) v;
+  return n;
+}
+
+/* Decode the chunk-size line at `p` a word at a time. Only the common form
+ * is taken: 1 to 7 hex digits followed by CRLF, all before `end`. Returns
+ * the offset of the LF and stores the size, or returns 0 to leave the line
+ * (extensions, longer sizes, bad input, too few bytes) to the byte-at-a-time
+ * states.
+ */
+static unsigned int
+parse_chunk_size_word (const char *p, const char *end, uint64_t *size)
+{
+  uint64_t w, lower, hex, v;
+  unsigned int n;
+
+  if (end - p < 9) {
+    return 0;
+  }
+
+  w = load_le64(p);
+  lower = w | (SWAR_ONES * 0x20);
+  hex = SWAR_BETWEEN(w, '0', '9') | SWAR_BETWEEN(lower, 'a', 'f');
+  if (hex == SWAR_HIGHS) {
+    return 0;
+  }
+
+  n = ctz64(~hex & SWAR_HIGHS) / 8;
+  if (n == 0 || p[n] != CR || p[n + 1] != LF) {
+    return 0;
+  }
+
+  /* Nibble values, most significant digit first in the top n bytes */
+  v = (w & (SWAR_ONES * 0x0f)) + 9 * ((w >> 6) & SWAR_ONES);
+  v <<= 8 * (8 - n);
+
+  /* Pack pairs of nibbles, then of bytes, then of halfwords */
+  v = ((v << 4) | (v >> 8)) & 0x00ff00ff00ff00ffULL;
+  v = ((v << 8) | (v >> 16)) & 0x0000ffff0000ffffULL;
+  v = ((v << 16) | (v >> 32)) & 0x00000000ffffffffULL;
+
+  *size = v;
+  return n + 1;
+}
+
+
+/* Well-known header ids. A name that is entirely in the buffer is looked
+ * up with one probe of header_hash. A name split across calls is matched
+ * incrementally instead: parser->header_id holds the first well-known name
+ * that starts with the bytes seen so far, and parser->index the position
+ * of the last of them, the same as for the h_matching_* states.
+ */
+static enum http_header_id
+header_lookup (const char *p, size_t len)
+{
+  const char *s;
+  uint64_t key;
+  unsigned int id;
+  size_t i;
+  char c;
+
+  if (len < 2) {
+    return HTTP_HEADER_OTHER;
+  }
+
+  key = (uint64_t) LOWER(p[0]) |
+        (uint64_t) LOWER(p[1]) << 8 |
+        (uint64_t) LOWER(p[len - 2]) << 16 |
+        (uint64_t) LOWER(p[len - 1]) << 24 |
+        (uint64_t) len << 32;
+  id = header_hash[(key * HEADER_HASH_MAGIC) >> 56];
+  if (id == HTTP_HEADER_OTHER) {
+    return HTTP_HEADER_OTHER;
+  }
+
+  /* tokens[] rather than LOWER(), which would turn CR into '-'. A zero
+   * (non-token) byte must not match the end of `s` either.
+   */
+  s = header_strings[id];
+  for (i = 0; i < len; i++) {
+    c = tokens[(unsigned char) p[i]];
+    if (c == 0 || c != s[i]) {
+      return HTTP_HEADER_OTHER;
+    }
+  }
+
+  return s[len] == '\0' ? (enum http_header_id) id : HTTP_HEADER_OTHER;
+}
+
+/* Narrow `id`, the first well-known name starting with the `pos` bytes
+ * already seen, by the bytes [p, end). Names sharing a prefix are adjacent
+ * in header_strings and ordered by their next byte.
+ */
+static unsigned int
+header_extend (unsigned int id, size_t pos, const char *p, const char *end)
+{
+  const char *s;
+  unsigned char c;
+
+  for (; p != end && id != HTTP_HEADER_OTHER; p++, pos++) {
+    c = (unsigned char) tokens[(unsigned char) *p];
+    if (c == 0) {
+      return HTTP_HEADER_OTHER;
+    }
+    s = header_strings[id];
+
+    while ((unsigned char) s[pos] < c) {
+      if (++id == ARRAY_SIZE(header_strings) ||
+          strncmp(header_strings[id], s, pos) != 0) {
+        return HTTP_HEADER_OTHER;
+      }
+      s = header_strings[id];
+    }
+
+    if ((unsigned char) s[pos] != c) {
+      return HTTP_HEADER_OTHER;
+    }
+  }
+
+  return id;
+}
+
+
+/* Complete-message fast path.
+ *
+ * When a request line or header line is entirely in the buffer,
+ * scan_request_line() and scan_header_line() validate it in straight-line
+ * code without touching the parser. http_parser_execute() then makes the
+ * callbacks the state machine would have made for that line. Anything
+ * unusual (HTTP/0.9, bare LF, line folding, empty values, multi-token
+ * Connection values, ...) is left to the state machine, starting at the
+ * beginning of the offending line.
+ */
+struct head_line {
+  const char *name_end;       /* the ':' */
+  const char *value;          /* first byte after leading whitespace */
+  const char *value_end;      /* the CR */
+  enum header_states name_state;  /* header_state after the name */
+  enum header_states value_state; /* header_state after the value */
+  enum http_header_id id;
+  uint64_t content_length;
+};
+
+/* Compare `len` bytes at `p` to the lowercase literal `lit` */
+static int
+lower_eq (const char *p, size_t len, const char *lit, size_t lit_len)
+{
+  size_t i;
+
+  if (len != lit_len) {
+    return 0;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (LOWER(p[i]) != (unsigned char) lit[i]) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+#define LOWER_EQ(p, len, lit) lower_eq((p), (len), (lit), sizeof(lit) - 1)
+
+/* Validates "<origin-form URL> HTTP/x.y\r\n" starting at `p`. Returns a
+ * pointer to the LF and sets `url_end` to the space after the URL, `query`
+ * to its first '?' before any '#' and `fragment` to its first '#' (or NULL),
+ * or returns NULL if the line is incomplete or needs the state machine.
+ */
+static const char *
+scan_request_line (const char *p, const char *end, const char **url_end,
+                   const char **query, const char **fragment)
+{
+  *query = NULL;
+  *fragment = NULL;
+
+  if (p == end || *p != '/') {
+    return NULL;
+  }
+
+  /* '?' and '#' are valid in every state after the leading '/'. Note the
+   * first '?' before any '#' and the first '#' for url_split_origin().
+   */
+  for (p++; ; p++) {
+    p = scan_url(p, end);
+    if (p == end) {
+      return NULL;
+    }
+    if (*p == '#') {
+      if (*fragment == NULL) {
+        *fragment = p;
+      }
+    } else if (*p == '?') {
+      if (*query == NULL && *fragment == NULL) {
+        *query = p;
+      }
+    } else {
+      break;
+    }
+  }
+
+  if (end - p < 11 ||
+      p[0] != ' ' ||
+      memcmp(p + 1, "HTTP/", 5) != 0 ||
+      !IS_NUM(p[6]) || p[7] != '.' || !IS_NUM(p[8]) ||
+      p[9] != CR || p[10] != LF) {
+    return NULL;
+  }
+
+  *url_end = p;
+  return p + 10;
+}
+
+/* Validates "<name>:<ws><value>\r\n" starting at `p` and works out the
+ * header states the state machine would have gone through. Also needs the
+ * first byte of the next line to rule out line folding. Returns 0 if the
+ * line is incomplete or needs the state machine.
+ */
+static int
+scan_header_line (const char *p, const char *end, int lenient,
+                  struct head_line *h)
+{
+  const char *name = p;
+  const char *value;
+  size_t name_len, value_len;
+
+  p = scan_token(p, end, NULL);
+  if (p == name || p == end || *p != ':') {
+    return 0;
+  }
+
+#if !HTTP_PARSER_STRICT
+  /* "Connection :" still matches in non-strict mode */
+  if (p[-1] == ' ') {
+    return 0;
+  }
+#endif
+
+  h->name_end = p;
+  name_len = p - name;
+
+  for (p++; p != end && (*p == ' ' || *p == '\t'); p++);
+  if (p == end || *p == CR || *p == LF) {
+    return 0;
+  }
+
+  value = p;
+  p = scan_header_value(p, end, lenient);
+  if (end - p < 3 || p[0] != CR || p[1] != LF ||
+      p[2] == ' ' || p[2] == '\t') {
+    return 0;
+  }
+
+  h->value = value;
+  h->value_end = p;
+  value_len = p - value;
+
+  h->name_state = h_general;
+  h->value_state = h_general;
+  h->content_length = 0;
+  h->id = header_lookup(name, name_len);
+
+  if (h->id == HTTP_HEADER_CONNECTION ||
+      h->id == HTTP_HEADER_PROXY_CONNECTION) {
+    h->name_state = h_connection;
+    if (LOWER_EQ(value, value_len, KEEP_ALIVE)) {
+      h->value_state = h_connection_keep_alive;
+    } else if (LOWER_EQ(value, value_len, CLOSE)) {
+      h->value_state = h_connection_close;
+    } else if (LOWER_EQ(value, value_len, UPGRADE)) {
+      h->value_state = h_connection_upgrade;
+    } else {
+      return 0;
+    }
+  } else if (h->id == HTTP_HEADER_CONTENT_LENGTH) {
+    uint64_t v = 0;
+
+    /* 18 digits can't overflow */
+    if (value_len > 18) {
+      return 0;
+    }
+
+    for (p = value; p != h->value_end; p++) {
+      if (!IS_NUM(*p)) {
+        return 0;
+      }
+      v = v * 10 + (*p - '0');
+    }
+
+    h->name_state = h_content_length;
+    h->value_state = h_content_length_num;
+    h->content_length = v;
+  } else if (h->id == HTTP_HEADER_TRANSFER_ENCODING) {
+    h->name_state = h_transfer_encoding;
+    if (LOWER_EQ(value, value_len, CHUNKED)) {
+      h->value_state = h_transfer_encoding_chunked;
+    } else if (LOWER(*value) == 'c') {
+      return 0;
+    }
+  } else if (h->id == HTTP_HEADER_UPGRADE) {
+    h->name_state = h_upgrade;
+  }
+
+  return 1;
+}
+
+
+/* Header index.
+ *
+ * http_parser_execute_head() runs the state machine with a non-NULL `head`,
+ * which turns the url, status, header_field and header_value callbacks into
+ * stores of buffer offsets. Fragments of one element arrive back to back in
+ * the caller's buffer, so each store either extends the element it belongs
+ * to or opens the next one.
+ */
+static void
+head_reset (struct http_parser_head *head)
+{
+  head->url_off = 0;
+  head->url_len = 0;
+  memset(&head->url, 0, sizeof(head->url));
+  head->url_host = s_http_host_start;
+  head->status_off = 0;
+  head->status_len = 0;
+  head->nheaders = 0;
+}
+
+/* Record `len` bytes at offset `off` into the current call's data. Returns
+ * nonzero if there is no room left for another header.
+ */
+static int
+head_store (struct http_parser_head *head, enum http_errno cb,
+            size_t off, size_t len, unsigned int id)
+{
+  struct http_parser_header *h;
+  uint32_t o = head->base + (uint32_t) off;
+
+  switch (cb) {
+    case HPE_CB_url:
+      if (head->url_len == 0) {
+        head->url_off = o;
+      }
+      head->url_len = o + (uint32_t) len - head->url_off;
+      return 0;
+
+    case HPE_CB_status:
+      if (head->status_len == 0) {
+        head->status_off = o;
+      }
+      head->status_len = o + (uint32_t) len - head->status_off;
+      return 0;
+
+    case HPE_CB_header_field:
+      if (head->nheaders > 0) {
+        h = head->headers + head->nheaders - 1;
+        if (h->value_len == 0 && h->name_off + h->name_len == o) {
+          h->name_len += (uint32_t) len;
+          h->id = id;
+          return 0;
+        }
+      }
+      if (head->nheaders == head->max_headers) {
+        return 1;
+      }
+      h = head->headers + head->nheaders++;
+      h->name_off = o;
+      h->name_len = (uint32_t) len;
+      h->value_off = 0;
+      h->value_len = 0;
+      h->id = id;
+      return 0;
+
+    case HPE_CB_header_value:
+      /* Continuation lines are folded into one run, line breaks included */
+      assert(head->nheaders > 0);
+      h = head->headers + head->nheaders - 1;
+      if (h->value_len == 0) {
+        h->value_off = o;
+      }
+      h->value_len = o + (uint32_t) len - h->value_off;
+      return 0;
+
+    default:
+      assert(0 && "unexpected head element");
+      return 0;
+  }
+}
+
+
+/* Record the start (message_begin) or end (message_complete) of a message
+ * at offset `off` into the current call's data, just past the byte that
+ * triggered it. Pauses the parser at the end of every message, so that
+ * http_parser_execute_batch() sees each boundary, and at the start of one
+ * that doesn't fit.
+ */
+static void
+batch_message (struct http_parser_batch *batch, http_parser *parser,
+               enum http_errno cb, size_t off)
+{
+  struct http_parser_message *m = batch->messages + batch->nmessages;
+
+  if (cb == HPE_CB_message_begin) {
+    if (batch->nmessages == batch->max_messages) {
+      parser->http_errno = HPE_PAUSED;
+      return;
+    }
+    memset(m, 0, sizeof(*m));
+    m->start = batch->base + (uint32_t) off - 1;
+    m->body_first = batch->nbodies;
+    return;
+  }
+
+  assert(cb == HPE_CB_message_complete);
+  assert(batch->nmessages < batch->max_messages);
+  m->end = batch->base + (uint32_t) off;
+  m->status_code = parser->status_code;
+  m->method = parser->method;
+  m->http_major = parser->http_major;
+  m->http_minor = parser->http_minor;
+  m->keep_alive = http_should_keep_alive(parser) != 0;
+  m->upgrade = parser->upgrade;
+  batch->nmessages++;
+  parser->http_errno = HPE_PAUSED;
+}
+
+/* Record `len` body bytes at offset `off` into the current call's data.
+ * Returns nonzero if there is no room for another span.
+ */
+static int
+batch_body (struct http_parser_batch *batch, size_t off, size_t len)
+{
+  struct http_parser_message *m = batch->messages + batch->nmessages;
+  struct http_parser_span *b = batch->bodies + batch->nbodies;
+  uint32_t o = batch->base + (uint32_t) off;
+
+  if (m->body_count > 0 && b[-1].off + b[-1].len == o) {
+    b[-1].len += (uint32_t) len;
+    return 0;
+  }
+  if (batch->nbodies == batch->max_bodies) {
+    return 1;
+  }
+  b->off = o;
+  b->len = (uint32_t) len;
+  batch->nbodies++;
+  m->body_count++;
+  return 0;
+}
+
+/* Map errno values to strings for human-readable output */
+#define HTTP_STRERROR_GEN(n, s) { "HPE_" #n, s },
+static struct {
+  const char *name;
+  const char *description;
+} http_strerror_tab[] = {
+  HTTP_ERRNO_MAP(HTTP_STRERROR_GEN)
+};
+#undef HTTP_STRERROR_GEN
+
+int http_message_needs_eof(const http_parser *parser);
+
+/* Our URL parser.
+ *
+ * This is designed to be shared by http_parser_execute() for URL validation,
+ * hence it has a state transition + byte-for-byte interface. In addition, it
+ * is meant to be embedded in http_parser_parse_url(), which does the dirty
+ * work of turning state transitions URL components for its API.
+ *
+ * This function should only be invoked with non-space characters. It is
+ * assumed that the caller cares about (and can detect) the transition between
+ * URL and non-URL states by looking for these.
+ */
+static enum state
+parse_url_char(enum state s, const char ch)
+{
+  if (ch == ' ' || ch == '\r' || ch == '\n') {
+    return s_dead;
+  }
+
+#if HTTP_PARSER_STRICT
+  if (ch == '\t' || ch == '\f') {
+    return s_dead;
+  }
+#endif
+
+  switch (s) {
+    case s_req_spaces_before_url:
+      /* Proxied requests are followed by scheme of an absolute URI (alpha).
+       * All methods except CONNECT are followed by '/' or '*'.
+       */
+
+      if (ch == '/' || ch == '*') {
+        return s_req_path;
+      }
+
+      if (IS_ALPHA(ch)) {
+        return s_req_schema;
+      }
+
+      break;
+
+    case s_req_schema:
+      if (IS_ALPHA(ch)) {
+        return s;
+      }
+
+      if (ch == ':') {
+        return s_req_schema_slash;
+      }
+
+      break;
+
+    case s_req_schema_slash:
+      if (ch == '/') {
+        return s_req_schema_slash_slash;
+      }
+
+      break;
+
+    case s_req_schema_slash_slash:
+      if (ch == '/') {
+        return s_req_server_start;
+      }
+
+      break;
+
+    case s_req_server_with_at:
+      if (ch == '@') {
+        return s_dead;
+      }
+
+    /* fall through */
+    case s_req_server_start:
+    case s_req_server:
+      if (ch == '/') {
+        return s_req_path;
+      }
+
+      if (ch == '?') {
+        return s_req_query_string_start;
+      }
+
+      if (ch == '@') {
+        return s_req_server_with_at;
+      }
+
+      if (IS_USERINFO_CHAR(ch) || ch == '[' || ch == ']') {
+        return s_req_server;
+      }
+
+      break;
+
+    case s_req_path:
+      if (IS_URL_CHAR(ch)) {
+        return s;
+      }
+
+      switch (ch) {
+        case '?':
+          return s_req_query_string_start;
+
+        case '#':
+          return s_req_fragment_start;
+      }
+
+      break;
+
+    case s_req_query_string_start:
+    case s_req_query_string:
+      if (IS_URL_CHAR(ch)) {
+        return s_req_query_string;
+      }
+
+      switch (ch) {
+        case '?':
+          /* allow extra '?' in query string */
+          return s_req_query_string;
+
+        case '#':
+          return s_req_fragment_start;
+      }
+
+      break;
+
+    case s_req_fragment_start:
+      if (IS_URL_CHAR(ch)) {
+        return s_req_fragment;
+      }
+
+      switch (ch) {
+        case '?':
+          return s_req_fragment;
+
+        case '#':
+          return s;
+      }
+
+      break;
+
+    case s_req_fragment:
+      if (IS_URL_CHAR(ch)) {
+        return s;
+      }
+
+      switch (ch) {
+        case '?':
+        case '#':
+          return s;
+      }
+
+      break;
 
     default:
       break;
@@ -631,10 +2193,308 @@ parse_url_char(enum state s, const char ch)
   return s_dead;
 }
 
-size_t http_parser_execute (http_parser *parser,
-                            const http_parser_settings *settings,
-                            const char *data,
-                            size_t len)
+/* Single-pass URL splitting.
+ *
+ * http_parser_parse_url() walks the URL twice: once for the fields, and
+ * again over the host for userinfo, host and port. The functions below do
+ * the same work a byte at a time alongside parse_url_char(), so that
+ * http_parser_execute_head() can fill in a struct http_parser_url32 as the
+ * URL streams past, and http_parser_parse_url32() is a single loop.
+ *
+ * The host part is only known to start with userinfo once its '@' shows
+ * up, so it is parsed as a host from the start and restarted at the '@'.
+ * `host` holds the http_host_state, plus URL_NOT_USERINFO once a byte was
+ * seen that userinfo can't contain and URL_FOUND_AT after the '@'.
+ */
+#define URL_NOT_USERINFO 0x80
+#define URL_FOUND_AT     0x40
+#define URL_HOST_FLAGS   (URL_NOT_USERINFO | URL_FOUND_AT)
+
+static enum http_host_state
+http_parse_host_char(enum http_host_state s, const char ch);
+
+static enum http_parser_url_fields
+url_field (enum state s)
+{
+  switch (s) {
+    case s_req_schema:          return UF_SCHEMA;
+    case s_req_server:
+    case s_req_server_with_at:  return UF_HOST;
+    case s_req_path:            return UF_PATH;
+    case s_req_query_string:    return UF_QUERY;
+    case s_req_fragment:        return UF_FRAGMENT;
+    default:                    return UF_MAX;
+  }
+}
+
+/* Byte `ch` at offset `o` of a host part */
+static void
+url_host_char (struct http_parser_url32 *u, uint8_t *host, uint32_t o,
+               const char ch)
+{
+  enum http_host_state s = (enum http_host_state) (*host & ~URL_HOST_FLAGS);
+  enum http_host_state new_s;
+  uint32_t port;
+
+  if ((u->field_set & (1 << UF_HOST)) == 0) {
+    u->field_set |= (1 << UF_HOST);
+    u->field_data[UF_USERINFO].off = o;
+  }
+
+  if (ch == '@') {
+    if (*host & URL_HOST_FLAGS) {
+      *host = s_http_host_dead | URL_FOUND_AT;
+      return;
+    }
+
+    if (o > u->field_data[UF_USERINFO].off) {
+      u->field_data[UF_USERINFO].len = o - u->field_data[UF_USERINFO].off;
+      u->field_set |= (1 << UF_USERINFO);
+    }
+    u->field_set &= ~(1 << UF_PORT);
+    u->field_data[UF_HOST].len = 0;
+    u->port = 0;
+    *host = s_http_host_start | URL_FOUND_AT;
+    return;
+  }
+
+  if (!IS_USERINFO_CHAR(ch)) {
+    *host |= URL_NOT_USERINFO;
+  }
+
+  new_s = http_parse_host_char(s, ch);
+  switch (new_s) {
+    case s_http_host:
+    case s_http_host_v6:
+      if (s != new_s) {
+        u->field_data[UF_HOST].off = o;
+        u->field_data[UF_HOST].len = 0;
+      }
+      u->field_data[UF_HOST].len++;
+      break;
+
+    case s_http_host_v6_zone_start:
+    case s_http_host_v6_zone:
+      u->field_data[UF_HOST].len++;
+      break;
+
+    case s_http_host_port:
+      if (s != s_http_host_port) {
+        u->field_data[UF_PORT].off = o;
+        u->field_data[UF_PORT].len = 0;
+        u->field_set |= (1 << UF_PORT);
+        u->port = 0;
+      }
+      u->field_data[UF_PORT].len++;
+
+      /* Ports have a max value of 2^16 */
+      port = u->port * 10 + (ch - '0');
+      if (port > 0xffff) {
+        new_s = s_http_host_dead;
+      }
+      u->port = (uint16_t) port;
+      break;
+
+    default:
+      break;
+  }
+
+  *host = (uint8_t) (new_s | (*host & URL_HOST_FLAGS));
+}
+
+/* parse_url_char() took byte `ch` at offset `o` from state `from` to `to` */
+static void
+url_split_char (struct http_parser_url32 *u, uint8_t *host,
+                enum state from, enum state to, uint32_t o, const char ch)
+{
+  enum http_parser_url_fields old_uf = url_field(from);
+  enum http_parser_url_fields uf = url_field(to);
+
+  if (uf == UF_HOST) {
+    url_host_char(u, host, o, ch);
+    return;
+  }
+
+  if (uf == old_uf) {
+    return;
+  }
+
+  if (old_uf != UF_MAX && old_uf != UF_HOST) {
+    u->field_data[old_uf].len = o - u->field_data[old_uf].off;
+  }
+
+  if (uf != UF_MAX) {
+    u->field_data[uf].off = o;
+    u->field_set |= (1 << uf);
+  }
+}
+
+/* The URL ended at offset `o` in state `s`. Checks what
+ * http_parser_parse_url() checks after its loop; on failure clears `u` and
+ * returns 1.
+ */
+static int
+url_split_end (struct http_parser_url32 *u, uint8_t host, enum state s,
+               uint32_t o, int is_connect)
+{
+  enum http_parser_url_fields uf = url_field(s);
+  int i;
+
+  if (uf != UF_MAX && uf != UF_HOST) {
+    u->field_data[uf].len = o - u->field_data[uf].off;
+  }
+
+  /* Drop what's left of a host part restarted at its '@' */
+  for (i = 0; i < UF_MAX; i++) {
+    if ((u->field_set & (1 << i)) == 0) {
+      u->field_data[i].off = 0;
+      u->field_data[i].len = 0;
+    }
+  }
+
+  /* host must be present if there is a schema */
+  if ((u->field_set & (1 << UF_SCHEMA)) &&
+      (u->field_set & (1 << UF_HOST)) == 0) {
+    goto error;
+  }
+
+  /* Make sure the host doesn't end somewhere unexpected */
+  if (u->field_set & (1 << UF_HOST)) {
+    switch (host & ~URL_HOST_FLAGS) {
+      case s_http_host_dead:
+      case s_http_host_start:
+      case s_http_host_v6_start:
+      case s_http_host_v6:
+      case s_http_host_v6_zone_start:
+      case s_http_host_v6_zone:
+      case s_http_host_port_start:
+        goto error;
+      default:
+        break;
+    }
+  }
+
+  /* CONNECT requests can only contain "hostname:port" */
+  if (is_connect && u->field_set != ((1 << UF_HOST)|(1 << UF_PORT))) {
+    goto error;
+  }
+
+  return 0;
+
+error:
+  memset(u, 0, sizeof(*u));
+  return 1;
+}
+
+/* Fast path for an authority that is a plain "host[:port]": a run of host
+ * characters, then optionally ':' and a port, ending at `end` or at a '/'
+ * or '?'. Returns the end of the authority and sets `host_end`, `port_len`
+ * (0 without a port) and `port`. Returns NULL to leave anything else (IPv6
+ * literals, zone IDs, userinfo, bad input) to http_parse_host_char().
+ */
+static const char *
+parse_authority (const char *p, const char *end, const char **host_end,
+                 unsigned int *port_len, uint16_t *port)
+{
+  const char *q = scan_host(p, end);
+
+  if (q == p) {
+    return NULL;
+  }
+
+  *host_end = q;
+  *port_len = 0;
+
+  if (q != end && *q == ':') {
+    *port_len = parse_port(q + 1, end, port);
+    if (*port_len == 0) {
+      return NULL;
+    }
+    q += 1 + *port_len;
+  }
+
+  if (q != end && *q != '/' && *q != '?') {
+    return NULL;
+  }
+
+  return q;
+}
+
+/* Store what parse_authority() found at `p`, offset `o` */
+static void
+url_split_authority (struct http_parser_url32 *u, uint8_t *host, uint32_t o,
+                     const char *p, const char *host_end,
+                     unsigned int port_len, uint16_t port)
+{
+  u->field_set |= (1 << UF_HOST);
+  u->field_data[UF_HOST].off = o;
+  u->field_data[UF_HOST].len = (uint32_t) (host_end - p);
+
+  if (port_len == 0) {
+    *host = s_http_host;
+    return;
+  }
+
+  u->field_set |= (1 << UF_PORT);
+  u->field_data[UF_PORT].off = o + (uint32_t) (host_end + 1 - p);
+  u->field_data[UF_PORT].len = port_len;
+  u->port = port;
+  *host = s_http_host_port;
+}
+
+/* Fills `u` for an origin-form URL at offset `o` whose first '?' and '#'
+ * scan_request_line() found.
+ */
+static void
+url_split_origin (struct http_parser_url32 *u, uint32_t o, const char *url,
+                  const char *query, const char *fragment, const char *end)
+{
+  const char *path_end = query ? query : fragment ? fragment : end;
+
+  u->field_set = (1 << UF_PATH);
+  u->field_data[UF_PATH].off = o;
+  u->field_data[UF_PATH].len = (uint32_t) (path_end - url);
+
+  if (query != NULL) {
+    const char *query_end = fragment ? fragment : end;
+
+    if (query + 1 < query_end) {
+      u->field_set |= (1 << UF_QUERY);
+      u->field_data[UF_QUERY].off = o + (uint32_t) (query + 1 - url);
+      u->field_data[UF_QUERY].len = (uint32_t) (query_end - (query + 1));
+    }
+  }
+
+  if (fragment != NULL) {
+    for (fragment++; fragment < end && *fragment == '#'; fragment++);
+    if (fragment < end) {
+      u->field_set |= (1 << UF_FRAGMENT);
+      u->field_data[UF_FRAGMENT].off = o + (uint32_t) (fragment - url);
+      u->field_data[UF_FRAGMENT].len = (uint32_t) (end - fragment);
+    }
+  }
+}
+
+/* The state machine proper. Inlined into http_parser_execute() with a NULL
+ * `head`, `dechunk` and `batch`, into http_parser_execute_head() with a
+ * non-NULL `head`, into http_parser_execute_dechunk() with `dechunk`
+ * pointing at a writable `data` and into http_parser_execute_batch() with a
+ * non-NULL `batch`, so each entry point gets a copy with the checks for the
+ * others folded away.
+ *
+ * The parser fields touched on every byte live in locals (p_state,
+ * p_header_state, p_index, p_flags, p_content_length) so the compiler can
+ * keep them in registers; SYNC_OUT() and SYNC_IN() move them to and from
+ * the parser around callbacks and on return.
+ */
+static EXECUTE_INLINE size_t
+execute (http_parser *parser,
+         const http_parser_settings *settings,
+         const char *data,
+         size_t len,
+         struct http_parser_head *head,
+         char *dechunk,
+         struct http_parser_batch *batch)
 {
   char c, ch;
   int8_t unhex_val;
@@ -647,6 +2507,50 @@ size_t http_parser_execute (http_parser *parser,
   enum state p_state = (enum state) parser->state;
   const unsigned int lenient = parser->lenient_http_headers;
   uint32_t nread = parser->nread;
+  enum header_states p_header_state =
+    (enum header_states) parser->header_state;
+  unsigned int p_index = parser->index;
+  unsigned int p_flags = parser->flags;
+  uint64_t p_content_length = parser->content_length;
+  size_t field_seen = 0; /* header name bytes before header_field_mark */
+  char *dechunk_start = NULL; /* compacted chunk payloads, if dechunking */
+  char *dechunk_end = NULL;
+  /* Chunk payloads are collected for BODY_FLUSH() rather than passed on
+   * one chunk at a time
+   */
+  const int collect_body =
+    dechunk != NULL || settings->on_body_ranges != NULL;
+  struct http_parser_range ranges[BODY_RANGES];
+  size_t nranges = 0;
+#if THREADED_DISPATCH
+  /* Indexed by state - s_dead, in the order of enum state */
+  static const void *const dispatch[] = {
+    &&L_s_dead, &&L_s_start_req_or_res, &&L_s_res_or_resp_H,
+    &&L_s_start_res, &&L_s_res_H, &&L_s_res_HT, &&L_s_res_HTT,
+    &&L_s_res_HTTP, &&L_s_res_http_major, &&L_s_res_http_dot,
+    &&L_s_res_http_minor, &&L_s_res_http_end, &&L_s_res_first_status_code,
+    &&L_s_res_status_code, &&L_s_res_status_start, &&L_s_res_status,
+    &&L_s_res_line_almost_done, &&L_s_start_req, &&L_s_req_method,
+    &&L_s_req_spaces_before_url, &&L_s_req_schema, &&L_s_req_schema_slash,
+    &&L_s_req_schema_slash_slash, &&L_s_req_server_start, &&L_s_req_server,
+    &&L_s_req_server_with_at, &&L_s_req_path, &&L_s_req_query_string_start,
+    &&L_s_req_query_string, &&L_s_req_fragment_start, &&L_s_req_fragment,
+    &&L_s_req_http_start, &&L_s_req_http_H, &&L_s_req_http_HT,
+    &&L_s_req_http_HTT, &&L_s_req_http_HTTP, &&L_s_req_http_major,
+    &&L_s_req_http_dot, &&L_s_req_http_minor, &&L_s_req_http_end,
+    &&L_s_req_line_almost_done, &&L_s_header_field_start,
+    &&L_s_header_field, &&L_s_header_value_discard_ws,
+    &&L_s_header_value_discard_ws_almost_done,
+    &&L_s_header_value_discard_lws, &&L_s_header_value_start,
+    &&L_s_header_value, &&L_s_header_value_lws, &&L_s_header_almost_done,
+    &&L_s_chunk_size_start, &&L_s_chunk_size, &&L_s_chunk_parameters,
+    &&L_s_chunk_size_almost_done, &&L_s_headers_almost_done,
+    &&L_s_headers_done, &&L_s_chunk_data, &&L_s_chunk_data_almost_done,
+    &&L_s_chunk_data_done, &&L_s_body_identity, &&L_s_body_identity_eof,
+    &&L_s_message_done
+  };
+  assert(ARRAY_SIZE(dispatch) == s_message_done);
+#endif
 
   /* We're in an error state. Don't bother doing anything. */
   if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {
@@ -675,8 +2579,10 @@ size_t http_parser_execute (http_parser *parser,
   }
 
 
-  if (CURRENT_STATE() == s_header_field)
+  if (CURRENT_STATE() == s_header_field) {
     header_field_mark = data;
+    field_seen = p_index + 1;
+  }
   if (CURRENT_STATE() == s_header_value)
     header_value_mark = data;
   switch (CURRENT_STATE()) {
@@ -707,9 +2613,10 @@ size_t http_parser_execute (http_parser *parser,
       COUNT_HEADER_SIZE(1);
 
 reexecute:
+    DISPATCH();
     switch (CURRENT_STATE()) {
 
-      case s_dead:
+      CASE(s_dead):
         /* this state is used after a 'Connection: close' message
          * the parser will error out if it reads another message
          */
@@ -719,17 +2626,27 @@ reexecute:
         SET_ERRNO(HPE_CLOSED_CONNECTION);
         goto error;
 
-      case s_start_req_or_res:
+      CASE(s_start_req_or_res):
       {
         if (ch == CR || ch == LF)
           break;
-        parser->flags = 0;
-        parser->content_length = ULLONG_MAX;
+        p_flags = 0;
+        p_content_length = ULLONG_MAX;
 
         if (ch == 'H') {
+          unsigned int n;
+
           UPDATE_STATE(s_res_or_resp_H);
 
           CALLBACK_NOTIFY(message_begin);
+
+          n = match_status_line(p, data + len, parser);
+          if (n != 0) {
+            parser->type = HTTP_RESPONSE;
+            p += n;
+            COUNT_HEADER_SIZE(n);
+            UPDATE_STATE(s_res_status_code);
+          }
         } else {
           parser->type = HTTP_REQUEST;
           UPDATE_STATE(s_start_req);
@@ -739,7 +2656,7 @@ reexecute:
         break;
       }
 
-      case s_res_or_resp_H:
+      CASE(s_res_or_resp_H):
         if (ch == 'T') {
           parser->type = HTTP_RESPONSE;
           UPDATE_STATE(s_res_HT);
@@ -751,17 +2668,19 @@ reexecute:
 
           parser->type = HTTP_REQUEST;
           parser->method = HTTP_HEAD;
-          parser->index = 2;
+          p_index = 2;
           UPDATE_STATE(s_req_method);
         }
         break;
 
-      case s_start_res:
+      CASE(s_start_res):
       {
+        unsigned int n;
+
         if (ch == CR || ch == LF)
           break;
-        parser->flags = 0;
-        parser->content_length = ULLONG_MAX;
+        p_flags = 0;
+        p_content_length = ULLONG_MAX;
 
         if (ch == 'H') {
           UPDATE_STATE(s_res_H);
@@ -771,30 +2690,40 @@ reexecute:
         }
 
         CALLBACK_NOTIFY(message_begin);
+
+        /* The usual "HTTP/1.x NNN" goes straight to the end of the status
+         * code, which s_res_status_code finishes
+         */
+        n = match_status_line(p, data + len, parser);
+        if (n != 0) {
+          p += n;
+          COUNT_HEADER_SIZE(n);
+          UPDATE_STATE(s_res_status_code);
+        }
         break;
       }
 
-      case s_res_H:
+      CASE(s_res_H):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_res_HT);
         break;
 
-      case s_res_HT:
+      CASE(s_res_HT):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_res_HTT);
         break;
 
-      case s_res_HTT:
+      CASE(s_res_HTT):
         STRICT_CHECK(ch != 'P');
         UPDATE_STATE(s_res_HTTP);
         break;
 
-      case s_res_HTTP:
+      CASE(s_res_HTTP):
         STRICT_CHECK(ch != '/');
         UPDATE_STATE(s_res_http_major);
         break;
 
-      case s_res_http_major:
+      CASE(s_res_http_major):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -804,7 +2733,7 @@ reexecute:
         UPDATE_STATE(s_res_http_dot);
         break;
 
-      case s_res_http_dot:
+      CASE(s_res_http_dot):
       {
         if (UNLIKELY(ch != '.')) {
           SET_ERRNO(HPE_INVALID_VERSION);
@@ -815,7 +2744,7 @@ reexecute:
         break;
       }
 
-      case s_res_http_minor:
+      CASE(s_res_http_minor):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -825,7 +2754,7 @@ reexecute:
         UPDATE_STATE(s_res_http_end);
         break;
 
-      case s_res_http_end:
+      CASE(s_res_http_end):
       {
         if (UNLIKELY(ch != ' ')) {
           SET_ERRNO(HPE_INVALID_VERSION);
@@ -836,7 +2765,7 @@ reexecute:
         break;
       }
 
-      case s_res_first_status_code:
+      CASE(s_res_first_status_code):
       {
         if (!IS_NUM(ch)) {
           if (ch == ' ') {
@@ -851,7 +2780,7 @@ reexecute:
         break;
       }
 
-      case s_res_status_code:
+      CASE(s_res_status_code):
       {
         if (!IS_NUM(ch)) {
           switch (ch) {
@@ -881,11 +2810,11 @@ reexecute:
         break;
       }
 
-      case s_res_status_start:
+      CASE(s_res_status_start):
       {
         MARK(status);
         UPDATE_STATE(s_res_status);
-        parser->index = 0;
+        p_index = 0;
 
         if (ch == CR || ch == LF)
           REEXECUTE();
@@ -893,7 +2822,7 @@ reexecute:
         break;
       }
 
-      case s_res_status:
+      CASE(s_res_status):
         if (ch == CR) {
           UPDATE_STATE(s_res_line_almost_done);
           CALLBACK_DATA(status);
@@ -908,17 +2837,17 @@ reexecute:
 
         break;
 
-      case s_res_line_almost_done:
+      CASE(s_res_line_almost_done):
         STRICT_CHECK(ch != LF);
         UPDATE_STATE(s_header_field_start);
         break;
 
-      case s_start_req:
+      CASE(s_start_req):
       {
         if (ch == CR || ch == LF)
           break;
-        parser->flags = 0;
-        parser->content_length = ULLONG_MAX;
+        p_flags = 0;
+        p_content_length = ULLONG_MAX;
 
         if (UNLIKELY(!IS_ALPHA(ch))) {
           SET_ERRNO(HPE_INVALID_METHOD);
@@ -926,7 +2855,7 @@ reexecute:
         }
 
         parser->method = (enum http_method) 0;
-        parser->index = 1;
+        p_index = 1;
         switch (ch) {
           case 'A': parser->method = HTTP_ACL; break;
           case 'B': parser->method = HTTP_BIND; break;
@@ -941,22 +2870,132 @@ reexecute:
           case 'P': parser->method = HTTP_POST;
             /* or PROPFIND|PROPPATCH|PUT|PATCH|PURGE */
             break;
-          case 'R': parser->method = HTTP_REPORT; /* or REBIND */ break;
-          case 'S': parser->method = HTTP_SUBSCRIBE; /* or SEARCH, SOURCE */ break;
-          case 'T': parser->method = HTTP_TRACE; break;
-          case 'U': parser->method = HTTP_UNLOCK; /* or UNSUBSCRIBE, UNBIND, UNLINK */ break;
-          default:
-            SET_ERRNO(HPE_INVALID_METHOD);
-            goto error;
+          case 'R': parser->method = HTTP_REPORT; /* or REBIND */ break;
+          case 'S': parser->method = HTTP_SUBSCRIBE; /* or SEARCH, SOURCE */ break;
+          case 'T': parser->method = HTTP_TRACE; break;
+          case 'U': parser->method = HTTP_UNLOCK; /* or UNSUBSCRIBE, UNBIND, UNLINK */ break;
+          default:
+            SET_ERRNO(HPE_INVALID_METHOD);
+            goto error;
+        }
+        UPDATE_STATE(s_req_method);
+
+        /* With the whole method in the buffer, recognize it in one go and
+         * jump over it and the space. The state is only switched after
+         * on_message_begin so that a pause there resumes in s_req_method.
+         */
+        if (data + len - p >= 8) {
+          enum http_method method;
+          unsigned int n = match_method_word(p, &method);
+
+          if (n != 0) {
+            const char *url_end;
+            const char *query;
+            const char *fragment;
+            const char *eol;
+            struct head_line h;
+
+            parser->method = method;
+            CALLBACK_NOTIFY(message_begin);
+            UPDATE_STATE(s_req_spaces_before_url);
+            COUNT_HEADER_SIZE(n);
+            p += n;
+
+            /* Complete-message fast path; see scan_header_line(). Each step
+             * leaves `p` and the state exactly where the byte-at-a-time
+             * code would have, so we can stop at any line.
+             */
+            if (method == HTTP_CONNECT) {
+              break;
+            }
+
+            eol = scan_request_line(p + 1, data + len, &url_end,
+                                    &query, &fragment);
+            if (eol == NULL || nread + (eol - p) > HTTP_MAX_HEADER_SIZE) {
+              break;
+            }
+
+            if (head) {
+              url_split_origin(&head->url,
+                               head->base + (uint32_t) (p + 1 - data),
+                               p + 1, query, fragment, url_end);
+            }
+
+            url_mark = p + 1;
+            COUNT_HEADER_SIZE(url_end - p);
+            p = url_end;
+            UPDATE_STATE(s_req_http_start);
+            CALLBACK_DATA(url);
+
+            parser->http_major = url_end[6] - '0';
+            parser->http_minor = url_end[8] - '0';
+            COUNT_HEADER_SIZE(eol - p);
+            p = eol;
+            UPDATE_STATE(s_header_field_start);
+
+            while (scan_header_line(p + 1, data + len, lenient, &h) &&
+                   nread + (h.value_end + 1 - p) <= HTTP_MAX_HEADER_SIZE) {
+              if (h.name_state == h_content_length &&
+                  (p_flags & F_CONTENTLENGTH)) {
+                break;
+              }
+
+              header_field_mark = p + 1;
+              COUNT_HEADER_SIZE(h.name_end - p);
+              p = h.name_end;
+              p_header_state = h.name_state;
+              parser->header_id = h.id;
+              UPDATE_STATE(s_header_value_discard_ws);
+              CALLBACK_DATA(header_field);
+
+              /* What s_header_value_start does */
+              if (h.name_state == h_upgrade) {
+                p_flags |= F_UPGRADE;
+              } else if (h.name_state == h_content_length) {
+                p_flags |= F_CONTENTLENGTH;
+                p_content_length = h.content_length;
+              }
+
+              header_value_mark = h.value;
+              COUNT_HEADER_SIZE(h.value_end - p);
+              p = h.value_end;
+              p_header_state = h.value_state;
+              UPDATE_STATE(s_header_almost_done);
+              CALLBACK_DATA(header_value);
+
+              /* What s_header_value_lws does */
+              switch (h.value_state) {
+                case h_connection_keep_alive:
+                  p_flags |= F_CONNECTION_KEEP_ALIVE;
+                  break;
+                case h_connection_close:
+                  p_flags |= F_CONNECTION_CLOSE;
+                  break;
+                case h_transfer_encoding_chunked:
+                  p_flags |= F_CHUNKED;
+                  break;
+                case h_connection_upgrade:
+                  p_flags |= F_CONNECTION_UPGRADE;
+                  break;
+                default:
+                  break;
+              }
+
+              COUNT_HEADER_SIZE(1);
+              p++;
+              UPDATE_STATE(s_header_field_start);
+            }
+
+            break;
+          }
         }
-        UPDATE_STATE(s_req_method);
 
         CALLBACK_NOTIFY(message_begin);
 
         break;
       }
 
-      case s_req_method:
+      CASE(s_req_method):
       {
         const char *matcher;
         if (UNLIKELY(ch == '\0')) {
@@ -965,13 +3004,13 @@ reexecute:
         }
 
         matcher = method_strings[parser->method];
-        if (ch == ' ' && matcher[parser->index] == '\0') {
+        if (ch == ' ' && matcher[p_index] == '\0') {
           UPDATE_STATE(s_req_spaces_before_url);
-        } else if (ch == matcher[parser->index]) {
+        } else if (ch == matcher[p_index]) {
           ; /* nada */
         } else if ((ch >= 'A' && ch <= 'Z') || ch == '-') {
 
-          switch (parser->method << 16 | parser->index << 8 | ch) {
+          switch (parser->method << 16 | p_index << 8 | ch) {
 #define XX(meth, pos, ch, new_meth) \
             case (HTTP_##meth << 16 | pos << 8 | ch): \
               parser->method = HTTP_##new_meth; break;
@@ -1005,11 +3044,11 @@ reexecute:
           goto error;
         }
 
-        ++parser->index;
+        ++p_index;
         break;
       }
 
-      case s_req_spaces_before_url:
+      CASE(s_req_spaces_before_url):
       {
         if (ch == ' ') break;
 
@@ -1018,19 +3057,14 @@ reexecute:
           UPDATE_STATE(s_req_server_start);
         }
 
-        UPDATE_STATE(parse_url_char(CURRENT_STATE(), ch));
-        if (UNLIKELY(CURRENT_STATE() == s_dead)) {
-          SET_ERRNO(HPE_INVALID_URL);
-          goto error;
-        }
-
+        URL_CHAR();
         break;
       }
 
-      case s_req_schema:
-      case s_req_schema_slash:
-      case s_req_schema_slash_slash:
-      case s_req_server_start:
+      CASE(s_req_schema):
+      CASE(s_req_schema_slash):
+      CASE(s_req_schema_slash_slash):
+      CASE(s_req_server_start):
       {
         switch (ch) {
           /* No whitespace allowed here */
@@ -1040,31 +3074,29 @@ reexecute:
             SET_ERRNO(HPE_INVALID_URL);
             goto error;
           default:
-            UPDATE_STATE(parse_url_char(CURRENT_STATE(), ch));
-            if (UNLIKELY(CURRENT_STATE() == s_dead)) {
-              SET_ERRNO(HPE_INVALID_URL);
-              goto error;
-            }
+            URL_CHAR();
         }
 
         break;
       }
 
-      case s_req_server:
-      case s_req_server_with_at:
-      case s_req_path:
-      case s_req_query_string_start:
-      case s_req_query_string:
-      case s_req_fragment_start:
-      case s_req_fragment:
+      CASE(s_req_server):
+      CASE(s_req_server_with_at):
+      CASE(s_req_path):
+      CASE(s_req_query_string_start):
+      CASE(s_req_query_string):
+      CASE(s_req_fragment_start):
+      CASE(s_req_fragment):
       {
         switch (ch) {
           case ' ':
+            URL_END();
             UPDATE_STATE(s_req_http_start);
             CALLBACK_DATA(url);
             break;
           case CR:
           case LF:
+            URL_END();
             parser->http_major = 0;
             parser->http_minor = 9;
             UPDATE_STATE((ch == CR) ?
@@ -1073,18 +3105,50 @@ reexecute:
             CALLBACK_DATA(url);
             break;
           default:
-            UPDATE_STATE(parse_url_char(CURRENT_STATE(), ch));
-            if (UNLIKELY(CURRENT_STATE() == s_dead)) {
-              SET_ERRNO(HPE_INVALID_URL);
-              goto error;
+            URL_CHAR();
+
+            /* Skip runs of plain URL bytes; only '?', '#', whitespace and
+             * invalid bytes can change the state from here. Likewise for
+             * host names, which only need their length counted when the
+             * URL is being split.
+             */
+            if (CURRENT_STATE() == s_req_path ||
+                CURRENT_STATE() == s_req_query_string ||
+                CURRENT_STATE() == s_req_fragment) {
+              const char *start = p + 1;
+              size_t limit = data + len - start;
+
+              limit = MIN(limit, HTTP_MAX_HEADER_SIZE);
+              p = scan_url(start, start + limit);
+              COUNT_HEADER_SIZE(p - start);
+              --p;
+            } else if (CURRENT_STATE() == s_req_server &&
+                       (!head || (head->url_host & ~URL_HOST_FLAGS) ==
+                                 s_http_host)) {
+              const char *start = p + 1;
+              size_t limit = data + len - start;
+
+              limit = MIN(limit, HTTP_MAX_HEADER_SIZE);
+              p = scan_host(start, start + limit);
+              if (head) {
+                head->url.field_data[UF_HOST].len += (uint32_t) (p - start);
+              }
+              COUNT_HEADER_SIZE(p - start);
+              --p;
             }
         }
         break;
       }
 
-      case s_req_http_start:
+      CASE(s_req_http_start):
         switch (ch) {
           case 'H':
+            if (data + len - p >= 8 && match_version_word(p, parser)) {
+              p += 7;
+              COUNT_HEADER_SIZE(7);
+              UPDATE_STATE(s_req_http_end);
+              break;
+            }
             UPDATE_STATE(s_req_http_H);
             break;
           case ' ':
@@ -1095,27 +3159,27 @@ reexecute:
         }
         break;
 
-      case s_req_http_H:
+      CASE(s_req_http_H):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_req_http_HT);
         break;
 
-      case s_req_http_HT:
+      CASE(s_req_http_HT):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_req_http_HTT);
         break;
 
-      case s_req_http_HTT:
+      CASE(s_req_http_HTT):
         STRICT_CHECK(ch != 'P');
         UPDATE_STATE(s_req_http_HTTP);
         break;
 
-      case s_req_http_HTTP:
+      CASE(s_req_http_HTTP):
         STRICT_CHECK(ch != '/');
         UPDATE_STATE(s_req_http_major);
         break;
 
-      case s_req_http_major:
+      CASE(s_req_http_major):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -1125,7 +3189,7 @@ reexecute:
         UPDATE_STATE(s_req_http_dot);
         break;
 
-      case s_req_http_dot:
+      CASE(s_req_http_dot):
       {
         if (UNLIKELY(ch != '.')) {
           SET_ERRNO(HPE_INVALID_VERSION);
@@ -1136,7 +3200,7 @@ reexecute:
         break;
       }
 
-      case s_req_http_minor:
+      CASE(s_req_http_minor):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -1146,7 +3210,7 @@ reexecute:
         UPDATE_STATE(s_req_http_end);
         break;
 
-      case s_req_http_end:
+      CASE(s_req_http_end):
       {
         if (ch == CR) {
           UPDATE_STATE(s_req_line_almost_done);
@@ -1164,7 +3228,7 @@ reexecute:
       }
 
       /* end of request line */
-      case s_req_line_almost_done:
+      CASE(s_req_line_almost_done):
       {
         if (UNLIKELY(ch != LF)) {
           SET_ERRNO(HPE_LF_EXPECTED);
@@ -1175,7 +3239,7 @@ reexecute:
         break;
       }
 
-      case s_header_field_start:
+      CASE(s_header_field_start):
       {
         if (ch == CR) {
           UPDATE_STATE(s_headers_almost_done);
@@ -1198,34 +3262,35 @@ reexecute:
 
         MARK(header_field);
 
-        parser->index = 0;
+        p_index = 0;
+        field_seen = 0;
         UPDATE_STATE(s_header_field);
 
         switch (c) {
           case 'c':
-            parser->header_state = h_C;
+            p_header_state = h_C;
             break;
 
           case 'p':
-            parser->header_state = h_matching_proxy_connection;
+            p_header_state = h_matching_proxy_connection;
             break;
 
           case 't':
-            parser->header_state = h_matching_transfer_encoding;
+            p_header_state = h_matching_transfer_encoding;
             break;
 
           case 'u':
-            parser->header_state = h_matching_upgrade;
+            p_header_state = h_matching_upgrade;
             break;
 
           default:
-            parser->header_state = h_general;
+            p_header_state = h_general;
             break;
         }
         break;
       }
 
-      case s_header_field:
+      CASE(s_header_field):
       {
         const char* start = p;
         for (; p != data + len; p++) {
@@ -1235,37 +3300,36 @@ reexecute:
           if (!c)
             break;
 
-          switch (parser->header_state) {
+          switch (p_header_state) {
             case h_general: {
               size_t limit = data + len - p;
               limit = MIN(limit, HTTP_MAX_HEADER_SIZE);
-              while (p+1 < data + limit && TOKEN(p[1])) {
-                p++;
-              }
+              p = scan_token(p + 1, p + limit, NULL);
+              --p;
               break;
             }
 
             case h_C:
-              parser->index++;
-              parser->header_state = (c == 'o' ? h_CO : h_general);
+              p_index++;
+              p_header_state = (c == 'o' ? h_CO : h_general);
               break;
 
             case h_CO:
-              parser->index++;
-              parser->header_state = (c == 'n' ? h_CON : h_general);
+              p_index++;
+              p_header_state = (c == 'n' ? h_CON : h_general);
               break;
 
             case h_CON:
-              parser->index++;
+              p_index++;
               switch (c) {
                 case 'n':
-                  parser->header_state = h_matching_connection;
+                  p_header_state = h_matching_connection;
                   break;
                 case 't':
-                  parser->header_state = h_matching_content_length;
+                  p_header_state = h_matching_content_length;
                   break;
                 default:
-                  parser->header_state = h_general;
+                  p_header_state = h_general;
                   break;
               }
               break;
@@ -1273,60 +3337,60 @@ reexecute:
             /* connection */
 
             case h_matching_connection:
-              parser->index++;
-              if (parser->index > sizeof(CONNECTION)-1
-                  || c != CONNECTION[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(CONNECTION)-2) {
-                parser->header_state = h_connection;
+              p_index++;
+              if (p_index > sizeof(CONNECTION)-1
+                  || c != CONNECTION[p_index]) {
+                p_header_state = h_general;
+              } else if (p_index == sizeof(CONNECTION)-2) {
+                p_header_state = h_connection;
               }
               break;
 
             /* proxy-connection */
 
             case h_matching_proxy_connection:
-              parser->index++;
-              if (parser->index > sizeof(PROXY_CONNECTION)-1
-                  || c != PROXY_CONNECTION[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(PROXY_CONNECTION)-2) {
-                parser->header_state = h_connection;
+              p_index++;
+              if (p_index > sizeof(PROXY_CONNECTION)-1
+                  || c != PROXY_CONNECTION[p_index]) {
+                p_header_state = h_general;
+              } else if (p_index == sizeof(PROXY_CONNECTION)-2) {
+                p_header_state = h_connection;
               }
               break;
 
             /* content-length */
 
             case h_matching_content_length:
-              parser->index++;
-              if (parser->index > sizeof(CONTENT_LENGTH)-1
-                  || c != CONTENT_LENGTH[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(CONTENT_LENGTH)-2) {
-                parser->header_state = h_content_length;
+              p_index++;
+              if (p_index > sizeof(CONTENT_LENGTH)-1
+                  || c != CONTENT_LENGTH[p_index]) {
+                p_header_state = h_general;
+              } else if (p_index == sizeof(CONTENT_LENGTH)-2) {
+                p_header_state = h_content_length;
               }
               break;
 
             /* transfer-encoding */
 
             case h_matching_transfer_encoding:
-              parser->index++;
-              if (parser->index > sizeof(TRANSFER_ENCODING)-1
-                  || c != TRANSFER_ENCODING[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(TRANSFER_ENCODING)-2) {
-                parser->header_state = h_transfer_encoding;
+              p_index++;
+              if (p_index > sizeof(TRANSFER_ENCODING)-1
+                  || c != TRANSFER_ENCODING[p_index]) {
+                p_header_state = h_general;
+              } else if (p_index == sizeof(TRANSFER_ENCODING)-2) {
+                p_header_state = h_transfer_encoding;
               }
               break;
 
             /* upgrade */
 
             case h_matching_upgrade:
-              parser->index++;
-              if (parser->index > sizeof(UPGRADE)-1
-                  || c != UPGRADE[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(UPGRADE)-2) {
-                parser->header_state = h_upgrade;
+              p_index++;
+              if (p_index > sizeof(UPGRADE)-1
+                  || c != UPGRADE[p_index]) {
+                p_header_state = h_general;
+              } else if (p_index == sizeof(UPGRADE)-2) {
+                p_header_state = h_upgrade;
               }
               break;
 
@@ -1334,7 +3398,7 @@ reexecute:
             case h_content_length:
             case h_transfer_encoding:
             case h_upgrade:
-              if (ch != ' ') parser->header_state = h_general;
+              if (ch != ' ') p_header_state = h_general;
               break;
 
             default:
@@ -1352,6 +3416,18 @@ reexecute:
         COUNT_HEADER_SIZE(p - start);
 
         if (ch == ':') {
+          if (field_seen == 0) {
+            parser->header_id = header_lookup(header_field_mark,
+                                              p - header_field_mark);
+          } else {
+            unsigned int id = header_extend(parser->header_id, field_seen,
+                                            header_field_mark, p);
+            if (id != HTTP_HEADER_OTHER &&
+                header_strings[id][field_seen + (p - header_field_mark)]) {
+              id = HTTP_HEADER_OTHER;
+            }
+            parser->header_id = id;
+          }
           UPDATE_STATE(s_header_value_discard_ws);
           CALLBACK_DATA(header_field);
           break;
@@ -1361,7 +3437,7 @@ reexecute:
         goto error;
       }
 
-      case s_header_value_discard_ws:
+      CASE(s_header_value_discard_ws):
         if (ch == ' ' || ch == '\t') break;
 
         if (ch == CR) {
@@ -1374,29 +3450,31 @@ reexecute:
           break;
         }
 
-        /* fall through */
+        FALLTHROUGH;
 
-      case s_header_value_start:
+      CASE(s_header_value_start):
       {
+        unsigned int n;
+
         MARK(header_value);
 
         UPDATE_STATE(s_header_value);
-        parser->index = 0;
+        p_index = 0;
 
         c = LOWER(ch);
 
-        switch (parser->header_state) {
+        switch (p_header_state) {
           case h_upgrade:
-            parser->flags |= F_UPGRADE;
-            parser->header_state = h_general;
+            p_flags |= F_UPGRADE;
+            p_header_state = h_general;
             break;
 
           case h_transfer_encoding:
             /* looking for 'Transfer-Encoding: chunked' */
             if ('c' == c) {
-              parser->header_state = h_matching_transfer_encoding_chunked;
+              p_header_state = h_matching_transfer_encoding_chunked;
             } else {
-              parser->header_state = h_general;
+              p_header_state = h_general;
             }
             break;
 
@@ -1406,27 +3484,37 @@ reexecute:
               goto error;
             }
 
-            if (parser->flags & F_CONTENTLENGTH) {
+            if (p_flags & F_CONTENTLENGTH) {
               SET_ERRNO(HPE_UNEXPECTED_CONTENT_LENGTH);
               goto error;
             }
 
-            parser->flags |= F_CONTENTLENGTH;
-            parser->content_length = ch - '0';
-            parser->header_state = h_content_length_num;
+            p_flags |= F_CONTENTLENGTH;
+            p_header_state = h_content_length_num;
+
+            /* Take the digits in the buffer a word at a time and leave
+             * the rest, if any, to s_header_value
+             */
+            n = parse_decimal_word(p, data + len, &p_content_length);
+            if (n == 0) {
+              p_content_length = ch - '0';
+              break;
+            }
+            p += n - 1;
+            COUNT_HEADER_SIZE(n - 1);
             break;
 
           case h_connection:
             /* looking for 'Connection: keep-alive' */
             if (c == 'k') {
-              parser->header_state = h_matching_connection_keep_alive;
+              p_header_state = h_matching_connection_keep_alive;
             /* looking for 'Connection: close' */
             } else if (c == 'c') {
-              parser->header_state = h_matching_connection_close;
+              p_header_state = h_matching_connection_close;
             } else if (c == 'u') {
-              parser->header_state = h_matching_connection_upgrade;
+              p_header_state = h_matching_connection_upgrade;
             } else {
-              parser->header_state = h_matching_connection_token;
+              p_header_state = h_matching_connection_token;
             }
             break;
 
@@ -1435,21 +3523,21 @@ reexecute:
             break;
 
           default:
-            parser->header_state = h_general;
+            p_header_state = h_general;
             break;
         }
         break;
       }
 
-      case s_header_value:
+      CASE(s_header_value):
       {
         const char* start = p;
-        enum header_states h_state = (enum header_states) parser->header_state;
+        enum header_states h_state = (enum header_states) p_header_state;
         for (; p != data + len; p++) {
           ch = *p;
           if (ch == CR) {
             UPDATE_STATE(s_header_almost_done);
-            parser->header_state = h_state;
+            p_header_state = h_state;
             CALLBACK_DATA(header_value);
             break;
           }
@@ -1457,12 +3545,14 @@ reexecute:
           if (ch == LF) {
             UPDATE_STATE(s_header_almost_done);
             COUNT_HEADER_SIZE(p - start);
-            parser->header_state = h_state;
+            p_header_state = h_state;
             CALLBACK_DATA_NOADVANCE(header_value);
             REEXECUTE();
           }
 
           if (!lenient && !IS_HEADER_CHAR(ch)) {
+            /* The scan below can run past HTTP_MAX_HEADER_SIZE */
+            COUNT_HEADER_SIZE(p - start);
             SET_ERRNO(HPE_INVALID_HEADER_TOKEN);
             goto error;
           }
@@ -1472,24 +3562,14 @@ reexecute:
           switch (h_state) {
             case h_general:
             {
-              const char* p_cr;
-              const char* p_lf;
               size_t limit = data + len - p;
 
               limit = MIN(limit, HTTP_MAX_HEADER_SIZE);
 
-              p_cr = (const char*) memchr(p, CR, limit);
-              p_lf = (const char*) memchr(p, LF, limit);
-              if (p_cr != NULL) {
-                if (p_lf != NULL && p_cr >= p_lf)
-                  p = p_lf;
-                else
-                  p = p_cr;
-              } else if (UNLIKELY(p_lf != NULL)) {
-                p = p_lf;
-              } else {
-                p = data + len;
-              }
+              /* Skip to the next CR, LF or invalid byte and let the checks
+               * at the top of the loop deal with it.
+               */
+              p = scan_header_value(p + 1, p + limit, lenient);
               --p;
               break;
             }
@@ -1515,38 +3595,38 @@ reexecute:
 
               if (UNLIKELY(!IS_NUM(ch))) {
                 SET_ERRNO(HPE_INVALID_CONTENT_LENGTH);
-                parser->header_state = h_state;
+                p_header_state = h_state;
                 goto error;
               }
 
-              t = parser->content_length;
+              t = p_content_length;
               t *= 10;
               t += ch - '0';
 
               /* Overflow? Test against a conservative limit for simplicity. */
-              if (UNLIKELY((ULLONG_MAX - 10) / 10 < parser->content_length)) {
+              if (UNLIKELY((ULLONG_MAX - 10) / 10 < p_content_length)) {
                 SET_ERRNO(HPE_INVALID_CONTENT_LENGTH);
-                parser->header_state = h_state;
+                p_header_state = h_state;
                 goto error;
               }
 
-              parser->content_length = t;
+              p_content_length = t;
               break;
             }
 
             case h_content_length_ws:
               if (ch == ' ') break;
               SET_ERRNO(HPE_INVALID_CONTENT_LENGTH);
-              parser->header_state = h_state;
+              p_header_state = h_state;
               goto error;
 
             /* Transfer-Encoding: chunked */
             case h_matching_transfer_encoding_chunked:
-              parser->index++;
-              if (parser->index > sizeof(CHUNKED)-1
-                  || c != CHUNKED[parser->index]) {
+              p_index++;
+              if (p_index > sizeof(CHUNKED)-1
+                  || c != CHUNKED[p_index]) {
                 h_state = h_general;
-              } else if (parser->index == sizeof(CHUNKED)-2) {
+              } else if (p_index == sizeof(CHUNKED)-2) {
                 h_state = h_transfer_encoding_chunked;
               }
               break;
@@ -1571,32 +3651,32 @@ reexecute:
 
             /* looking for 'Connection: keep-alive' */
             case h_matching_connection_keep_alive:
-              parser->index++;
-              if (parser->index > sizeof(KEEP_ALIVE)-1
-                  || c != KEEP_ALIVE[parser->index]) {
+              p_index++;
+              if (p_index > sizeof(KEEP_ALIVE)-1
+                  || c != KEEP_ALIVE[p_index]) {
                 h_state = h_matching_connection_token;
-              } else if (parser->index == sizeof(KEEP_ALIVE)-2) {
+              } else if (p_index == sizeof(KEEP_ALIVE)-2) {
                 h_state = h_connection_keep_alive;
               }
               break;
 
             /* looking for 'Connection: close' */
             case h_matching_connection_close:
-              parser->index++;
-              if (parser->index > sizeof(CLOSE)-1 || c != CLOSE[parser->index]) {
+              p_index++;
+              if (p_index > sizeof(CLOSE)-1 || c != CLOSE[p_index]) {
                 h_state = h_matching_connection_token;
-              } else if (parser->index == sizeof(CLOSE)-2) {
+              } else if (p_index == sizeof(CLOSE)-2) {
                 h_state = h_connection_close;
               }
               break;
 
             /* looking for 'Connection: upgrade' */
             case h_matching_connection_upgrade:
-              parser->index++;
-              if (parser->index > sizeof(UPGRADE) - 1 ||
-                  c != UPGRADE[parser->index]) {
+              p_index++;
+              if (p_index > sizeof(UPGRADE) - 1 ||
+                  c != UPGRADE[p_index]) {
                 h_state = h_matching_connection_token;
-              } else if (parser->index == sizeof(UPGRADE)-2) {
+              } else if (p_index == sizeof(UPGRADE)-2) {
                 h_state = h_connection_upgrade;
               }
               break;
@@ -1604,7 +3684,7 @@ reexecute:
             case h_matching_connection_token:
               if (ch == ',') {
                 h_state = h_matching_connection_token_start;
-                parser->index = 0;
+                p_index = 0;
               }
               break;
 
@@ -1617,14 +3697,14 @@ reexecute:
             case h_connection_upgrade:
               if (ch == ',') {
                 if (h_state == h_connection_keep_alive) {
-                  parser->flags |= F_CONNECTION_KEEP_ALIVE;
+                  p_flags |= F_CONNECTION_KEEP_ALIVE;
                 } else if (h_state == h_connection_close) {
-                  parser->flags |= F_CONNECTION_CLOSE;
+                  p_flags |= F_CONNECTION_CLOSE;
                 } else if (h_state == h_connection_upgrade) {
-                  parser->flags |= F_CONNECTION_UPGRADE;
+                  p_flags |= F_CONNECTION_UPGRADE;
                 }
                 h_state = h_matching_connection_token_start;
-                parser->index = 0;
+                p_index = 0;
               } else if (ch != ' ') {
                 h_state = h_matching_connection_token;
               }
@@ -1636,7 +3716,7 @@ reexecute:
               break;
           }
         }
-        parser->header_state = h_state;
+        p_header_state = h_state;
 
         if (p == data + len)
           --p;
@@ -1645,7 +3725,7 @@ reexecute:
         break;
       }
 
-      case s_header_almost_done:
+      CASE(s_header_almost_done):
       {
         if (UNLIKELY(ch != LF)) {
           SET_ERRNO(HPE_LF_EXPECTED);
@@ -1656,7 +3736,7 @@ reexecute:
         break;
       }
 
-      case s_header_value_lws:
+      CASE(s_header_value_lws):
       {
         if (ch == ' ' || ch == '\t') {
           UPDATE_STATE(s_header_value_start);
@@ -1664,18 +3744,18 @@ reexecute:
         }
 
         /* finished the header */
-        switch (parser->header_state) {
+        switch (p_header_state) {
           case h_connection_keep_alive:
-            parser->flags |= F_CONNECTION_KEEP_ALIVE;
+            p_flags |= F_CONNECTION_KEEP_ALIVE;
             break;
           case h_connection_close:
-            parser->flags |= F_CONNECTION_CLOSE;
+            p_flags |= F_CONNECTION_CLOSE;
             break;
           case h_transfer_encoding_chunked:
-            parser->flags |= F_CHUNKED;
+            p_flags |= F_CHUNKED;
             break;
           case h_connection_upgrade:
-            parser->flags |= F_CONNECTION_UPGRADE;
+            p_flags |= F_CONNECTION_UPGRADE;
             break;
           default:
             break;
@@ -1685,31 +3765,31 @@ reexecute:
         REEXECUTE();
       }
 
-      case s_header_value_discard_ws_almost_done:
+      CASE(s_header_value_discard_ws_almost_done):
       {
         STRICT_CHECK(ch != LF);
         UPDATE_STATE(s_header_value_discard_lws);
         break;
       }
 
-      case s_header_value_discard_lws:
+      CASE(s_header_value_discard_lws):
       {
         if (ch == ' ' || ch == '\t') {
           UPDATE_STATE(s_header_value_discard_ws);
           break;
         } else {
-          switch (parser->header_state) {
+          switch (p_header_state) {
             case h_connection_keep_alive:
-              parser->flags |= F_CONNECTION_KEEP_ALIVE;
+              p_flags |= F_CONNECTION_KEEP_ALIVE;
               break;
             case h_connection_close:
-              parser->flags |= F_CONNECTION_CLOSE;
+              p_flags |= F_CONNECTION_CLOSE;
               break;
             case h_connection_upgrade:
-              parser->flags |= F_CONNECTION_UPGRADE;
+              p_flags |= F_CONNECTION_UPGRADE;
               break;
             case h_transfer_encoding_chunked:
-              parser->flags |= F_CHUNKED;
+              p_flags |= F_CHUNKED;
               break;
             default:
               break;
@@ -1723,11 +3803,11 @@ reexecute:
         }
       }
 
-      case s_headers_almost_done:
+      CASE(s_headers_almost_done):
       {
         STRICT_CHECK(ch != LF);
 
-        if (parser->flags & F_TRAILING) {
+        if (p_flags & F_TRAILING) {
           /* End of a chunked request */
           UPDATE_STATE(s_message_done);
           CALLBACK_NOTIFY_NOADVANCE(chunk_complete);
@@ -1736,17 +3816,22 @@ reexecute:
 
         /* Cannot use chunked encoding and a content-length header together
            per the HTTP specification. */
-        if ((parser->flags & F_CHUNKED) &&
-            (parser->flags & F_CONTENTLENGTH)) {
+        if ((p_flags & F_CHUNKED) &&
+            (p_flags & F_CONTENTLENGTH)) {
           SET_ERRNO(HPE_UNEXPECTED_CONTENT_LENGTH);
           goto error;
         }
 
         UPDATE_STATE(s_headers_done);
 
+        if (batch) {
+          batch->messages[batch->nmessages].head_end =
+            batch->base + (uint32_t) (p - data) + 1;
+        }
+
         /* Set this here so that on_headers_complete() callbacks can see it */
-        if ((parser->flags & F_UPGRADE) &&
-            (parser->flags & F_CONNECTION_UPGRADE)) {
+        if ((p_flags & F_UPGRADE) &&
+            (p_flags & F_CONNECTION_UPGRADE)) {
           /* For responses, "Upgrade: foo" and "Connection: upgrade" are
            * mandatory only when it is a 101 Switching Protocols response,
            * otherwise it is purely informational, to announce support.
@@ -1767,6 +3852,7 @@ reexecute:
          * we have to simulate it by handling a change in errno below.
          */
         if (settings->on_headers_complete) {
+          SYNC_OUT();
           switch (settings->on_headers_complete(parser)) {
             case 0:
               break;
@@ -1783,6 +3869,7 @@ reexecute:
               SET_ERRNO(HPE_CB_headers_complete);
               RETURN(p - data); /* Error */
           }
+          SYNC_IN();
         }
 
         if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {
@@ -1792,7 +3879,7 @@ reexecute:
         REEXECUTE();
       }
 
-      case s_headers_done:
+      CASE(s_headers_done):
       {
         int hasBody;
         STRICT_CHECK(ch != LF);
@@ -1800,31 +3887,32 @@ reexecute:
         parser->nread = 0;
         nread = 0;
 
-        hasBody = parser->flags & F_CHUNKED ||
-          (parser->content_length > 0 && parser->content_length != ULLONG_MAX);
+        hasBody = p_flags & F_CHUNKED ||
+          (p_content_length > 0 && p_content_length != ULLONG_MAX);
         if (parser->upgrade && (parser->method == HTTP_CONNECT ||
-                                (parser->flags & F_SKIPBODY) || !hasBody)) {
+                                (p_flags & F_SKIPBODY) || !hasBody)) {
           /* Exit, the rest of the message is in a different protocol. */
           UPDATE_STATE(NEW_MESSAGE());
           CALLBACK_NOTIFY(message_complete);
           RETURN((p - data) + 1);
         }
 
-        if (parser->flags & F_SKIPBODY) {
+        if (p_flags & F_SKIPBODY) {
           UPDATE_STATE(NEW_MESSAGE());
           CALLBACK_NOTIFY(message_complete);
-        } else if (parser->flags & F_CHUNKED) {
+        } else if (p_flags & F_CHUNKED) {
           /* chunked encoding - ignore Content-Length header */
           UPDATE_STATE(s_chunk_size_start);
         } else {
-          if (parser->content_length == 0) {
+          if (p_content_length == 0) {
             /* Content-Length header given but zero: Content-Length: 0\r\n */
             UPDATE_STATE(NEW_MESSAGE());
             CALLBACK_NOTIFY(message_complete);
-          } else if (parser->content_length != ULLONG_MAX) {
+          } else if (p_content_length != ULLONG_MAX) {
             /* Content-Length header given and non-zero */
             UPDATE_STATE(s_body_identity);
           } else {
+            SYNC_OUT();
             if (!http_message_needs_eof(parser)) {
               /* Assume content-length 0 - read the next */
               UPDATE_STATE(NEW_MESSAGE());
@@ -1839,13 +3927,13 @@ reexecute:
         break;
       }
 
-      case s_body_identity:
+      CASE(s_body_identity):
       {
-        uint64_t to_read = MIN(parser->content_length,
+        uint64_t to_read = MIN(p_content_length,
                                (uint64_t) ((data + len) - p));
 
-        assert(parser->content_length != 0
-            && parser->content_length != ULLONG_MAX);
+        assert(p_content_length != 0
+            && p_content_length != ULLONG_MAX);
 
         /* The difference between advancing content_length and p is because
          * the latter will automaticaly advance on the next loop iteration.
@@ -1853,10 +3941,10 @@ reexecute:
          * byte again for our message complete callback.
          */
         MARK(body);
-        parser->content_length -= to_read;
+        p_content_length -= to_read;
         p += to_read - 1;
 
-        if (parser->content_length == 0) {
+        if (p_content_length == 0) {
           UPDATE_STATE(s_message_done);
 
           /* Mimic CALLBACK_DATA_NOADVANCE() but with one extra byte.
@@ -1876,13 +3964,13 @@ reexecute:
       }
 
       /* read until EOF */
-      case s_body_identity_eof:
+      CASE(s_body_identity_eof):
         MARK(body);
         p = data + len - 1;
 
         break;
 
-      case s_message_done:
+      CASE(s_message_done):
         UPDATE_STATE(NEW_MESSAGE());
         CALLBACK_NOTIFY(message_complete);
         if (parser->upgrade) {
@@ -1891,10 +3979,23 @@ reexecute:
         }
         break;
 
-      case s_chunk_size_start:
+      CASE(s_chunk_size_start):
       {
+        uint64_t size;
+        unsigned int n;
+
         assert(nread == 1);
-        assert(parser->flags & F_CHUNKED);
+        assert(p_flags & F_CHUNKED);
+
+        /* A whole size line in the buffer goes straight to its LF */
+        n = parse_chunk_size_word(p, data + len, &size);
+        if (LIKELY(n != 0)) {
+          p_content_length = size;
+          p += n;
+          ch = *p;
+          UPDATE_STATE(s_chunk_size_almost_done);
+          REEXECUTE();
+        }
 
         unhex_val = unhex[(unsigned char)ch];
         if (UNLIKELY(unhex_val == -1)) {
@@ -1902,154 +4003,509 @@ reexecute:
           goto error;
         }
 
-        parser->content_length = unhex_val;
+        p_content_length = unhex_val;
         UPDATE_STATE(s_chunk_size);
         break;
       }
 
-      case s_chunk_size:
+      CASE(s_chunk_size):
       {
         uint64_t t;
 
-        assert(parser->flags & F_CHUNKED);
+        assert(p_flags & F_CHUNKED);
+
+        if (ch == CR) {
+          UPDATE_STATE(s_chunk_size_almost_done);
+          break;
+        }
+
+        unhex_val = unhex[(unsigned char)ch];
+
+        if (unhex_val == -1) {
+          if (ch == ';' || ch == ' ') {
+            UPDATE_STATE(s_chunk_parameters);
+            break;
+          }
+
+          SET_ERRNO(HPE_INVALID_CHUNK_SIZE);
+          goto error;
+        }
+
+        t = p_content_length;
+        t *= 16;
+        t += unhex_val;
+
+        /* Overflow? Test against a conservative limit for simplicity. */
+        if (UNLIKELY((ULLONG_MAX - 16) / 16 < p_content_length)) {
+          SET_ERRNO(HPE_INVALID_CONTENT_LENGTH);
+          goto error;
+        }
 
+        p_content_length = t;
+        break;
+      }
+
+      CASE(s_chunk_parameters):
+      {
+        assert(p_flags & F_CHUNKED);
+        /* just ignore this shit. TODO check for overflow */
         if (ch == CR) {
           UPDATE_STATE(s_chunk_size_almost_done);
           break;
         }
+        break;
+      }
+
+      CASE(s_chunk_size_almost_done):
+      {
+        assert(p_flags & F_CHUNKED);
+        STRICT_CHECK(ch != LF);
+
+        parser->nread = 0;
+        nread = 0;
+
+        if (p_content_length == 0) {
+          /* The body is complete; hand it over before any trailers */
+          BODY_FLUSH(p - data);
+          p_flags |= F_TRAILING;
+          UPDATE_STATE(s_header_field_start);
+        } else {
+          UPDATE_STATE(s_chunk_data);
+        }
+        CALLBACK_NOTIFY(chunk_header);
+        break;
+      }
+
+      CASE(s_chunk_data):
+      {
+        uint64_t to_read = MIN(p_content_length,
+                               (uint64_t) ((data + len) - p));
+
+        assert(p_flags & F_CHUNKED);
+        assert(p_content_length != 0
+            && p_content_length != ULLONG_MAX);
+
+        /* See the explanation in s_body_identity for why the content
+         * length and data pointers are managed this way.
+         */
+        if (collect_body) {
+          if (nranges == BODY_RANGES) {
+            BODY_FLUSH(p - data);
+          }
+          BODY_RANGE(p, to_read);
+        } else {
+          MARK(body);
+        }
+        p_content_length -= to_read;
+        p += to_read - 1;
+
+        if (p_content_length != 0) {
+          break;
+        }
+
+        UPDATE_STATE(s_chunk_data_almost_done);
+
+        /* Without chunk callbacks there is nothing to stop for between
+         * chunks, so take each following chunk whose CRLF and size line
+         * are in the buffer here, straight from payload to payload.
+         */
+        while (collect_body &&
+               data + len - p > 2 && p[1] == CR && p[2] == LF) {
+          uint64_t size;
+          unsigned int n = parse_chunk_size_word(p + 3, data + len, &size);
+
+          if (n == 0) {
+            break;
+          }
+          if (nranges == BODY_RANGES) {
+            BODY_FLUSH(p - data + 1);
+          }
+
+          /* On to the LF ending the size line */
+          p += 3 + n;
+          p_content_length = size;
+          parser->nread = 0;
+          nread = 0;
+
+          if (size == 0) {
+            ch = *p;
+            UPDATE_STATE(s_chunk_size_almost_done);
+            REEXECUTE();
+          }
+
+          to_read = MIN(size, (uint64_t) ((data + len) - (p + 1)));
+          if (to_read == 0) {
+            UPDATE_STATE(s_chunk_data);
+            break;
+          }
+
+          BODY_RANGE(p + 1, to_read);
+          p_content_length -= to_read;
+          p += to_read;
+
+          if (p_content_length != 0) {
+            UPDATE_STATE(s_chunk_data);
+            break;
+          }
+        }
+
+        break;
+      }
+
+      CASE(s_chunk_data_almost_done):
+        assert(p_flags & F_CHUNKED);
+        assert(p_content_length == 0);
+        STRICT_CHECK(ch != CR);
+        UPDATE_STATE(s_chunk_data_done);
+        CALLBACK_DATA(body);
+        break;
+
+      CASE(s_chunk_data_done):
+        assert(p_flags & F_CHUNKED);
+        STRICT_CHECK(ch != LF);
+        parser->nread = 0;
+        nread = 0;
+        UPDATE_STATE(s_chunk_size_start);
+        CALLBACK_NOTIFY(chunk_complete);
+        break;
+
+      default:
+        assert(0 && "unhandled state");
+        SET_ERRNO(HPE_INVALID_INTERNAL_STATE);
+        goto error;
+    }
+  }
+
+  /* Run callbacks for any marks that we have leftover after we ran out of
+   * bytes. There should be at most one of these set, so it's OK to invoke
+   * them in series (unset marks will not result in callbacks).
+   *
+   * We use the NOADVANCE() variety of callbacks here because 'p' has already
+   * overflowed 'data' and this allows us to correct for the off-by-one that
+   * we'd otherwise have (since CALLBACK_DATA() is meant to be run with a 'p'
+   * value that's in-bounds).
+   */
+
+  /* Carry a partial header name's candidate id over to the next call */
+  if (CURRENT_STATE() == s_header_field) {
+    size_t seen = field_seen + (data + len - header_field_mark);
+    parser->header_id = header_extend(field_seen ? parser->header_id : 1,
+                                      field_seen, header_field_mark,
+                                      data + len);
+    p_index = MIN(seen - 1, 127);
+  }
+
+  assert(((header_field_mark ? 1 : 0) +
+          (header_value_mark ? 1 : 0) +
+          (url_mark ? 1 : 0)  +
+          (body_mark ? 1 : 0) +
+          (status_mark ? 1 : 0)) <= 1);
+
+  CALLBACK_DATA_NOADVANCE(header_field);
+  CALLBACK_DATA_NOADVANCE(header_value);
+  CALLBACK_DATA_NOADVANCE(url);
+  CALLBACK_DATA_NOADVANCE(body);
+  CALLBACK_DATA_NOADVANCE(status);
+  BODY_FLUSH(p - data);
+
+  RETURN(len);
+
+error:
+  if (HTTP_PARSER_ERRNO(parser) == HPE_OK) {
+    SET_ERRNO(HPE_UNKNOWN);
+  }
+
+  RETURN(p - data);
+}
+
+
+size_t http_parser_execute (http_parser *parser,
+                            const http_parser_settings *settings,
+                            const char *data,
+                            size_t len)
+{
+  return execute(parser, settings, data, len, NULL, NULL, NULL);
+}
+
+
+size_t http_parser_execute_dechunk (http_parser *parser,
+                                    const http_parser_settings *settings,
+                                    char *data,
+                                    size_t len)
+{
+  return execute(parser, settings, data, len, NULL, data, NULL);
+}
+
+
+size_t http_parser_execute_batch (http_parser *parser,
+                                  const char *data,
+                                  size_t len,
+                                  struct http_parser_batch *batch)
+{
+  static const http_parser_settings no_callbacks;
+  const uint32_t base = batch->base;
+  size_t done = 0;
+  size_t n;
+
+  batch->nmessages = 0;
+  batch->nbodies = 0;
+
+  /* execute() pauses after every message. Keep the parser as it was at the
+   * last boundary, to go back to if the next message doesn't complete.
+   */
+  while (done < len && HTTP_PARSER_ERRNO(parser) == HPE_OK) {
+    http_parser saved = *parser;
+    uint32_t nmessages = batch->nmessages;
+    uint32_t nbodies = batch->nbodies;
+
+    batch->base = base + (uint32_t) done;
+    n = execute(parser, &no_callbacks, data + done, len - done,
+                NULL, NULL, batch);
+
+    if (batch->nmessages == nmessages) {
+      if (HTTP_PARSER_ERRNO(parser) == HPE_OK ||
+          HTTP_PARSER_ERRNO(parser) == HPE_PAUSED) {
+        *parser = saved;
+        batch->nbodies = nbodies;
+        break;
+      }
+      done += n;
+      break;
+    }
+
+    assert(HTTP_PARSER_ERRNO(parser) == HPE_PAUSED);
+    parser->http_errno = HPE_OK;
+    done += n;
+
+    if (!batch->messages[nmessages].keep_alive ||
+        batch->messages[nmessages].upgrade) {
+      break;
+    }
+  }
+
+  batch->base = base + (uint32_t) done;
+  return done;
+}
+
+#if HTTP_PARSER_DFA_CHECK
+static int
+dfa_check_stop (http_parser *parser)
+{
+  http_parser_pause(parser, 1);
+  return 0;
+}
+
+/* Run both head engines over `data` from a message start and assert that
+ * they come to the same verdict: the same head, no head yet, or the same
+ * error. The tables don't look at what headers mean, so heads that
+ * execute() rejects for their Content-Length are left out.
+ */
+static void
+dfa_check (const http_parser *parser,
+           const char *data,
+           size_t len,
+           const struct http_parser_head *head)
+{
+  http_parser_settings stop;
+  http_parser scanned = *parser;
+  http_parser parsed = *parser;
+  struct http_parser_head a = *head;
+  struct http_parser_head b = *head;
+  enum http_errno err;
+  size_t n, m;
+  uint32_t i;
+
+  memset(&stop, 0, sizeof(stop));
+  stop.on_headers_complete = dfa_check_stop;
+
+  a.headers = malloc(sizeof(*a.headers) * (head->max_headers + 1));
+  b.headers = malloc(sizeof(*b.headers) * (head->max_headers + 1));
+  assert(a.headers != NULL && b.headers != NULL);
+
+  n = http_parser_scan_head(&scanned, data, len, &a);
+  /* Pausing in on_headers_complete returns the offset of the last byte of
+   * the head
+   */
+  m = execute(&parsed, &stop, data, len, &b, NULL, NULL);
+  err = HTTP_PARSER_ERRNO(&parsed);
+
+  if (err == HPE_INVALID_CONTENT_LENGTH ||
+      err == HPE_UNEXPECTED_CONTENT_LENGTH) {
+    /* Not the tables' business */
+  } else if (err != HPE_PAUSED) {
+    assert(n == 0);
+    assert(HTTP_PARSER_ERRNO(&scanned) == err);
+  } else {
+    assert(n == m + 1);
+    assert(HTTP_PARSER_ERRNO(&scanned) == HPE_OK);
+    assert(a.url_len == b.url_len);
+    assert(a.url_len == 0 || a.url_off == b.url_off);
+    assert(memcmp(&a.url, &b.url, sizeof(a.url)) == 0);
+    assert(a.status_len == b.status_len);
+    assert(a.status_len == 0 || a.status_off == b.status_off);
+    assert(a.nheaders == b.nheaders);
+    for (i = 0; i < a.nheaders; i++) {
+      assert(a.headers[i].name_off == b.headers[i].name_off);
+      assert(a.headers[i].name_len == b.headers[i].name_len);
+      assert(a.headers[i].value_len == b.headers[i].value_len);
+      assert(a.headers[i].value_len == 0 ||
+             a.headers[i].value_off == b.headers[i].value_off);
+      assert(a.headers[i].id == b.headers[i].id);
+    }
+    assert(scanned.http_major == parsed.http_major);
+    assert(scanned.http_minor == parsed.http_minor);
+    if (parsed.type == HTTP_REQUEST) {
+      assert(scanned.method == parsed.method);
+    } else {
+      assert(scanned.status_code == parsed.status_code);
+    }
+  }
+
+  free(a.headers);
+  free(b.headers);
+}
+#endif
+
+
+size_t http_parser_execute_head (http_parser *parser,
+                                 const http_parser_settings *settings,
+                                 const char *data,
+                                 size_t len,
+                                 struct http_parser_head *head)
+{
+  size_t nparsed;
+
+#if HTTP_PARSER_DFA_CHECK
+  if (HTTP_PARSER_ERRNO(parser) == HPE_OK &&
+      (parser->state == s_start_req || parser->state == s_start_res ||
+       parser->state == s_start_req_or_res)) {
+    dfa_check(parser, data, len, head);
+  }
+#endif
+
+  nparsed = execute(parser, settings, data, len, head, NULL, NULL);
+  head->base += (uint32_t) nparsed;
+  return nparsed;
+}
 
-        unhex_val = unhex[(unsigned char)ch];
 
-        if (unhex_val == -1) {
-          if (ch == ';' || ch == ' ') {
-            UPDATE_STATE(s_chunk_parameters);
-            break;
-          }
+size_t
+http_parser_scan_head (http_parser *parser,
+                       const char *data,
+                       size_t len,
+                       struct http_parser_head *head)
+{
+  const char *p;
+  const char *end = data + MIN(len, HTTP_MAX_HEADER_SIZE);
+  const char *mark = data;
+  struct http_parser_header *h = NULL;
+  unsigned int s, t, i;
 
-          SET_ERRNO(HPE_INVALID_CHUNK_SIZE);
-          goto error;
-        }
+  if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {
+    return 0;
+  }
 
-        t = parser->content_length;
-        t *= 16;
-        t += unhex_val;
+  switch (parser->type) {
+    case HTTP_REQUEST:  s = DFA_START_REQUEST; break;
+    case HTTP_RESPONSE: s = DFA_START_RESPONSE; break;
+    default:            s = DFA_START_BOTH; break;
+  }
 
-        /* Overflow? Test against a conservative limit for simplicity. */
-        if (UNLIKELY((ULLONG_MAX - 16) / 16 < parser->content_length)) {
-          SET_ERRNO(HPE_INVALID_CONTENT_LENGTH);
-          goto error;
-        }
+  head_reset(head);
+  parser->status_code = 0;
 
-        parser->content_length = t;
-        break;
-      }
+#define DFA_OFF(P) (head->base + (uint32_t) ((P) - data))
 
-      case s_chunk_parameters:
-      {
-        assert(parser->flags & F_CHUNKED);
-        /* just ignore this shit. TODO check for overflow */
-        if (ch == CR) {
-          UPDATE_STATE(s_chunk_size_almost_done);
-          break;
-        }
-        break;
+  /* Like execute(), fail with HPE_HEADER_OVERFLOW rather than look at byte
+   * HTTP_MAX_HEADER_SIZE of a head
+   */
+  for (p = data; p != end; p++) {
+    t = dfa_next[s][dfa_class[(unsigned char) *p]];
+    if (UNLIKELY((t & DFA_STATE_MASK) == 0)) {
+      t = parser->lenient_http_headers ? dfa_lenient[s] : 0;
+      if (t == 0) {
+        parser->http_errno = dfa_error[s];
+        return 0;
       }
+    }
+    s = t & DFA_STATE_MASK;
 
-      case s_chunk_size_almost_done:
-      {
-        assert(parser->flags & F_CHUNKED);
-        STRICT_CHECK(ch != LF);
+    switch (t >> DFA_STATE_BITS) {
+      case DFA_NONE:
+        break;
 
-        parser->nread = 0;
-        nread = 0;
+      case DFA_MARK:
+        mark = p;
+        break;
 
-        if (parser->content_length == 0) {
-          parser->flags |= F_TRAILING;
-          UPDATE_STATE(s_header_field_start);
-        } else {
-          UPDATE_STATE(s_chunk_data);
+      case DFA_URL:
+        parser->http_major = 0;
+        parser->http_minor = 9;
+        head->url_off = DFA_OFF(mark);
+        head->url_len = (uint32_t) (p - mark);
+        if (http_parser_parse_url32(mark, p - mark,
+                                    parser->method == HTTP_CONNECT,
+                                    &head->url) == 0) {
+          for (i = 0; i < UF_MAX; i++) {
+            if (head->url.field_set & (1 << i)) {
+              head->url.field_data[i].off += head->url_off;
+            }
+          }
         }
-        CALLBACK_NOTIFY(chunk_header);
         break;
-      }
-
-      case s_chunk_data:
-      {
-        uint64_t to_read = MIN(parser->content_length,
-                               (uint64_t) ((data + len) - p));
-
-        assert(parser->flags & F_CHUNKED);
-        assert(parser->content_length != 0
-            && parser->content_length != ULLONG_MAX);
 
-        /* See the explanation in s_body_identity for why the content
-         * length and data pointers are managed this way.
-         */
-        MARK(body);
-        parser->content_length -= to_read;
-        p += to_read - 1;
+      case DFA_STATUS:
+        head->status_off = DFA_OFF(mark);
+        head->status_len = (uint32_t) (p - mark);
+        break;
 
-        if (parser->content_length == 0) {
-          UPDATE_STATE(s_chunk_data_almost_done);
+      case DFA_FIELD:
+        if (UNLIKELY(head->nheaders == head->max_headers)) {
+          parser->http_errno = HPE_TOO_MANY_HEADERS;
+          return 0;
         }
+        h = head->headers + head->nheaders++;
+        h->name_off = DFA_OFF(mark);
+        h->name_len = (uint32_t) (p - mark);
+        h->value_off = 0;
+        h->value_len = 0;
+        h->id = header_lookup(mark, p - mark);
+        break;
 
+      case DFA_VALUE:
+        assert(h != NULL);
+        h->value_off = DFA_OFF(mark);
+        h->value_len = (uint32_t) (p - mark);
         break;
-      }
 
-      case s_chunk_data_almost_done:
-        assert(parser->flags & F_CHUNKED);
-        assert(parser->content_length == 0);
-        STRICT_CHECK(ch != CR);
-        UPDATE_STATE(s_chunk_data_done);
-        CALLBACK_DATA(body);
+      case DFA_MAJOR:
+        parser->http_major = *p - '0';
         break;
 
-      case s_chunk_data_done:
-        assert(parser->flags & F_CHUNKED);
-        STRICT_CHECK(ch != LF);
-        parser->nread = 0;
-        nread = 0;
-        UPDATE_STATE(s_chunk_size_start);
-        CALLBACK_NOTIFY(chunk_complete);
+      case DFA_MINOR:
+        parser->http_minor = *p - '0';
+        break;
+
+      case DFA_CODE:
+        parser->status_code = parser->status_code * 10 + (*p - '0');
         break;
 
+      case DFA_DONE:
+        head->base += (uint32_t) (p + 1 - data);
+        return p + 1 - data;
+
       default:
-        assert(0 && "unhandled state");
-        SET_ERRNO(HPE_INVALID_INTERNAL_STATE);
-        goto error;
+        parser->method = (t >> DFA_STATE_BITS) - DFA_METHOD;
+        break;
     }
   }
 
-  /* Run callbacks for any marks that we have leftover after we ran out of
-   * bytes. There should be at most one of these set, so it's OK to invoke
-   * them in series (unset marks will not result in callbacks).
-   *
-   * We use the NOADVANCE() variety of callbacks here because 'p' has already
-   * overflowed 'data' and this allows us to correct for the off-by-one that
-   * we'd otherwise have (since CALLBACK_DATA() is meant to be run with a 'p'
-   * value that's in-bounds).
-   */
-
-  assert(((header_field_mark ? 1 : 0) +
-          (header_value_mark ? 1 : 0) +
-          (url_mark ? 1 : 0)  +
-          (body_mark ? 1 : 0) +
-          (status_mark ? 1 : 0)) <= 1);
-
-  CALLBACK_DATA_NOADVANCE(header_field);
-  CALLBACK_DATA_NOADVANCE(header_value);
-  CALLBACK_DATA_NOADVANCE(url);
-  CALLBACK_DATA_NOADVANCE(body);
-  CALLBACK_DATA_NOADVANCE(status);
-
-  RETURN(len);
+#undef DFA_OFF
 
-error:
-  if (HTTP_PARSER_ERRNO(parser) == HPE_OK) {
-    SET_ERRNO(HPE_UNKNOWN);
+  if (UNLIKELY(len > HTTP_MAX_HEADER_SIZE)) {
+    parser->http_errno = HPE_HEADER_OVERFLOW;
   }
-
-  RETURN(p - data);
+  return 0;
 }
 
 
@@ -2102,6 +4558,18 @@ http_method_str (enum http_method m)
   return ELEM_AT(method_strings, m, "<unknown>");
 }
 
+const char *
+http_header_name (enum http_header_id id)
+{
+  return ELEM_AT(header_strings, id, "<unknown>");
+}
+
+enum http_header_id
+http_header_lookup (const char *name, size_t len)
+{
+  return header_lookup(name, len);
+}
+
 const char *
 http_status_str (enum http_status s)
 {
@@ -2233,6 +4701,24 @@ http_parse_host(const char * buf, struct http_parser_url *u, int found_at) {
 
   assert(u->field_set & (1 << UF_HOST));
 
+  if (!found_at) {
+    const char *host_end;
+    unsigned int port_len;
+    uint16_t port;
+
+    p = buf + u->field_data[UF_HOST].off;
+    if (parse_authority(p, buf + buflen, &host_end, &port_len, &port) ==
+        buf + buflen) {
+      u->field_data[UF_HOST].len = (uint16_t) (host_end - p);
+      if (port_len != 0) {
+        u->field_data[UF_PORT].off = (uint16_t) (host_end + 1 - buf);
+        u->field_data[UF_PORT].len = (uint16_t) port_len;
+        u->field_set |= (1 << UF_PORT);
+      }
+      return 0;
+    }
+  }
+
   u->field_data[UF_HOST].len = 0;
 
   s = found_at ? s_http_userinfo_start : s_http_host_start;
@@ -2376,14 +4862,21 @@ http_parser_parse_url(const char *buf, size_t buflen, int is_connect,
     /* Nothing's changed; soldier on */
     if (uf == old_uf) {
       u->field_data[uf].len++;
-      continue;
+    } else {
+      u->field_data[uf].off = p - buf;
+      u->field_data[uf].len = 1;
+
+      u->field_set |= (1 << uf);
+      old_uf = uf;
     }
 
-    u->field_data[uf].off = p - buf;
-    u->field_data[uf].len = 1;
+    /* Path, query and fragment only end at a delimiter; skip to it */
+    if (s == s_req_path || s == s_req_query_string || s == s_req_fragment) {
+      const char *end = scan_url(p + 1, buf + buflen);
 
-    u->field_set |= (1 << uf);
-    old_uf = uf;
+      u->field_data[uf].len += end - (p + 1);
+      p = end - 1;
+    }
   }
 
   /* host must be present if there is a schema */
@@ -2434,6 +4927,336 @@ http_parser_parse_url(const char *buf, size_t buflen, int is_connect,
   return 0;
 }
 
+int
+http_parser_parse_host(const char *buf, size_t buflen,
+                       struct http_parser_url32 *u)
+{
+  const char *p;
+  const char *end;
+  const char *host_end;
+  unsigned int port_len;
+  uint16_t port;
+  uint8_t host = s_http_host_start;
+
+  memset(u, 0, sizeof(*u));
+
+  /* Header values keep their trailing whitespace */
+  while (buflen > 0 && (buf[buflen - 1] == ' ' || buf[buflen - 1] == '\t')) {
+    buflen--;
+  }
+
+  if (buflen == 0 || (uint32_t) buflen != buflen) {
+    return 1;
+  }
+
+  end = buf + buflen;
+  if (parse_authority(buf, end, &host_end, &port_len, &port) == end) {
+    url_split_authority(u, &host, 0, buf, host_end, port_len, port);
+    return 0;
+  }
+
+  /* IPv6 literals and zone IDs; there's no userinfo in a Host header */
+  for (p = buf; p < end; p++) {
+    if (*p == '@') {
+      memset(u, 0, sizeof(*u));
+      return 1;
+    }
+    url_host_char(u, &host, (uint32_t) (p - buf), *p);
+  }
+
+  return url_split_end(u, host, s_req_server, (uint32_t) buflen, 0);
+}
+
+/* Returns a pointer to the first `a` or `b` in [p, end), or `end` if there
+ * is none.
+ */
+static const char *
+scan_either (const char *p, const char *end, char a, char b)
+{
+#if HTTP_PARSER_SIMD
+  switch (simd_level()) {
+    case SIMD_AVX2:
+      p = scan_either_avx2(p, end, a, b);
+      break;
+    case SIMD_SSE42:
+      p = scan_either_sse42(p, end, a, b);
+      break;
+    default:
+      break;
+  }
+#endif
+
+  while (p != end && *p != a && *p != b) {
+    p++;
+  }
+
+  return p;
+}
+
+size_t
+http_parser_split_query(const char *buf, size_t buflen,
+                        struct http_parser_param *params, size_t max_params)
+{
+  const char *p = buf;
+  const char *end = buf + buflen;
+  const char *key, *sep;
+  size_t n = 0;
+
+  while (p != end) {
+    key = p;
+    p = scan_either(p, end, '&', '=');
+    sep = p;
+
+    /* A value runs to the next '&'; any further '=' is part of it */
+    if (p != end && *p == '=') {
+      p = scan_either(p + 1, end, '&', '&');
+    }
+
+    if (p != key) {
+      if (n < max_params) {
+        struct http_parser_param *param = &params[n];
+
+        param->key_off = (uint32_t) (key - buf);
+        param->key_len = (uint32_t) (sep - key);
+        param->value_off = (uint32_t) (sep - buf) + (sep != p);
+        param->value_len = (uint32_t) (p - buf) - param->value_off;
+      }
+      n++;
+    }
+
+    if (p != end) {
+      p++;
+    }
+  }
+
+  return n;
+}
+
+int
+http_parser_decode_param(const char *buf, size_t buflen, char *out,
+                         size_t *outlen)
+{
+  const char *p = buf;
+  const char *end = buf + buflen;
+  const char *q;
+  size_t o = 0;
+
+  while (p != end) {
+    q = scan_either(p, end, '%', '+');
+    if (out + o != p) {
+      memmove(out + o, p, q - p);
+    }
+    o += q - p;
+    p = q;
+
+    if (p == end) {
+      break;
+    }
+
+    if (*p == '+') {
+      out[o++] = ' ';
+      p++;
+      continue;
+    }
+
+    if (end - p < 3 || !IS_HEX(p[1]) || !IS_HEX(p[2])) {
+      return 1;
+    }
+
+    out[o++] = (char) (unhex[(unsigned char) p[1]] << 4 |
+                       unhex[(unsigned char) p[2]]);
+    p += 3;
+  }
+
+  *outlen = o;
+  return 0;
+}
+
+/* Path normalization.
+ *
+ * The result is what percent-decoding the path and then applying
+ * remove_dot_segments() (RFC 3986 5.2.4) and merging slashes would give,
+ * in one pass: `seg` is where the segment being copied starts in `out`, and
+ * each '/', literal or decoded, looks back at it for "." and "..". Paths
+ * with nothing to do, which is most of them, are a single scan_path().
+ */
+
+/* If out[seg, o) is "." drop it, and if it is ".." drop it and the segment
+ * before it, but not the root. Returns the new end of `out`.
+ */
+static size_t
+path_dot_segment (const char *out, size_t o, size_t seg, size_t root)
+{
+  if (o - seg == 1 && out[seg] == '.') {
+    return seg;
+  }
+
+  if (o - seg == 2 && out[seg] == '.' && out[seg + 1] == '.') {
+    for (o = seg; o > root; o--) {
+      if (o < seg && out[o - 1] == '/') {
+        break;
+      }
+    }
+  }
+
+  return o;
+}
+
+int
+http_parser_normalize_path(const char *buf, size_t buflen, char *out,
+                           size_t *outlen)
+{
+  const char *p = buf;
+  const char *end = buf + buflen;
+  const char *q;
+  size_t o = 0, seg, end_o, root = 0;
+  unsigned char c;
+
+  if (p != end && *p == '/') {
+    out[o++] = '/';
+    p++;
+    root = 1;
+  } else if (end - p >= 3 && p[0] == '%' && p[1] == '2' && LOWER(p[2]) == 'f') {
+    out[o++] = '/';
+    p += 3;
+    root = 1;
+  }
+
+  /* Skip what doesn't need changing */
+  q = p;
+  if (q != end && *q != '.' && *q != '/') {
+    q = scan_path(q, end, 0);
+  }
+  if (out + o != p) {
+    memmove(out + o, p, q - p);
+  }
+  o += q - p;
+  p = q;
+
+  for (seg = o; seg > root && out[seg - 1] != '/'; seg--);
+
+  while (p != end) {
+    q = scan_path(p, end, 1);
+    if (out + o != p) {
+      memmove(out + o, p, q - p);
+    }
+    o += q - p;
+    p = q;
+
+    if (p == end) {
+      break;
+    }
+
+    if (*p == '%') {
+      if (end - p < 3 || !IS_HEX(p[1]) || !IS_HEX(p[2])) {
+        return 1;
+      }
+
+      c = (unsigned char) (unhex[(unsigned char) p[1]] << 4 |
+                           unhex[(unsigned char) p[2]]);
+      p += 3;
+
+      /* A NUL would end the path early for C string users */
+      if (c == 0) {
+        return 1;
+      }
+
+      if (c != '/') {
+        out[o++] = (char) c;
+        continue;
+      }
+    } else {
+      p++;
+    }
+
+    /* A '/' ends the segment at `seg`; empty ones are dropped */
+    end_o = path_dot_segment(out, o, seg, root);
+    if (end_o == o && o != seg) {
+      out[end_o++] = '/';
+    }
+    o = seg = end_o;
+  }
+
+  *outlen = path_dot_segment(out, o, seg, root);
+  return 0;
+}
+
+int
+http_parser_parse_url32(const char *buf, size_t buflen, int is_connect,
+                        struct http_parser_url32 *u)
+{
+  enum state s, new_s;
+  const char *p, *q;
+  const char *end = buf + buflen;
+  const char *host_end;
+  unsigned int port_len;
+  uint16_t port;
+  uint8_t host = s_http_host_start;
+
+  memset(u, 0, sizeof(*u));
+
+  if (buflen == 0 || (uint32_t) buflen != buflen) {
+    return 1;
+  }
+
+  s = is_connect ? s_req_server_start : s_req_spaces_before_url;
+
+  for (p = buf; p < end; p++) {
+    new_s = parse_url_char(s, *p);
+    if (new_s == s_dead) {
+      memset(u, 0, sizeof(*u));
+      return 1;
+    }
+
+    /* Take a plain "host[:port]" in one go */
+    if (s == s_req_server_start && new_s == s_req_server &&
+        (q = parse_authority(p, end, &host_end, &port_len, &port)) != NULL) {
+      url_split_authority(u, &host, (uint32_t) (p - buf), p, host_end,
+                          port_len, port);
+      s = s_req_server;
+      p = q - 1;
+      continue;
+    }
+
+    url_split_char(u, &host, s, new_s, (uint32_t) (p - buf), *p);
+    s = new_s;
+
+    /* Path, query and fragment only end at a delimiter; skip to it */
+    if (s == s_req_path || s == s_req_query_string || s == s_req_fragment) {
+      p = scan_url(p + 1, end) - 1;
+    }
+  }
+
+  return url_split_end(u, host, s, (uint32_t) buflen, is_connect);
+}
+
+size_t
+http_header_field_lower(const char *buf, size_t buflen, char *out) {
+  return scan_token(buf, buf + buflen, out) - buf;
+}
+
+void
+http_parser_head_init(struct http_parser_head *head,
+                      struct http_parser_header *headers,
+                      uint32_t max_headers) {
+  memset(head, 0, sizeof(*head));
+  head->headers = headers;
+  head->max_headers = max_headers;
+}
+
+void
+http_parser_batch_init(struct http_parser_batch *batch,
+                       struct http_parser_message *messages,
+                       uint32_t max_messages,
+                       struct http_parser_span *bodies,
+                       uint32_t max_bodies) {
+  memset(batch, 0, sizeof(*batch));
+  batch->messages = messages;
+  batch->max_messages = max_messages;
+  batch->bodies = bodies;
+  batch->max_bodies = max_bodies;
+}
+
 void
 http_parser_pause(http_parser *parser, int paused) {
   /* Users should only be pausing/unpausing a parser that is not in an error
@@ -5,6 +5,9 @@ using std::unique_ptr;
 using std::optional;
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <climits>
 
 
 #define RequestParser HttpParser<HttpRequest>
@@ -16,11 +19,11 @@ using std::optional;
  * HttpParser<HttpRequest>
  * 
  **********************************************************************/
-RequestParser::HttpParser()
+RequestParser::HttpParser(MessageArena *arena)
 {
     HTTP_PARSER::http_parser_settings setting =
     {
-        nullptr, // on_message_begin;
+        on_message_begin, // on_message_begin;
         on_url, // on_url;
         nullptr, // on_status;
         on_header_field, // on_header_field;
@@ -29,16 +32,43 @@ RequestParser::HttpParser()
         on_body, // on_body;
         on_message_complete, // on_message_complete;
         nullptr, // on_chunk_header;
-        nullptr // on_chunk_complete;
+        nullptr, // on_chunk_complete;
+        nullptr // on_body_ranges;
     };
     this->setting = setting;
 
+    this->data.arena = arena;
+    this->data.in_message = false;
+    this->data.message_lost = false;
     this->data.complete = false;
+    this->data.head_ready = false;
+    this->data.body_action = Buffer;
+    this->data.body_sink = nullptr;
+    this->data.sink_failed = false;
+    this->nparsed = 0;
     this->parser.data = &this->data;
 
     http_parser_init(&this->parser, HTTP_PARSER::HTTP_REQUEST);
 }
 
+/**
+ * A pipelined message begins after the previous one was queued, with no
+ * request to parse into yet.
+ */
+int RequestParser::on_message_begin(HTTP_PARSER::http_parser *parser)
+{
+    instance_data_t *data = (instance_data_t*)parser->data;
+
+    if(!data->req_ptr)
+    {
+        begin_message(data);
+        if(data->owner)
+            data->req_ptr->owners.push_back(data->owner);
+    }
+    data->in_message = true;
+    return 0;
+}
+
 int RequestParser::on_url(HTTP_PARSER::http_parser *parser, const char *at, size_t length)
 {
     instance_data_t *data = (instance_data_t*)parser->data;
@@ -57,7 +87,17 @@ int RequestParser::on_url(HTTP_PARSER::http_parser *parser, const char *at, size
     {
         // method
         req->method_num = parser->method;
+    }
 
+    if(data->zero_copy)
+    {
+        append(data->url_span, data->state == FirstCall, at, length, req->coalesced);
+        data->last_callback = Url;
+        return 0;
+    }
+
+    if(data->state == FirstCall)
+    {
         // url
         data->url_index= req->headers_str.length();
         data->url_len = length;
@@ -67,7 +107,7 @@ int RequestParser::on_url(HTTP_PARSER::http_parser *parser, const char *at, size
         data->url_len += length;
     }
 
-    req->headers_str.append(string(at, length));
+    req->headers_str.append(at, length);
 
     data->last_callback = Url;
     return 0;
@@ -88,13 +128,23 @@ int RequestParser::on_header_field(HTTP_PARSER::http_parser* parser, const char
             break;
         case HeaderValue:
             data->state = FirstCall;
-            // Create str_view_t for last header value, and insert into std::map
-            data->headers.push_back({data->header_value_index, data->header_value_len});
+            // Create str_view_t for last header value, and insert into the header table
+            if(data->zero_copy)
+                data->header_views.push_back(data->value_span.view());
+            else
+                data->headers.push_back({data->header_value_index, data->header_value_len});
             break;
         default:
             assert(false);
     }
 
+    if(data->zero_copy)
+    {
+        append(data->header_span, data->state == FirstCall, at, length, req->coalesced);
+        data->last_callback = HeaderField;
+        return 0;
+    }
+
     if(data->state == FirstCall)
     {
         data->last_header_index = req->headers_str.length();
@@ -105,7 +155,7 @@ int RequestParser::on_header_field(HTTP_PARSER::http_parser* parser, const char
         data->last_header_len += length;
     }
 
-    req->headers_str.append(string(at, length));
+    req->headers_str.append(at, length);
 
     data->last_callback = HeaderField;
     return 0;
@@ -121,13 +171,24 @@ int RequestParser::on_header_value(HTTP_PARSER::http_parser* parser, const char
         data->state = FirstCall;
         assert(data->last_callback == HeaderField);
         // Create string_view for the field corrsponding with this value
-        data->headers.push_back({data->last_header_index, data->last_header_len});
+        if(data->zero_copy)
+            data->header_views.push_back(data->header_span.view());
+        else
+            data->headers.push_back({data->last_header_index, data->last_header_len});
+        data->header_ids.push_back(parser->header_id);
     }
     else
     {
         data->state = AfterFirst;
     }
 
+    if(data->zero_copy)
+    {
+        append(data->value_span, data->state == FirstCall, at, length, req->coalesced);
+        data->last_callback = HeaderValue;
+        return 0;
+    }
+
     if(data->state == FirstCall)
     {
         data->header_value_index = req->headers_str.length();
@@ -138,7 +199,7 @@ int RequestParser::on_header_value(HTTP_PARSER::http_parser* parser, const char
         data->header_value_len += length;
     }
 
-    req->headers_str.append(string(at, length));
+    req->headers_str.append(at, length);
 
     data->last_callback = HeaderValue;
     return 0;
@@ -154,9 +215,24 @@ int RequestParser::on_headers_complete(HTTP_PARSER::http_parser *parser)
     instance_data_t *data = (instance_data_t*)parser->data;
     HttpRequest *req = data->req_ptr.get();
 
+    if(data->zero_copy)
+    {
+        if(data->last_callback == HeaderValue)
+            data->header_views.push_back(data->value_span.view());
+
+        for(size_t i = 0; i + 1 < data->header_views.size(); i+=2)
+            req->headers.push_back(data->header_views[i], data->header_views[i+1], data->header_ids.at(i / 2));
+
+        data->header_views.clear();
+        data->header_ids.clear();
+        req->url_view = data->url_span.view();
+        data->last_callback = HeaderComplete;
+        return head_ready(parser);
+    }
+
     if(data->last_callback == HeaderValue)
     {
-        // Create string_view for last header value, and insert into std::map
+        // Create string_view for last header value, and insert into the header table
         data->headers.push_back({data->header_value_index, data->header_value_len});
 
         // length must be even number, {field, value} pairs
@@ -166,10 +242,11 @@ int RequestParser::on_headers_complete(HTTP_PARSER::http_parser *parser)
         {
             string_view field = data->headers.at(i).to_string_view(&req->headers_str[0]);
             string_view value = data->headers.at(i+1).to_string_view(&req->headers_str[0]);
-            req->headers.emplace(field, value);
+            req->headers.push_back(field, value, data->header_ids.at(i / 2));
         }
 
         data->headers.clear();
+        data->header_ids.clear();
     }
     // no headers are presented in the request
     else
@@ -182,7 +259,25 @@ int RequestParser::on_headers_complete(HTTP_PARSER::http_parser *parser)
 
     //reset_after_header_pair((instance_data_t*)parser->data);
     data->last_callback = HeaderComplete;
-    return 0;
+    return head_ready(parser);
+}
+
+/**
+ * The headers-ready stage: the request has its url and headers, and the
+ * head handler picks what happens to its body.
+ */
+int RequestParser::head_ready(HTTP_PARSER::http_parser *parser)
+{
+    instance_data_t *data = (instance_data_t*)parser->data;
+
+    data->head_ready = true;
+    if(data->head_handler)
+        data->body_action = data->head_handler(*data->req_ptr);
+
+    if(data->body_action == Buffer && !data->zero_copy && parser->content_length != ULLONG_MAX)
+        data->req_ptr->body_buf.reserve(parser->content_length);
+
+    return data->body_action == Reject ? -1 : 0;
 }
 
 int RequestParser::on_body(HTTP_PARSER::http_parser* parser, const char *at, size_t length)
@@ -190,7 +285,37 @@ int RequestParser::on_body(HTTP_PARSER::http_parser* parser, const char *at, siz
     instance_data_t *data = (instance_data_t*)parser->data;
     HttpRequest *req = data->req_ptr.get();
 
-    req->body_str.append(string(at, length));
+    switch(data->body_action)
+    {
+        case Buffer:
+            if(data->zero_copy)
+                append(data->body_span, data->last_callback != Body, at, length, req->coalesced);
+            else
+                req->body_buf.append(at, length);
+            break;
+        case Stream:
+            if(data->body_sink)
+            {
+                size_t n = data->body_sink->write(string_view(at, length));
+                if(n == BodySink::error)
+                    return -1;
+                // Backpressure: hold on to the rest and stop after this callback
+                if(n < length)
+                {
+                    data->pending = string_view(at + n, length - n);
+                    HTTP_PARSER::http_parser_pause(parser, 1);
+                }
+            }
+            else if(data->body_handler)
+                data->body_handler(*req, string_view(at, length));
+            break;
+        case Discard:
+            break;
+        case Reject:
+            return -1;
+    }
+
+    data->last_callback = Body;
     return 0;
 }
 
@@ -198,40 +323,174 @@ int RequestParser::on_message_complete(HTTP_PARSER::http_parser* parser)
 {
     (void)parser;
     instance_data_t *data = (instance_data_t*)parser->data;
-    //HttpRequest *req = data->req_ptr.get();
+    HttpRequest *req = data->req_ptr.get();
+
+    if(data->body_action == Reject)
+        return -1;
     data->complete = true;
+    data->head_ready = false;
+
+    if(data->body_action == Stream && data->body_sink)
+        data->body_sink->finish();
+
+    if(data->body_action != Buffer)
+        req->body_kept = false;
+    else if(data->zero_copy)
+        req->body_view = data->last_callback == Body ? data->body_span.view() : string_view();
+    // A body of several segments is flattened by body() if it is asked for
+    else if(req->body_buf.segment_count() == 1)
+        req->body_view = req->body_buf.segment(0);
 
     // Clear temp data
     data->headers.clear();
+    data->header_ids.clear();
+
+    // Anything after this belongs to the next message
+    data->finished.push_back(std::move(data->req_ptr));
+    data->in_message = false;
 
     return 0;
 }
 
-void RequestParser::init()
+/**
+ * Reset the per-message state and take a request to parse into, reusing
+ * a recycled one if there is any.
+ */
+void RequestParser::begin_message(instance_data_t *data)
 {
-    http_parser_init(&this->parser, HTTP_PARSER::HTTP_REQUEST);
+    data->header_views.clear();
+    data->headers.clear();
+    data->header_ids.clear();
+
+    data->url_index = 0;
+    data->url_len = 0;
+    data->last_header_index = 0;
+    data->last_header_len = 0;
+    data->header_value_index = 0;
+    data->header_value_len = 0;
+
+    data->last_callback = None;
+    data->state = FirstCall;
+    data->head_ready = false;
+    data->body_action = Buffer;
+
+    data->req_ptr.reset();
+    while(!data->req_ptr && !data->spare.empty())
+    {
+        if(!stale(data, data->spare.back()))
+            data->req_ptr = std::move(data->spare.back());
+        data->spare.pop_back();
+    }
 
-    this->data.url_index = 0;
-    this->data.url_len = 0;
-    this->data.last_header_index = 0;
-    this->data.last_header_len = 0;
-    this->data.header_value_index = 0;
-    this->data.header_value_len = 0;
+    if(data->req_ptr)
+        return;
+    if(data->arena)
+        data->req_ptr = {data->arena->create<HttpRequest>(), MessageDeleter{true, data->arena->generation()}};
+    else
+        data->req_ptr = {new HttpRequest(), MessageDeleter{false}};
+}
 
-    this->data.last_callback = None;
-    this->data.state = FirstCall;
+/**
+ * Whether `req` was built in the arena before its last reset(), and so no
+ * longer exists.
+ */
+bool RequestParser::stale(const instance_data_t *data, const std::unique_ptr<HttpRequest, MessageDeleter> &req)
+{
+    return req && req.get_deleter().in_arena
+        && req.get_deleter().generation != data->arena->generation();
+}
 
-    this->data.complete = false;
+/**
+ * Forget the messages a reset() of the arena destroyed. One that had begun
+ * cannot be continued; one that had not is begun again.
+ */
+void RequestParser::drop_stale()
+{
+    instance_data_t &data = this->data;
+    if(!data.arena || !stale(&data, data.req_ptr))
+        return;
+
+    if(data.in_message)
+    {
+        data.req_ptr.reset();
+        data.head_ready = false;
+        data.message_lost = true;
+    }
+    else
+        begin_message(&data);
+}
+
+void RequestParser::init(Buffering buffering)
+{
+    http_parser_init(&this->parser, HTTP_PARSER::HTTP_REQUEST);
 
-    this->data.req_ptr = std::unique_ptr<HttpRequest>(new HttpRequest());
+    this->data.zero_copy = buffering == ZeroCopy;
+    this->data.finished.clear();
+    this->data.complete = false;
+    this->data.pending = string_view();
+    this->data.sink_failed = false;
+    this->data.in_message = false;
+    this->data.message_lost = false;
+    this->nparsed = 0;
+    begin_message(&this->data);
 }
 
 bool RequestParser::parse(const string_view &input)
 {
     this->data.complete = false;
-    size_t nparsed = http_parser_execute(&this->parser, &this->setting, input.data(), input.length());
+    this->drop_stale();
+    if(this->data.sink_failed || this->data.message_lost)
+        return false;
+    this->nparsed = http_parser_execute(&this->parser, &this->setting, input.data(), input.length());
 
-    return nparsed == input.length();
+    return this->nparsed == input.length() || this->paused();
+}
+
+bool RequestParser::parse(const string_view &input, std::shared_ptr<const void> owner)
+{
+    this->drop_stale();
+    if(this->data.req_ptr)
+    {
+        std::pmr::vector<std::shared_ptr<const void>> &owners = this->data.req_ptr->owners;
+        if(owner && (owners.empty() || owners.back() != owner))
+            owners.push_back(owner);
+    }
+
+    // Messages that begin in `input` take their reference in on_message_begin
+    this->data.owner = std::move(owner);
+    bool ok = this->parse(input);
+    this->data.owner.reset();
+    return ok;
+}
+
+/**
+ * Extend `span` by a fragment. Fragments that continue the span in memory
+ * (the caller's buffers happen to be adjacent) are still free; anything else
+ * copies the span into a new string at the back of `coalesced`.
+ */
+void RequestParser::append(span_t &span, bool first, const char *at, size_t length,
+                           std::pmr::deque<std::pmr::string> &coalesced)
+{
+    if(first)
+    {
+        span = {at, length, false};
+        return;
+    }
+
+    if(!span.owned)
+    {
+        if(span.ptr + span.len == at)
+        {
+            span.len += length;
+            return;
+        }
+        coalesced.emplace_back(span.ptr, span.len);
+        span.owned = true;
+    }
+
+    coalesced.back().append(at, length);
+    span.ptr = coalesced.back().data();
+    span.len = coalesced.back().length();
 }
 
 bool RequestParser::complete()
@@ -241,25 +500,116 @@ bool RequestParser::complete()
 
 std::optional<HttpRequest*> RequestParser::result()
 {
-    // signal EOF to the parser
-    http_parser_execute(&this->parser, &this->setting, nullptr, 0);
+    // No EOF is signalled: only responses can end at EOF, and it would fail
+    // a pipelined request still under way.
+
+    // Messages a reset() destroyed are dropped
+    while(!this->data.finished.empty() && stale(&this->data, this->data.finished.front()))
+        this->data.finished.pop_front();
 
     // If called when the full msg has not been feed into parser (or msg has error, and
     // doesn't terminate) , return nullopt
-    if(! this->data.complete)
+    if(this->data.finished.empty())
         return std::nullopt;
 
-    HttpRequest *ptr = this->data.req_ptr.get();
-    this->data.req_ptr.release();
+    HttpRequest *ptr = this->data.finished.front().release();
+    this->data.finished.pop_front();
     return ptr;
 }
 
+void RequestParser::set_head_handler(HeadHandler handler)
+{
+    this->data.head_handler = std::move(handler);
+}
+
+void RequestParser::set_body_handler(BodyHandler handler)
+{
+    this->data.body_handler = std::move(handler);
+}
+
+void RequestParser::set_body_sink(BodySink *sink)
+{
+    this->data.body_sink = sink;
+}
+
+bool RequestParser::paused()
+{
+    return this->parser.http_errno == HTTP_PARSER::HPE_PAUSED;
+}
+
+size_t RequestParser::parsed()
+{
+    return this->nparsed;
+}
+
+bool RequestParser::resume()
+{
+    if(!this->paused() || this->data.sink_failed)
+        return false;
+
+    if(!this->data.pending.empty())
+    {
+        size_t n = this->data.body_sink->write(this->data.pending);
+        if(n == BodySink::error)
+        {
+            this->data.sink_failed = true;
+            return false;
+        }
+        this->data.pending.remove_prefix(n);
+        if(!this->data.pending.empty())
+            return false;
+    }
+
+    HTTP_PARSER::http_parser_pause(&this->parser, 0);
+    return true;
+}
+
+bool RequestParser::headers_ready()
+{
+    return this->data.head_ready;
+}
+
+std::optional<HttpRequest*> RequestParser::head()
+{
+    if(!this->data.head_ready)
+        return std::nullopt;
+    return this->data.req_ptr.get();
+}
+
+void RequestParser::set_body_action(BodyAction action)
+{
+    if(this->data.head_ready)
+        this->data.body_action = action;
+}
+
+std::vector<HttpRequest*> RequestParser::results()
+{
+    std::vector<HttpRequest*> reqs;
+    reqs.reserve(this->data.finished.size());
+    for(auto &req : this->data.finished)
+        if(!stale(&this->data, req))
+            reqs.push_back(req.release());
+    this->data.finished.clear();
+    return reqs;
+}
+
+void RequestParser::recycle(HttpRequest *req)
+{
+    instance_data_t &data = this->data;
+    req->clear();
+    if(data.arena)
+        data.spare.push_back({req, MessageDeleter{true, data.arena->generation()}});
+    else
+        data.spare.push_back({req, MessageDeleter{false}});
+}
+
 /**********************************************************************
  * 
  * HttpParser<HttpResponse>
  * 
  **********************************************************************/
-ResponseParser::HttpParser()
+ResponseParser::HttpParser(MessageArena *arena)
+    : arena(arena)
 {
     HTTP_PARSER::http_parser_settings setting =
     {
@@ -272,7 +622,8 @@ ResponseParser::HttpParser()
         on_body, // on_body;
         on_message_complete, // on_message_complete;
         nullptr, // on_chunk_header;
-        nullptr // on_chunk_complete;
+        nullptr, // on_chunk_complete;
+        nullptr // on_body_ranges;
     };
     this->setting = setting;
 
@@ -310,7 +661,7 @@ int ResponseParser::on_header_field(HTTP_PARSER::http_parser* parser, const char
             break;
         case HeaderValue:
             data->state = FirstCall;
-            // Create str_view_t for last header value, and insert into std::map
+            // Create str_view_t for last header value, and insert into the header table
             data->headers.push_back({data->header_value_index, data->header_value_len});
             break;
         default:
@@ -327,7 +678,7 @@ int ResponseParser::on_header_field(HTTP_PARSER::http_parser* parser, const char
         data->last_header_len += length;
     }
 
-    resp->headers_str.append(string(at, length));
+    resp->headers_str.append(at, length);
 
     data->last_callback = HeaderField;
     return 0;
@@ -344,6 +695,7 @@ int ResponseParser::on_header_value(HTTP_PARSER::http_parser* parser, const char
         assert(data->last_callback == HeaderField);
         // Create string_view for the field corrsponding with this value
         data->headers.push_back({data->last_header_index, data->last_header_len});
+        data->header_ids.push_back(parser->header_id);
     }
     else
     {
@@ -360,7 +712,7 @@ int ResponseParser::on_header_value(HTTP_PARSER::http_parser* parser, const char
         data->header_value_len += length;
     }
 
-    resp->headers_str.append(string(at, length));
+    resp->headers_str.append(at, length);
 
     data->last_callback = HeaderValue;
     return 0;
@@ -378,7 +730,7 @@ int ResponseParser::on_headers_complete(HTTP_PARSER::http_parser *parser)
 
     if(data->last_callback == HeaderValue)
     {
-        // Create string_view for last header value, and insert into std::map
+        // Create string_view for last header value, and insert into the header table
         data->headers.push_back({data->header_value_index, data->header_value_len});
 
         // length must be even number, {field, value} pairs
@@ -388,16 +740,20 @@ int ResponseParser::on_headers_complete(HTTP_PARSER::http_parser *parser)
         {
             string_view field = data->headers.at(i).to_string_view(&resp->headers_str[0]);
             string_view value = data->headers.at(i+1).to_string_view(&resp->headers_str[0]);
-            resp->headers.emplace(field, value);
+            resp->headers.push_back(field, value, data->header_ids.at(i / 2));
         }
 
         data->headers.clear();
+        data->header_ids.clear();
     }
     // no headers are presented in the request
     else
     {
     }
 
+    if(parser->content_length != ULLONG_MAX)
+        resp->body_buf.reserve(parser->content_length);
+
     //reset_after_header_pair((instance_data_t*)parser->data);
     data->last_callback = HeaderComplete;
     return 0;
@@ -408,7 +764,7 @@ int ResponseParser::on_body(HTTP_PARSER::http_parser* parser, const char *at, si
     instance_data_t *data = (instance_data_t*)parser->data;
     HttpResponse *resp = data->resp_ptr.get();
 
-    resp->body_str.append(string(at, length));
+    resp->body_buf.append(at, length);
     return 0;
 }
 
@@ -434,7 +790,10 @@ void ResponseParser::init()
 
     this->data.complete = false;
 
-    this->data.resp_ptr = std::unique_ptr<HttpResponse>(new HttpResponse());
+    if(this->arena)
+        this->data.resp_ptr = {this->arena->create<HttpResponse>(), MessageDeleter{true, this->arena->generation()}};
+    else
+        this->data.resp_ptr = {new HttpResponse(), MessageDeleter{false}};
 }
 
 bool ResponseParser::parse(const string_view &input)
@@ -456,6 +815,7 @@ std::optional<HttpResponse*> ResponseParser::result()
     http_parser_execute(&this->parser, &this->setting, nullptr, 0);
 
     this->data.headers.clear();
+    this->data.header_ids.clear();
 
     HttpResponse *ptr = this->data.resp_ptr.get();
     this->data.resp_ptr.release();
@@ -463,18 +823,585 @@ std::optional<HttpResponse*> ResponseParser::result()
 }
 
 
+/**********************************************************************
+ * 
+ * BodySink
+ * 
+ **********************************************************************/
+size_t DiscardSink::write(string_view data)
+{
+    this->total += data.length();
+    return data.length();
+}
+
+RingBufferSink::RingBufferSink(size_t capacity)
+    : buf(new char[capacity]), cap(capacity)
+{
+    assert(capacity > 0);
+}
+
+size_t RingBufferSink::write(string_view data)
+{
+    size_t n = std::min(data.length(), this->cap - this->len);
+    if(n == 0)
+        return 0;
+    size_t end = (this->start + this->len) % this->cap;
+    size_t first = std::min(n, this->cap - end);
+
+    memcpy(&this->buf[end], data.data(), first);
+    memcpy(&this->buf[0], data.data() + first, n - first);
+    this->len += n;
+    return n;
+}
+
+string_view RingBufferSink::peek() const
+{
+    return string_view(&this->buf[this->start], std::min(this->len, this->cap - this->start));
+}
+
+void RingBufferSink::consume(size_t n)
+{
+    assert(n <= this->len);
+    if(n == 0)
+        return;
+    this->start = (this->start + n) % this->cap;
+    this->len -= n;
+    // Restart at the front when empty, so peek() sees the longest run
+    if(this->len == 0)
+        this->start = 0;
+}
+
+size_t RingBufferSink::read(char *out, size_t n)
+{
+    size_t done = 0;
+    while(done < n && this->len != 0)
+    {
+        string_view run = this->peek();
+        size_t k = std::min(run.length(), n - done);
+        memcpy(out + done, run.data(), k);
+        this->consume(k);
+        done += k;
+    }
+    return done;
+}
+
+void RingBufferSink::clear()
+{
+    this->start = 0;
+    this->len = 0;
+    this->ended = false;
+}
+
+SpillSink::SpillSink(size_t memory_limit, std::pmr::memory_resource *mr)
+    : mem(mr), limit(memory_limit)
+{
+}
+
+SpillSink::~SpillSink()
+{
+    if(this->spill)
+        fclose(this->spill);
+}
+
+size_t SpillSink::write(string_view data)
+{
+    if(!this->spill && this->mem.length() + data.length() > this->limit)
+    {
+        this->spill = tmpfile();
+        if(!this->spill ||
+           fwrite(this->mem.data(), 1, this->mem.length(), this->spill) != this->mem.length())
+            return BodySink::error;
+        // Give the memory back; the body is in the file from now on
+        std::pmr::string(this->mem.get_allocator()).swap(this->mem);
+    }
+
+    if(this->spill)
+    {
+        if(fwrite(data.data(), 1, data.length(), this->spill) != data.length())
+            return BodySink::error;
+    }
+    else
+        this->mem.append(data);
+
+    this->total += data.length();
+    return data.length();
+}
+
+void SpillSink::finish()
+{
+    if(this->spill)
+    {
+        fflush(this->spill);
+        rewind(this->spill);
+    }
+}
+
+
+/**********************************************************************
+ * 
+ * MessageArena
+ * 
+ **********************************************************************/
+MessageArena::MessageArena(size_t initial_size)
+    : initial(new char[initial_size]),
+      pool(initial.get(), initial_size)
+{
+}
+
+MessageArena::~MessageArena()
+{
+    this->reset();
+}
+
+void MessageArena::reset()
+{
+    for(auto &msg : this->messages)
+        msg.second(msg.first);
+    this->messages.clear();
+    this->pool.release();
+    this->resets++;
+}
+
+
+/**********************************************************************
+ * 
+ * HeaderTable
+ * 
+ **********************************************************************/
+uint32_t HeaderTable::hash(string_view field)
+{
+    uint32_t h = 2166136261u;
+    for(char c : field)
+    {
+        if(c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        h = (h ^ (unsigned char)c) * 16777619u;
+    }
+    return h;
+}
+
+void HeaderTable::push_back(string_view field, string_view value, unsigned int id)
+{
+    entry e = {field, value, hash(field), id};
+    if(this->count < inline_capacity)
+        this->inline_entries[this->count] = e;
+    else
+        this->overflow.push_back(e);
+    this->count++;
+}
+
+void HeaderTable::clear()
+{
+    this->overflow.clear();
+    this->count = 0;
+}
+
+/**
+ * `view` pointed into `to` instead of [from, from + len), if it was in there.
+ */
+static string_view relocate(string_view view, const char *from, size_t len, const char *to)
+{
+    std::less_equal<const char*> le;
+    if(from == to || view.data() == nullptr ||
+       !le(from, view.data()) || !le(view.data() + view.length(), from + len))
+        return view;
+    return string_view(to + (view.data() - from), view.length());
+}
+
+void HeaderTable::relocate(const char *from, size_t len, const char *to)
+{
+    for(size_t i = 0; i < this->count; i++)
+    {
+        entry &e = i < inline_capacity ? this->inline_entries[i] : this->overflow[i - inline_capacity];
+        e.field = ::relocate(e.field, from, len, to);
+        e.value = ::relocate(e.value, from, len, to);
+    }
+}
+
+/**
+ * Index of the first entry at or after `from` named `field`, or size().
+ * Well-known names compare by id, anything else by hash, then by name.
+ */
+size_t HeaderTable::index_of(string_view field, size_t from) const
+{
+    unsigned int id = HTTP_PARSER::http_header_lookup(field.data(), field.length());
+    uint32_t h = id == HTTP_PARSER::HTTP_HEADER_OTHER ? hash(field) : 0;
+
+    for(size_t i = from; i < this->count; i++)
+    {
+        const entry &e = (*this)[i];
+        if(id != HTTP_PARSER::HTTP_HEADER_OTHER)
+        {
+            if(e.id == id)
+                return i;
+            continue;
+        }
+        if(e.hash != h || e.field.length() != field.length())
+            continue;
+
+        size_t j = 0;
+        for(; j < field.length(); j++)
+        {
+            char a = field[j], b = e.field[j];
+            if(a >= 'A' && a <= 'Z') a += 'a' - 'A';
+            if(b >= 'A' && b <= 'Z') b += 'a' - 'A';
+            if(a != b)
+                break;
+        }
+        if(j == field.length())
+            return i;
+    }
+    return this->count;
+}
+
+optional<string_view> HeaderTable::find(string_view field) const
+{
+    size_t i = this->index_of(field, 0);
+    if(i == this->count)
+        return std::nullopt;
+    return (*this)[i].value;
+}
+
+optional<string_view> HeaderTable::find(HTTP_PARSER::http_header_id id) const
+{
+    for(size_t i = 0; i < this->count; i++)
+    {
+        if((*this)[i].id == (unsigned int)id)
+            return (*this)[i].value;
+    }
+    return std::nullopt;
+}
+
+std::vector<string_view> HeaderTable::find_all(string_view field) const
+{
+    std::vector<string_view> values;
+    for(size_t i = this->index_of(field, 0); i < this->count; i = this->index_of(field, i + 1))
+        values.push_back((*this)[i].value);
+    return values;
+}
+
+
+/**********************************************************************
+ * 
+ * BodyBuffer
+ * 
+ **********************************************************************/
+BodyBuffer::BodyBuffer(std::pmr::memory_resource *mr)
+    : mr(mr), segs(mr), used(0), total(0), expected(0)
+{
+}
+
+BodyBuffer::BodyBuffer(BodyBuffer &&other)
+    : mr(other.mr), segs(std::move(other.segs)), used(other.used),
+      total(other.total), expected(other.expected)
+{
+    other.segs.clear();
+    other.used = 0;
+    other.total = 0;
+    other.expected = 0;
+}
+
+BodyBuffer &BodyBuffer::operator=(BodyBuffer &&other)
+{
+    if(this == &other)
+        return *this;
+
+    if(*this->mr == *other.mr)
+    {
+        for(segment_t &seg : this->segs)
+            this->mr->deallocate(seg.data, seg.cap, 1);
+        this->segs = std::move(other.segs);
+        this->used = other.used;
+        this->total = other.total;
+        this->expected = other.expected;
+        other.segs.clear();
+    }
+    else
+    {
+        this->clear();
+        this->expected = other.total;
+        for(size_t i = 0; i < other.used; i++)
+            this->append(other.segs[i].data, other.segs[i].len);
+        other.clear();
+    }
+    other.used = 0;
+    other.total = 0;
+    other.expected = 0;
+    return *this;
+}
+
+BodyBuffer::~BodyBuffer()
+{
+    for(segment_t &seg : this->segs)
+        this->mr->deallocate(seg.data, seg.cap, 1);
+}
+
+void BodyBuffer::reserve(uint64_t length)
+{
+    this->expected = length;
+    // Room for the segment list, within reason for a length we were told
+    uint64_t n = length / segment_size + 1;
+    if(n <= 1024)
+        this->segs.reserve(n);
+}
+
+void BodyBuffer::append(const char *at, size_t length)
+{
+    while(length > 0)
+    {
+        if(this->used == 0 || this->segs[this->used - 1].len == this->segs[this->used - 1].cap)
+        {
+            if(this->used == this->segs.size())
+            {
+                // The last segment of a body of known length is cut to fit
+                size_t cap = segment_size;
+                if(this->expected > this->total && this->expected - this->total < cap)
+                    cap = this->expected - this->total;
+                this->segs.push_back({(char*)this->mr->allocate(cap, 1), 0, cap});
+            }
+            this->used++;
+        }
+
+        segment_t &seg = this->segs[this->used - 1];
+        size_t n = std::min(length, seg.cap - seg.len);
+        memcpy(seg.data + seg.len, at, n);
+        seg.len += n;
+        this->total += n;
+        at += n;
+        length -= n;
+    }
+}
+
+void BodyBuffer::clear()
+{
+    for(size_t i = 0; i < this->used; i++)
+        this->segs[i].len = 0;
+    this->used = 0;
+    this->total = 0;
+    this->expected = 0;
+}
+
+void BodyBuffer::flatten(std::pmr::string &out) const
+{
+    out.reserve(out.length() + this->total);
+    for(size_t i = 0; i < this->used; i++)
+        out.append(this->segs[i].data, this->segs[i].len);
+}
+
+
+/**********************************************************************
+ * 
+ * QueryIndex
+ * 
+ **********************************************************************/
+QueryIndex::QueryIndex(string_view query, std::pmr::memory_resource *mr)
+    : params(mr)
+{
+    this->assign(query);
+}
+
+void QueryIndex::assign(string_view query)
+{
+    // Most queries fit the first guess; longer ones are split again
+    size_t n = 16;
+    this->query = query;
+    this->params.resize(n);
+    n = HTTP_PARSER::http_parser_split_query(query.data(), query.length(),
+                                              this->params.data(), n);
+    if(n > this->params.size())
+    {
+        this->params.resize(n);
+        HTTP_PARSER::http_parser_split_query(query.data(), query.length(),
+                                             this->params.data(), n);
+    }
+    this->params.resize(n);
+}
+
+string_view QueryIndex::key(size_t i) const
+{
+    return this->query.substr(this->params[i].key_off, this->params[i].key_len);
+}
+
+string_view QueryIndex::value(size_t i) const
+{
+    return this->query.substr(this->params[i].value_off, this->params[i].value_len);
+}
+
+bool QueryIndex::decode(string_view in, std::string &out)
+{
+    size_t len = 0;
+    out.resize(in.length());
+    if(HTTP_PARSER::http_parser_decode_param(in.data(), in.length(), &out[0], &len) != 0)
+        return false;
+    out.resize(len);
+    return true;
+}
+
+/**
+ * Index of the first parameter at or after `from` whose key decodes to
+ * `key`, or size(). Keys without escapes are compared as they are.
+ */
+size_t QueryIndex::index_of(string_view key, size_t from) const
+{
+    std::string decoded;
+    for(size_t i = from; i < this->params.size(); i++)
+    {
+        string_view raw = this->key(i);
+        if(raw.find_first_of("%+") == string_view::npos)
+        {
+            if(raw == key)
+                return i;
+            continue;
+        }
+        // An escape is 3 bytes for 1, so a shorter raw key cannot match
+        if(raw.length() < key.length())
+            continue;
+        if(decode(raw, decoded) && decoded == key)
+            return i;
+    }
+    return this->params.size();
+}
+
+optional<string> QueryIndex::get(string_view key) const
+{
+    string value;
+    size_t i = this->index_of(key, 0);
+    if(i == this->params.size() || !decode(this->value(i), value))
+        return std::nullopt;
+    return value;
+}
+
+std::vector<string> QueryIndex::get_all(string_view key) const
+{
+    std::vector<string> values;
+    string value;
+    for(size_t i = this->index_of(key, 0); i < this->params.size(); i = this->index_of(key, i + 1))
+    {
+        if(decode(this->value(i), value))
+            values.push_back(value);
+    }
+    return values;
+}
+
+bool QueryIndex::contains(string_view key) const
+{
+    return this->index_of(key, 0) != this->params.size();
+}
+
+
 /**********************************************************************
  * 
  * HttpRequest
  * 
  **********************************************************************/
+HttpRequest::HttpRequest(std::pmr::memory_resource *mr)
+    : headers_str(mr), body_buf(mr), body_str(mr), headers(mr), body_kept(true), coalesced(mr),
+      owners(mr), path_str(mr), path_state(PathUnparsed), query_index(mr),
+      query_indexed(false)
+{
+}
+
+/**
+ * Members are move-constructed rather than assigned, so strings allocated
+ * from a MessageArena keep their buffers (and the views into them).
+ */
 HttpRequest::HttpRequest(HttpRequest &&other)
+    : HttpRequest(std::move(other), other.headers_str.data())
+{
+}
+
+/**
+ * `old_headers` is where other.headers_str kept its characters before the
+ * move: a short string keeps them inside the object, so they move with it.
+ */
+HttpRequest::HttpRequest(HttpRequest &&other, const char *old_headers)
+    : method_num(other.method_num),
+      headers_str(std::move(other.headers_str)),
+      body_buf(std::move(other.body_buf)),
+      body_str(std::move(other.body_str)),
+      url_view(other.url_view),
+      headers(std::move(other.headers)),
+      body_kept(other.body_kept),
+      coalesced(std::move(other.coalesced)),
+      owners(std::move(other.owners)),
+      path_str(std::move(other.path_str)),
+      path_state(other.path_state),
+      query_index(std::move(other.query_index)),
+      query_indexed(other.query_indexed)
+{
+    // A non-empty body_str is what body_view refers to; segments don't move
+    this->body_view = this->body_str.empty() ? other.body_view : string_view(this->body_str);
+
+    this->relocate(old_headers, this->headers_str.length(), this->headers_str.data());
+}
+
+/**
+ * Unlike the constructor, the strings may be copied rather than taken
+ * (different memory resources), so views into coalesced strings and body
+ * segments are rebased as well as those into headers_str.
+ */
+HttpRequest &HttpRequest::operator=(HttpRequest &&other)
 {
+    if(this == &other)
+        return *this;
+
+    const char *old_headers = other.headers_str.data();
+    std::vector<std::pair<const char*, size_t>> old_coalesced;
+    for(const std::pmr::string &str : other.coalesced)
+        old_coalesced.emplace_back(str.data(), str.length());
+    bool view_in_buf = other.body_buf.segment_count() == 1 &&
+                       other.body_view.data() == other.body_buf.segment(0).data();
+
     this->method_num = other.method_num;
     this->headers_str = std::move(other.headers_str);
+    this->body_buf = std::move(other.body_buf);
     this->body_str = std::move(other.body_str);
     this->url_view = other.url_view;
     this->headers = std::move(other.headers);
+    this->body_view = other.body_view;
+    this->body_kept = other.body_kept;
+    this->coalesced = std::move(other.coalesced);
+    this->owners = std::move(other.owners);
+    this->path_str = std::move(other.path_str);
+    this->path_state = other.path_state;
+    this->query_index = std::move(other.query_index);
+    this->query_indexed = other.query_indexed;
+
+    this->relocate(old_headers, this->headers_str.length(), this->headers_str.data());
+    for(size_t i = 0; i < old_coalesced.size(); i++)
+        this->relocate(old_coalesced[i].first, old_coalesced[i].second, this->coalesced[i].data());
+
+    if(!this->body_str.empty())
+        this->body_view = this->body_str;
+    else if(view_in_buf)
+        this->body_view = this->body_buf.segment(0);
+    return *this;
+}
+
+void HttpRequest::relocate(const char *from, size_t len, const char *to)
+{
+    this->url_view = ::relocate(this->url_view, from, len, to);
+    this->headers.relocate(from, len, to);
+    this->body_view = ::relocate(this->body_view, from, len, to);
+    this->query_index.query = ::relocate(this->query_index.query, from, len, to);
+}
+
+void HttpRequest::clear()
+{
+    this->method_num = 0;
+    this->headers_str.clear();
+    this->body_buf.clear();
+    this->body_str.clear();
+    this->url_view = string_view();
+    this->headers.clear();
+    this->body_view = string_view();
+    this->body_kept = true;
+    this->coalesced.clear();
+    this->owners.clear();
+    this->path_str.clear();
+    this->path_state = PathUnparsed;
+    this->query_index.assign(string_view());
+    this->query_indexed = false;
 }
 
 string_view HttpRequest::url()
@@ -482,6 +1409,53 @@ string_view HttpRequest::url()
     return this->url_view;
 }
 
+optional<string_view> HttpRequest::path()
+{
+    if(this->path_state == PathUnparsed)
+    {
+        HTTP_PARSER::http_parser_url32 u;
+        size_t len = 0;
+
+        this->path_state = PathInvalid;
+        if(HTTP_PARSER::http_parser_parse_url32(this->url_view.data(), this->url_view.length(),
+                                                this->method_num == HTTP_PARSER::HTTP_CONNECT, &u) != 0)
+            return std::nullopt;
+
+        // CONNECT targets and "http://host" have no path
+        if(u.field_set & (1 << HTTP_PARSER::UF_PATH))
+        {
+            const char *at = this->url_view.data() + u.field_data[HTTP_PARSER::UF_PATH].off;
+            this->path_str.resize(u.field_data[HTTP_PARSER::UF_PATH].len);
+            if(HTTP_PARSER::http_parser_normalize_path(at, this->path_str.length(), &this->path_str[0], &len) != 0)
+                return std::nullopt;
+        }
+        this->path_str.resize(len);
+        this->path_state = PathValid;
+    }
+
+    if(this->path_state == PathInvalid)
+        return std::nullopt;
+    return string_view(this->path_str);
+}
+
+const QueryIndex &HttpRequest::query()
+{
+    if(!this->query_indexed)
+    {
+        HTTP_PARSER::http_parser_url32 u;
+
+        this->query_indexed = true;
+        if(HTTP_PARSER::http_parser_parse_url32(this->url_view.data(), this->url_view.length(),
+                                                this->method_num == HTTP_PARSER::HTTP_CONNECT, &u) == 0 &&
+           (u.field_set & (1 << HTTP_PARSER::UF_QUERY)))
+        {
+            this->query_index.assign(this->url_view.substr(u.field_data[HTTP_PARSER::UF_QUERY].off,
+                                                           u.field_data[HTTP_PARSER::UF_QUERY].len));
+        }
+    }
+    return this->query_index;
+}
+
 unsigned int HttpRequest::method()
 {
     return this->method_num;
@@ -489,28 +1463,44 @@ unsigned int HttpRequest::method()
 
 optional<string_view> HttpRequest::header(const std::string &field)
 {
-    if(this->headers.count(string_view(&field[0], field.length())) == 0)
-        return std::nullopt;
-    return this->headers.at(string_view(&field[0], field.length()));
+    return this->headers.find(string_view(field));
 }
 
 optional<string_view> HttpRequest::header(const char *field, size_t len)
 {
-    if(this->headers.count(string_view(field, len)) == 0)
-        return std::nullopt;
-    return this->headers.at(string_view(field, len));
+    return this->headers.find(string_view(field, len));
 }
 
 optional<string_view> HttpRequest::header(const string_view &field)
 {
-    if(this->headers.count(field) == 0)
-        return std::nullopt;
-    return this->headers.at(field);
+    return this->headers.find(field);
+}
+
+optional<string_view> HttpRequest::header(HTTP_PARSER::http_header_id id)
+{
+    return this->headers.find(id);
+}
+
+const HeaderTable &HttpRequest::header_table()
+{
+    return this->headers;
 }
 
 optional<string_view> HttpRequest::body()
 {
-    return string_view(&this->body_str[0], this->body_str.length());
+    if(!this->body_kept)
+        return std::nullopt;
+    if(this->body_buf.segment_count() > 1 && this->body_str.empty())
+    {
+        this->body_buf.flatten(this->body_str);
+        this->body_view = this->body_str;
+    }
+    return this->body_view;
+}
+
+const BodyBuffer &HttpRequest::body_buffer()
+{
+    return this->body_buf;
 }
 
 
@@ -519,12 +1509,41 @@ optional<string_view> HttpRequest::body()
  * HttpResponse
  * 
  **********************************************************************/
+HttpResponse::HttpResponse(std::pmr::memory_resource *mr)
+    : headers_str(mr), body_buf(mr), body_str(mr), headers(mr)
+{
+}
+
 HttpResponse::HttpResponse(HttpResponse &&other)
+    : HttpResponse(std::move(other), other.headers_str.data())
 {
+}
+
+HttpResponse::HttpResponse(HttpResponse &&other, const char *old_headers)
+    : status_num(other.status_num),
+      headers_str(std::move(other.headers_str)),
+      body_buf(std::move(other.body_buf)),
+      body_str(std::move(other.body_str)),
+      headers(std::move(other.headers))
+{
+    this->headers.relocate(old_headers, this->headers_str.length(), this->headers_str.data());
+}
+
+HttpResponse &HttpResponse::operator=(HttpResponse &&other)
+{
+    if(this == &other)
+        return *this;
+
+    const char *old_headers = other.headers_str.data();
+
     this->status_num = other.status_num;
     this->headers_str = std::move(other.headers_str);
+    this->body_buf = std::move(other.body_buf);
     this->body_str = std::move(other.body_str);
     this->headers = std::move(other.headers);
+
+    this->headers.relocate(old_headers, this->headers_str.length(), this->headers_str.data());
+    return *this;
 }
 
 unsigned int HttpResponse::status()
@@ -534,28 +1553,41 @@ unsigned int HttpResponse::status()
 
 optional<string_view> HttpResponse::header(const std::string &field)
 {
-    if(this->headers.count(string_view(&field[0], field.length())) == 0)
-        return std::nullopt;
-    return this->headers.at(string_view(&field[0], field.length()));
+    return this->headers.find(string_view(field));
 }
 
 optional<string_view> HttpResponse::header(const char *field, size_t len)
 {
-    if(this->headers.count(string_view(field, len)) == 0)
-        return std::nullopt;
-    return this->headers.at(string_view(field, len));
+    return this->headers.find(string_view(field, len));
 }
 
 optional<string_view> HttpResponse::header(const string_view &field)
 {
-    if(this->headers.count(field) == 0)
-        return std::nullopt;
-    return this->headers.at(field);
+    return this->headers.find(field);
+}
+
+optional<string_view> HttpResponse::header(HTTP_PARSER::http_header_id id)
+{
+    return this->headers.find(id);
+}
+
+const HeaderTable &HttpResponse::header_table()
+{
+    return this->headers;
 }
 
 optional<string_view> HttpResponse::body()
 {
-    return string_view(&this->body_str[0], this->body_str.length());
+    if(this->body_buf.segment_count() <= 1)
+        return this->body_buf.empty() ? string_view() : this->body_buf.segment(0);
+    if(this->body_str.empty())
+        this->body_buf.flatten(this->body_str);
+    return string_view(this->body_str);
+}
+
+const BodyBuffer &HttpResponse::body_buffer()
+{
+    return this->body_buf;
 }
 
 
@@ -25,9 +25,9 @@ extern "C" {
 #endif
 
 /* Also update SONAME in the Makefile whenever you change these. */
-#define HTTP_PARSER_VERSION_MAJOR 2
-#define HTTP_PARSER_VERSION_MINOR 8
-#define HTTP_PARSER_VERSION_PATCH 1
+#define HTTP_PARSER_VERSION_MAJOR 3
+#define HTTP_PARSER_VERSION_MINOR 0
+#define HTTP_PARSER_VERSION_PATCH 0
 
 #include <stddef.h>
 #if defined(_WIN32) && !defined(__MINGW32__) && \
@@ -88,6 +88,16 @@ typedef struct http_parser_settings http_parser_settings;
 typedef int (*http_data_cb) (http_parser*, const char *at, size_t length);
 typedef int (*http_cb) (http_parser*);
 
+/* A run of body bytes passed to on_body_ranges */
+struct http_parser_range {
+  const char *at;
+  size_t length;
+};
+
+typedef int (*http_ranges_cb) (http_parser*,
+                               const struct http_parser_range *ranges,
+                               size_t n);
+
 
 /* Status Codes */
 #define HTTP_STATUS_MAP(XX)                                                 \
@@ -212,6 +222,95 @@ enum http_method
   };
 
 
+/* Well-known header names, lowercase and in byte order. The parser reports
+ * the id of each header it sees; any other name is HTTP_HEADER_OTHER.
+ */
+#define HTTP_HEADER_MAP(XX)                                                    \
+  XX(1,  ACCEPT,                           "accept")                           \
+  XX(2,  ACCEPT_CHARSET,                   "accept-charset")                   \
+  XX(3,  ACCEPT_ENCODING,                  "accept-encoding")                  \
+  XX(4,  ACCEPT_LANGUAGE,                  "accept-language")                  \
+  XX(5,  ACCEPT_RANGES,                    "accept-ranges")                    \
+  XX(6,  ACCESS_CONTROL_ALLOW_CREDENTIALS, "access-control-allow-credentials") \
+  XX(7,  ACCESS_CONTROL_ALLOW_HEADERS,     "access-control-allow-headers")     \
+  XX(8,  ACCESS_CONTROL_ALLOW_METHODS,     "access-control-allow-methods")     \
+  XX(9,  ACCESS_CONTROL_ALLOW_ORIGIN,      "access-control-allow-origin")      \
+  XX(10, ACCESS_CONTROL_EXPOSE_HEADERS,    "access-control-expose-headers")    \
+  XX(11, ACCESS_CONTROL_MAX_AGE,           "access-control-max-age")           \
+  XX(12, ACCESS_CONTROL_REQUEST_HEADERS,   "access-control-request-headers")   \
+  XX(13, ACCESS_CONTROL_REQUEST_METHOD,    "access-control-request-method")    \
+  XX(14, AGE,                              "age")                              \
+  XX(15, ALLOW,                            "allow")                            \
+  XX(16, AUTHORIZATION,                    "authorization")                    \
+  XX(17, CACHE_CONTROL,                    "cache-control")                    \
+  XX(18, CONNECTION,                       "connection")                       \
+  XX(19, CONTENT_DISPOSITION,              "content-disposition")              \
+  XX(20, CONTENT_ENCODING,                 "content-encoding")                 \
+  XX(21, CONTENT_LANGUAGE,                 "content-language")                 \
+  XX(22, CONTENT_LENGTH,                   "content-length")                   \
+  XX(23, CONTENT_LOCATION,                 "content-location")                 \
+  XX(24, CONTENT_RANGE,                    "content-range")                    \
+  XX(25, CONTENT_SECURITY_POLICY,          "content-security-policy")          \
+  XX(26, CONTENT_TYPE,                     "content-type")                     \
+  XX(27, COOKIE,                           "cookie")                           \
+  XX(28, DATE,                             "date")                             \
+  XX(29, ETAG,                             "etag")                             \
+  XX(30, EXPECT,                           "expect")                           \
+  XX(31, EXPIRES,                          "expires")                          \
+  XX(32, FORWARDED,                        "forwarded")                        \
+  XX(33, FROM,                             "from")                             \
+  XX(34, HOST,                             "host")                             \
+  XX(35, IF_MATCH,                         "if-match")                         \
+  XX(36, IF_MODIFIED_SINCE,                "if-modified-since")                \
+  XX(37, IF_NONE_MATCH,                    "if-none-match")                    \
+  XX(38, IF_RANGE,                         "if-range")                         \
+  XX(39, IF_UNMODIFIED_SINCE,              "if-unmodified-since")              \
+  XX(40, KEEP_ALIVE,                       "keep-alive")                       \
+  XX(41, LAST_MODIFIED,                    "last-modified")                    \
+  XX(42, LINK,                             "link")                             \
+  XX(43, LOCATION,                         "location")                         \
+  XX(44, MAX_FORWARDS,                     "max-forwards")                     \
+  XX(45, ORIGIN,                           "origin")                           \
+  XX(46, PRAGMA,                           "pragma")                           \
+  XX(47, PROXY_AUTHENTICATE,               "proxy-authenticate")               \
+  XX(48, PROXY_AUTHORIZATION,              "proxy-authorization")              \
+  XX(49, PROXY_CONNECTION,                 "proxy-connection")                 \
+  XX(50, RANGE,                            "range")                            \
+  XX(51, REFERER,                          "referer")                          \
+  XX(52, RETRY_AFTER,                      "retry-after")                      \
+  XX(53, SEC_WEBSOCKET_ACCEPT,             "sec-websocket-accept")             \
+  XX(54, SEC_WEBSOCKET_KEY,                "sec-websocket-key")                \
+  XX(55, SEC_WEBSOCKET_PROTOCOL,           "sec-websocket-protocol")           \
+  XX(56, SEC_WEBSOCKET_VERSION,            "sec-websocket-version")            \
+  XX(57, SERVER,                           "server")                           \
+  XX(58, SET_COOKIE,                       "set-cookie")                       \
+  XX(59, STRICT_TRANSPORT_SECURITY,        "strict-transport-security")        \
+  XX(60, TE,                               "te")                               \
+  XX(61, TRAILER,                          "trailer")                          \
+  XX(62, TRANSFER_ENCODING,                "transfer-encoding")                \
+  XX(63, UPGRADE,                          "upgrade")                          \
+  XX(64, UPGRADE_INSECURE_REQUESTS,        "upgrade-insecure-requests")        \
+  XX(65, USER_AGENT,                       "user-agent")                       \
+  XX(66, VARY,                             "vary")                             \
+  XX(67, VIA,                              "via")                              \
+  XX(68, WARNING,                          "warning")                          \
+  XX(69, WWW_AUTHENTICATE,                 "www-authenticate")                 \
+  XX(70, X_FORWARDED_FOR,                  "x-forwarded-for")                  \
+  XX(71, X_FORWARDED_HOST,                 "x-forwarded-host")                 \
+  XX(72, X_FORWARDED_PROTO,                "x-forwarded-proto")                \
+  XX(73, X_REAL_IP,                        "x-real-ip")                        \
+  XX(74, X_REQUESTED_WITH,                 "x-requested-with")                 \
+
+
+enum http_header_id
+  {
+  HTTP_HEADER_OTHER = 0,
+#define XX(num, name, string) HTTP_HEADER_##name = num,
+  HTTP_HEADER_MAP(XX)
+#undef XX
+  };
+
+
 enum http_parser_type { HTTP_REQUEST, HTTP_RESPONSE, HTTP_BOTH };
 
 
@@ -275,7 +374,8 @@ enum flags
   XX(INVALID_INTERNAL_STATE, "encountered unexpected internal state")\
   XX(STRICT, "strict mode assertion failed")                         \
   XX(PAUSED, "parser is paused")                                     \
-  XX(UNKNOWN, "an unknown error occurred")
+  XX(UNKNOWN, "an unknown error occurred")                            \
+  XX(TOO_MANY_HEADERS, "header index is full")
 
 
 /* Define HPE_* values for each errno value above */
@@ -316,6 +416,11 @@ struct http_parser {
    */
   unsigned int upgrade : 1;
 
+  /* enum http_header_id of the current header. Set once its name is
+   * complete, before the last on_header_field callback for it.
+   */
+  unsigned int header_id : 7;
+
   /** PUBLIC **/
   void *data; /* A pointer to get hook to the "connection" or "socket" object */
 };
@@ -335,6 +440,12 @@ struct http_parser_settings {
    */
   http_cb      on_chunk_header;
   http_cb      on_chunk_complete;
+  /* If set, chunk payloads go here instead of to on_body: one range per
+   * chunk, or per piece of a chunk cut off by the end of the buffer,
+   * collected over a whole call and passed on in as few calls as possible.
+   * on_chunk_header and on_chunk_complete are not called.
+   */
+  http_ranges_cb on_body_ranges;
 };
 
 
@@ -368,6 +479,112 @@ struct http_parser_url {
 };
 
 
+/* Like struct http_parser_url, for http_parser_parse_url32() and
+ * http_parser_execute_head(), but with 32-bit offsets so that urls can be
+ * longer than 64 KB.
+ */
+struct http_parser_url32 {
+  uint16_t field_set;           /* Bitmask of (1 << UF_*) values */
+  uint16_t port;                /* Converted UF_PORT string */
+
+  struct {
+    uint32_t off;               /* Offset into buffer in which field starts */
+    uint32_t len;               /* Length of run in buffer */
+  } field_data[UF_MAX];
+};
+
+
+/* One key=value pair of a query string, for http_parser_split_query().
+ * Offsets are into the query. A pair without '=' has an empty value.
+ */
+struct http_parser_param {
+  uint32_t key_off;
+  uint32_t key_len;
+  uint32_t value_off;
+  uint32_t value_len;
+};
+
+
+/* One header of a message head, as offsets into the caller's buffer. A
+ * header without a value has value_len == 0.
+ */
+struct http_parser_header {
+  uint32_t name_off;
+  uint32_t name_len;
+  uint32_t value_off;
+  uint32_t value_len;
+  uint32_t id;                  /* enum http_header_id */
+};
+
+
+/* Result structure for http_parser_execute_head().
+ *
+ * Offsets count from the start of the buffer the caller accumulates input
+ * in; `base` is the offset of the next `data` passed to the parser and is
+ * advanced by the number of bytes parsed. Callers that discard consumed
+ * input should adjust `base` to match. The url, status and headers are
+ * cleared at the start of every message.
+ *
+ * `url` is the request target split up as it is parsed, as
+ * http_parser_parse_url32() would. Its field_set is 0 if that would fail.
+ */
+struct http_parser_head {
+  uint32_t base;
+  uint32_t url_off;             /* Request target; requests only */
+  uint32_t url_len;
+  uint32_t status_off;          /* Reason phrase; responses only */
+  uint32_t status_len;
+  uint32_t nheaders;            /* # entries used in headers[] */
+  uint32_t max_headers;         /* # entries available in headers[] */
+  struct http_parser_header *headers;
+  struct http_parser_url32 url; /* Set once the request target is complete */
+
+  /** PRIVATE **/
+  uint8_t url_host;             /* Progress through the host part of `url` */
+};
+
+
+/* A run of bytes in the caller's buffer, as an offset and a length */
+struct http_parser_span {
+  uint32_t off;
+  uint32_t len;
+};
+
+
+/* A complete message found by http_parser_execute_batch(). Offsets count
+ * from the start of the buffer the caller accumulates input in, as in
+ * struct http_parser_head.
+ */
+struct http_parser_message {
+  uint32_t start;               /* First byte of the message */
+  uint32_t head_end;            /* Just past the empty line ending the head */
+  uint32_t end;                 /* Just past the last byte of the message */
+  uint32_t body_first;          /* The body is bodies[body_first] on, */
+  uint32_t body_count;          /* body_count entries; one per chunk */
+  uint16_t status_code;         /* Responses only */
+  uint8_t method;               /* enum http_method; requests only */
+  uint8_t http_major;
+  uint8_t http_minor;
+  uint8_t keep_alive;           /* What http_should_keep_alive() says */
+  uint8_t upgrade;              /* The connection switches protocols */
+};
+
+
+/* Result structure for http_parser_execute_batch(). `base` is as in
+ * struct http_parser_head. The messages and their body spans are cleared
+ * on every call.
+ */
+struct http_parser_batch {
+  uint32_t base;
+  uint32_t nmessages;           /* # entries used in messages[] */
+  uint32_t max_messages;        /* # entries available in messages[] */
+  uint32_t nbodies;             /* # entries used in bodies[] */
+  uint32_t max_bodies;          /* # entries available in bodies[] */
+  struct http_parser_message *messages;
+  struct http_parser_span *bodies;
+};
+
+
 /* Returns the library version. Bits 16-23 contain the major version number,
  * bits 8-15 the minor version number and bits 0-7 the patch level.
  * Usage example:
@@ -396,6 +613,80 @@ size_t http_parser_execute(http_parser *parser,
                            size_t len);
 
 
+/* Like http_parser_execute(), but chunked bodies are decoded in place:
+ * chunk payloads are moved down over the chunk framing in `data`, and
+ * on_body runs once per call with everything decoded so far instead of
+ * once per chunk. on_chunk_header and on_chunk_complete are not called.
+ * The contents of `data` past the returned body ranges are unspecified
+ * afterwards.
+ */
+size_t http_parser_execute_dechunk(http_parser *parser,
+                                   const http_parser_settings *settings,
+                                   char *data,
+                                   size_t len);
+
+
+/* Initialize an http_parser_head to index into `headers` */
+void http_parser_head_init(struct http_parser_head *head,
+                           struct http_parser_header *headers,
+                           uint32_t max_headers);
+
+
+/* Like http_parser_execute(), but the url, status and headers are recorded
+ * in `head` instead of being passed to the on_url, on_status,
+ * on_header_field and on_header_value callbacks; the other callbacks run as
+ * usual. Sets HPE_TOO_MANY_HEADERS if `head` runs out of entries.
+ */
+size_t http_parser_execute_head(http_parser *parser,
+                                const http_parser_settings *settings,
+                                const char *data,
+                                size_t len,
+                                struct http_parser_head *head);
+
+
+/* Indexes the message head at the start of `data` into `head` with the
+ * table-driven engine generated from contrib/head.dfa, for heads that
+ * arrive whole. Sets the method or status code and the version in `parser`
+ * but runs no callbacks and doesn't look at what the headers mean. Returns
+ * the length of the head, including the empty line that ends it, and
+ * advances head->base by as much. Returns 0 if `data` holds no complete
+ * head, setting `parser->http_errno` if it can't be the start of one.
+ * Takes the heads http_parser_execute_head() takes, and fails where it does
+ * with the same error, except for invalid or conflicting Content-Length
+ * headers.
+ */
+size_t http_parser_scan_head(http_parser *parser,
+                             const char *data,
+                             size_t len,
+                             struct http_parser_head *head);
+
+
+/* Initialize an http_parser_batch to fill `messages` and `bodies` */
+void http_parser_batch_init(struct http_parser_batch *batch,
+                            struct http_parser_message *messages,
+                            uint32_t max_messages,
+                            struct http_parser_span *bodies,
+                            uint32_t max_bodies);
+
+
+/* Parses as many whole messages from `data` as `batch` has room for, such
+ * as a run of pipelined requests, recording each in batch->messages
+ * instead of running callbacks. Stops after a message that ends or
+ * upgrades the connection, and before one that isn't complete in `data`
+ * or doesn't fit, which is left unparsed. Returns the number of bytes
+ * parsed, the end of the last message, and advances batch->base by as
+ * much. A message that can never be complete in one buffer (a body larger
+ * than the buffer, or one that ends at EOF) has to go through
+ * http_parser_execute() instead. On error, returns where parsing stopped
+ * with `parser->http_errno` set; the messages before it are still in
+ * `batch`.
+ */
+size_t http_parser_execute_batch(http_parser *parser,
+                                 const char *data,
+                                 size_t len,
+                                 struct http_parser_batch *batch);
+
+
 /* If http_should_keep_alive() in the on_headers_complete or
  * on_message_complete callback returns 0, then this should be
  * the last message on the connection.
@@ -407,6 +698,14 @@ int http_should_keep_alive(const http_parser *parser);
 /* Returns a string version of the HTTP method. */
 const char *http_method_str(enum http_method m);
 
+/* Returns the lowercase name of a well-known header. */
+const char *http_header_name(enum http_header_id id);
+
+/* Returns the id of the header named by the `len` bytes at `name`,
+ * ignoring case, or HTTP_HEADER_OTHER.
+ */
+enum http_header_id http_header_lookup(const char *name, size_t len);
+
 /* Returns a string version of the HTTP status code. */
 const char *http_status_str(enum http_status s);
 
@@ -424,6 +723,51 @@ int http_parser_parse_url(const char *buf, size_t buflen,
                           int is_connect,
                           struct http_parser_url *u);
 
+/* Like http_parser_parse_url(), for urls of any length */
+int http_parser_parse_url32(const char *buf, size_t buflen,
+                            int is_connect,
+                            struct http_parser_url32 *u);
+
+/* Split a Host header value, "host[:port]" with the host possibly an IPv6
+ * literal, into the UF_HOST and UF_PORT fields of `u`. Returns 0 on
+ * success.
+ */
+int http_parser_parse_host(const char *buf, size_t buflen,
+                           struct http_parser_url32 *u);
+
+/* Percent-decode the path `buf` (e.g. the UF_PATH field of a parsed url)
+ * into `out`, removing "." and ".." segments and repeated slashes; a
+ * decoded '/' separates segments like a literal one. ".." never goes above
+ * the start of the path. `out` needs room for `buflen` bytes and may be
+ * `buf` itself. Returns 0 and sets `outlen`, or returns 1 if an escape is
+ * malformed or decodes to NUL.
+ */
+int http_parser_normalize_path(const char *buf, size_t buflen, char *out,
+                               size_t *outlen);
+
+/* Split the query string `buf` (e.g. the UF_QUERY field of a parsed url) at
+ * '&' and the first '=' of each pair, skipping empty pairs. Stores up to
+ * `max_params` pairs and returns how many there are, which may be more.
+ * Nothing is decoded; see http_parser_decode_param().
+ */
+size_t http_parser_split_query(const char *buf, size_t buflen,
+                               struct http_parser_param *params,
+                               size_t max_params);
+
+/* Decode a query key or value into `out`, turning '+' into a space and
+ * percent-escapes into bytes. `out` needs room for `buflen` bytes and may
+ * be `buf` itself. Returns 0 and sets `outlen`, or returns 1 if an escape
+ * is malformed.
+ */
+int http_parser_decode_param(const char *buf, size_t buflen, char *out,
+                             size_t *outlen);
+
+/* Copy the header field name at the start of `buf` to `out`, lowercased.
+ * Stops at the first byte that is not a token character (usually the ':').
+ * `out` must have room for `buflen` bytes. Returns the length of the name.
+ */
+size_t http_header_field_lower(const char *buf, size_t buflen, char *out);
+
 /* Pause or un-pause the parser; a nonzero value pauses */
 void http_parser_pause(http_parser *parser, int paused);
 
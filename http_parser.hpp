@@ -2,8 +2,11 @@
 #include <string>
 #include <string_view>
 #include <vector>
-#include <map>
+#include <deque>
+#include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <functional>
 
@@ -15,19 +18,415 @@ namespace HTTP_PARSER
 template<typename msg_type>
 class HttpParser;
 
+/**
+ * Headers of one message, in arrival order, duplicates included.
+ *
+ * The first inline_capacity entries live inside the table itself; only
+ * messages with more headers than that allocate. Each entry carries its
+ * http_header_id and a hash of its lowercased name, so a lookup compares
+ * integers first and only compares names (case-insensitively) on a hash hit.
+ */
+class HeaderTable
+{
+public:
+    static constexpr size_t inline_capacity = 32;
+
+    struct entry
+    {
+        std::string_view field;
+        std::string_view value;
+        uint32_t hash;
+        unsigned int id;
+    };
+
+    HeaderTable() : count(0) {}
+    explicit HeaderTable(std::pmr::memory_resource *mr) : overflow(mr), count(0) {}
+
+    void push_back(std::string_view field, std::string_view value, unsigned int id);
+    void clear();
+
+    size_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+    const entry &operator[](size_t i) const
+    { return i < inline_capacity ? this->inline_entries[i] : this->overflow[i - inline_capacity]; }
+
+    /**
+     * Value of the first header named `field`, ignoring case.
+     */
+    std::optional<std::string_view> find(std::string_view field) const;
+    std::optional<std::string_view> find(HTTP_PARSER::http_header_id id) const;
+    /**
+     * Values of every header named `field`, in arrival order.
+     */
+    std::vector<std::string_view> find_all(std::string_view field) const;
+
+    /**
+     * FNV-1a over the ASCII-lowercased name.
+     */
+    static uint32_t hash(std::string_view field);
+
+private:
+    size_t index_of(std::string_view field, size_t from) const;
+    /**
+     * Point names and values that were in [from, from + len) into `to`
+     * instead, after the string holding them moved.
+     */
+    void relocate(const char *from, size_t len, const char *to);
+    friend class HttpRequest;
+    friend class HttpResponse;
+
+    entry inline_entries[inline_capacity];
+    std::pmr::vector<entry> overflow;
+    size_t count;
+};
+
+/**
+ * A message body as a list of fixed-size segments, so appending never
+ * moves what is already stored.
+ *
+ * Segments come from the message's memory resource and are kept by
+ * clear() for the next body. With reserve(), a body whose length is known
+ * gets segments sized to it, i.e. one exact segment if it is small.
+ * Reading it in one piece means copying it: see flatten().
+ */
+class BodyBuffer
+{
+public:
+    static constexpr size_t segment_size = 16 * 1024;
+
+    explicit BodyBuffer(std::pmr::memory_resource *mr = std::pmr::get_default_resource());
+    BodyBuffer(BodyBuffer&&);
+    /**
+     * Takes other's segments if both use the same memory resource, and
+     * copies the body into this buffer's resource otherwise.
+     */
+    BodyBuffer &operator=(BodyBuffer&&);
+    BodyBuffer(const BodyBuffer&) = delete;
+    BodyBuffer &operator=(const BodyBuffer&) = delete;
+    ~BodyBuffer();
+
+    /**
+     * Expect a body of `length` bytes in total.
+     */
+    void reserve(uint64_t length);
+    void append(const char *at, size_t length);
+    /**
+     * Empty the buffer, keeping its segments.
+     */
+    void clear();
+
+    size_t size() const { return this->total; }
+    bool empty() const { return this->total == 0; }
+    size_t segment_count() const { return this->used; }
+    std::string_view segment(size_t i) const
+    { return std::string_view(this->segs[i].data, this->segs[i].len); }
+    /**
+     * Describe up to `max` segments in `iov`, anything with iov_base and
+     * iov_len such as struct iovec for writev(). Returns how many.
+     */
+    template<typename Iovec>
+    size_t fill_iovec(Iovec *iov, size_t max) const
+    {
+        size_t n = this->used < max ? this->used : max;
+        for(size_t i = 0; i < n; i++)
+        {
+            iov[i].iov_base = this->segs[i].data;
+            iov[i].iov_len = this->segs[i].len;
+        }
+        return n;
+    }
+    /**
+     * Append the whole body to `out`.
+     */
+    void flatten(std::pmr::string &out) const;
+
+private:
+    struct segment_t
+    {
+        char *data;
+        size_t len;
+        size_t cap;
+    };
+
+    std::pmr::memory_resource *mr;
+    std::pmr::vector<segment_t> segs;
+    size_t used;
+    size_t total;
+    // reserve()d length, 0 if unknown
+    uint64_t expected;
+};
+
+/**
+ * The parameters of a query string, split in one pass over it.
+ *
+ * Only the offsets of each key and value are stored; a key or value is
+ * percent-decoded when it is looked up, so reading a few parameters out of
+ * many costs one split plus decoding those few. Views and lookups refer to
+ * the query string, which must outlive the index.
+ */
+class QueryIndex
+{
+public:
+    QueryIndex() = default;
+    explicit QueryIndex(std::pmr::memory_resource *mr) : params(mr) {}
+    explicit QueryIndex(std::string_view query,
+                        std::pmr::memory_resource *mr = std::pmr::get_default_resource());
+
+    /**
+     * Re-index over `query`, reusing the index's memory.
+     */
+    void assign(std::string_view query);
+
+    size_t size() const { return this->params.size(); }
+    bool empty() const { return this->params.empty(); }
+    /**
+     * Raw, still-encoded key and value of the i-th parameter.
+     */
+    std::string_view key(size_t i) const;
+    std::string_view value(size_t i) const;
+
+    /**
+     * Decoded value of the first parameter whose decoded key is `key`, or
+     * nullopt if there is none or its value has a malformed escape.
+     */
+    std::optional<std::string> get(std::string_view key) const;
+    /**
+     * Decoded values of every parameter whose decoded key is `key`, in
+     * order; parameters with malformed escapes are skipped.
+     */
+    std::vector<std::string> get_all(std::string_view key) const;
+    bool contains(std::string_view key) const;
+
+    /**
+     * Decode `in` as a form-encoded key or value into `out`. Returns false
+     * on a malformed escape.
+     */
+    static bool decode(std::string_view in, std::string &out);
+
+private:
+    size_t index_of(std::string_view key, size_t from) const;
+    friend class HttpRequest;
+
+    std::string_view query;
+    std::pmr::vector<HTTP_PARSER::http_parser_param> params;
+};
+
 class HttpRequest;
 class HttpResponse;
 
 
+/**
+ * Monotonic memory for the messages of one connection or thread.
+ *
+ * A parser constructed with an arena builds its messages, their strings and
+ * header tables in it. reset() destroys all of them at once and rewinds to
+ * the start of the initial block, so a keep-alive connection that resets
+ * after each message stops calling malloc once its messages fit.
+ */
+class MessageArena
+{
+public:
+    explicit MessageArena(size_t initial_size = 16 * 1024);
+    ~MessageArena();
+    MessageArena(const MessageArena&) = delete;
+    MessageArena &operator=(const MessageArena&) = delete;
+
+    std::pmr::memory_resource *resource() { return &this->pool; }
+    /**
+     * Number of reset() calls so far; messages from an older generation
+     * no longer exist.
+     */
+    size_t generation() const { return this->resets; }
+
+    /**
+     * Destroy every message created since the last reset. Views into them
+     * must not be used afterwards. A parser drops those it still holds:
+     * queued ones are skipped by result(), and one still being parsed fails
+     * the next parse() until init().
+     */
+    void reset();
+
+    /**
+     * Construct a message in the arena, using the arena for its members.
+     */
+    template<typename T>
+    T *create()
+    {
+        void *mem = this->pool.allocate(sizeof(T), alignof(T));
+        T *msg = new (mem) T(&this->pool);
+        this->messages.push_back({msg, [](void *p) { static_cast<T*>(p)->~T(); }});
+        return msg;
+    }
+
+private:
+    std::unique_ptr<char[]> initial;
+    std::pmr::monotonic_buffer_resource pool;
+    // Messages to destroy on reset(), with their destructor
+    std::vector<std::pair<void*, void (*)(void*)>> messages;
+    size_t resets = 0;
+};
+
+/**
+ * Deletes heap-allocated messages; messages in a MessageArena are left to
+ * MessageArena::reset().
+ */
+struct MessageDeleter
+{
+    bool in_arena = false;
+    // MessageArena::generation() the message was created in
+    size_t generation = 0;
+    template<typename T>
+    void operator()(T *msg) const
+    {
+        if(!this->in_arena)
+            delete msg;
+    }
+};
+
+
+/**
+ * Receives a message body fragment by fragment as it is parsed, so the
+ * body need not be kept in the message.
+ *
+ * write() returns how many bytes of `data` it took. Taking fewer applies
+ * backpressure: the parser is paused (http_parser_pause()) and parse()
+ * returns early; the rest is offered again by resume(). Returning `error`
+ * fails the parse.
+ */
+class BodySink
+{
+public:
+    static constexpr size_t error = SIZE_MAX;
+
+    virtual ~BodySink() = default;
+    virtual size_t write(std::string_view data) = 0;
+    /**
+     * The body has ended; no write() follows for this message.
+     */
+    virtual void finish() {}
+};
+
+/**
+ * Takes and drops everything, counting the bytes.
+ */
+class DiscardSink : public BodySink
+{
+public:
+    size_t write(std::string_view data) override;
+    size_t size() const { return this->total; }
+
+private:
+    size_t total = 0;
+};
+
+/**
+ * A fixed-size ring buffer, read from while the body arrives. When it is
+ * full the parser pauses until the reader makes room and resumes it.
+ * The capacity must not be 0.
+ */
+class RingBufferSink : public BodySink
+{
+public:
+    explicit RingBufferSink(size_t capacity);
+
+    size_t write(std::string_view data) override;
+    void finish() override { this->ended = true; }
+
+    size_t size() const { return this->len; }
+    size_t capacity() const { return this->cap; }
+    /**
+     * The body has ended and every byte of it has been read.
+     */
+    bool done() const { return this->ended && this->len == 0; }
+    /**
+     * The buffered bytes up to the end of the ring; consume() them once
+     * used. Empty if nothing is buffered.
+     */
+    std::string_view peek() const;
+    void consume(size_t n);
+    /**
+     * Copy out and consume up to `n` bytes.
+     */
+    size_t read(char *out, size_t n);
+    /**
+     * Empty the buffer for the next body.
+     */
+    void clear();
+
+private:
+    std::unique_ptr<char[]> buf;
+    size_t cap;
+    size_t start = 0;
+    size_t len = 0;
+    bool ended = false;
+};
+
+/**
+ * Keeps the body in memory up to `memory_limit` bytes; a longer body is
+ * moved to an anonymous temporary file (tmpfile()) and written on there.
+ */
+class SpillSink : public BodySink
+{
+public:
+    explicit SpillSink(size_t memory_limit,
+                       std::pmr::memory_resource *mr = std::pmr::get_default_resource());
+    ~SpillSink();
+    SpillSink(const SpillSink&) = delete;
+    SpillSink &operator=(const SpillSink&) = delete;
+
+    size_t write(std::string_view data) override;
+    /**
+     * Flushes the file and rewinds it for reading.
+     */
+    void finish() override;
+
+    size_t size() const { return this->total; }
+    bool spilled() const { return this->spill != nullptr; }
+    /**
+     * The body, if it was not spilled.
+     */
+    std::string_view memory() const { return this->mem; }
+    /**
+     * The body, if it was spilled; owned by the sink.
+     */
+    FILE *file() const { return this->spill; }
+
+private:
+    std::pmr::string mem;
+    size_t limit;
+    size_t total = 0;
+    FILE *spill = nullptr;
+};
+
+
 /**
  * A wrapper around http_parser for HTTP Request.
  */
 template<>
 class HttpParser<HttpRequest>
 {
+public:
+    /**
+     * What to do with the body of a message whose headers are complete.
+     *
+     * Buffer: keep it in the request, body() returns it.
+     * Discard: parse past it without keeping it, body() returns nullopt.
+     * Stream: pass each fragment to the body handler as it arrives, body()
+     * returns nullopt.
+     * Reject: stop; parse() fails from here on.
+     */
+    enum BodyAction
+    {
+        Buffer, Discard, Stream, Reject,
+    };
+    using HeadHandler = std::function<BodyAction(HttpRequest &)>;
+    using BodyHandler = std::function<void(HttpRequest &, std::string_view)>;
+
+private:
     HTTP_PARSER::http_parser parser;
     HTTP_PARSER::http_parser_settings setting;
 
+    static int on_message_begin(HTTP_PARSER::http_parser* parser);
     static int on_url(HTTP_PARSER::http_parser* parser, const char *at, size_t length);
     static int on_header_field(HTTP_PARSER::http_parser* parser, const char *at, size_t length);
     static int on_header_value(HTTP_PARSER::http_parser* parser, const char *at, size_t length);
@@ -79,6 +478,23 @@ class HttpParser<HttpRequest>
         { return std::string_view(ptr + this->index, this->len); }
     };
 
+/**
+ * An element being accumulated in ZeroCopy mode. Points into the caller's
+ * buffer until a second, non-adjacent fragment arrives; from then on it is
+ * the last string in HttpRequest::coalesced, owned by the request.
+ */
+    struct span_t
+    {
+        const char *ptr;
+        size_t len;
+        bool owned;
+        std::string_view view() const
+        { return std::string_view(this->ptr, this->len); }
+    };
+
+    static void append(span_t &span, bool first, const char *at, size_t length,
+                       std::pmr::deque<std::pmr::string> &coalesced);
+
 /**
  * Since callback invoked by http_parser needs to be static, and multiple parser
  * instance might be spined for a multithreaded setup, each parser need to have
@@ -89,6 +505,13 @@ class HttpParser<HttpRequest>
         str_view_t url;
         size_t url_index;
         size_t url_len;
+        // ZeroCopy mode counterparts of the indexes above and of headers
+        bool zero_copy;
+        span_t url_span;
+        span_t header_span;
+        span_t value_span;
+        span_t body_span;
+        std::vector<std::string_view> header_views;
         //str_view_t last_header;
         size_t last_header_index;
         size_t last_header_len;
@@ -99,24 +522,144 @@ class HttpParser<HttpRequest>
         CallBack last_callback;
         State state;
         std::vector<str_view_t> headers;
-        std::unique_ptr<HttpRequest> req_ptr;
+        // http_header_id of each {field, value} pair in headers
+        std::vector<unsigned int> header_ids;
+        // The message being parsed; empty between pipelined messages
+        std::unique_ptr<HttpRequest, MessageDeleter> req_ptr;
+        // Messages completed but not yet taken by result(), oldest first
+        std::deque<std::unique_ptr<HttpRequest, MessageDeleter>> finished;
+        // Messages handed back by recycle(), reused before allocating
+        std::vector<std::unique_ptr<HttpRequest, MessageDeleter>> spare;
+        // Owner of the buffer being parsed, for messages that begin in it
+        std::shared_ptr<const void> owner;
+        MessageArena *arena;
+        // req_ptr has begun and not yet completed
+        bool in_message;
+        // The arena was reset under the message being parsed
+        bool message_lost;
         bool complete;
+        // Headers of req_ptr are complete, its body is yet to end
+        bool head_ready;
+        BodyAction body_action;
+        HeadHandler head_handler;
+        BodyHandler body_handler;
+        BodySink *body_sink;
+        // Part of a fragment the sink did not take before pausing
+        std::string_view pending;
+        bool sink_failed;
     };
     instance_data_t data;
+    size_t nparsed;
+
+    static void begin_message(instance_data_t *data);
+    static bool stale(const instance_data_t *data, const std::unique_ptr<HttpRequest, MessageDeleter> &req);
+    void drop_stale();
+    static int head_ready(HTTP_PARSER::http_parser *parser);
 
 public:
-    HttpParser();
     /**
-     * Called before parsing each msg.
+     * Copy: the request owns a copy of everything it was parsed from.
+     *
+     * ZeroCopy: url, headers and body are views into the buffers passed to
+     * parse(), which must stay valid and unmoved while the request is in use.
+     * Only elements split across parse() calls are copied, into the request.
+     */
+    enum Buffering
+    {
+        Copy, ZeroCopy,
+    };
+
+    /**
+     * With an `arena`, messages are built in it: result() then returns a
+     * message owned by the arena, which must not be deleted.
+     */
+    HttpParser(MessageArena *arena = nullptr);
+    /**
+     * Called before parsing each msg, or each connection when reading
+     * pipelined messages. Drops messages not yet taken by result().
+     */
+    void init(Buffering buffering = Copy);
+    /**
+     * Every message that ends in the input is queued for result(); the
+     * next one starts in a new request, so pipelined requests in one
+     * buffer are all parsed without calling init() in between.
+     *
+     * Returns true, having parsed only parsed() bytes, if a body sink
+     * paused the parser. The input must then stay valid until resume().
+     *
+     * Returns false, until init(), if the arena was reset while a message
+     * was being parsed.
      */
-    void init();
     bool parse(const std::string_view &);
+    /**
+     * ZeroCopy mode: the request keeps `owner` alive, so the caller may
+     * hand over a ref-counted receive buffer instead of pinning it.
+     */
+    bool parse(const std::string_view &, std::shared_ptr<const void> owner);
     /**
      * Check if parsing of a message has ended (Whether or not msg
      * received is a complete msg)
      */
     bool complete();
+    /**
+     * Called from parse() as soon as a message's headers are complete,
+     * before any of its body: url and headers may be read, and the
+     * returned action applies to the body. Without a handler every body
+     * is buffered.
+     */
+    void set_head_handler(HeadHandler handler);
+    /**
+     * Receives the body fragments of messages whose action is Stream.
+     */
+    void set_body_handler(BodyHandler handler);
+    /**
+     * Stream bodies go to `sink` rather than the body handler. May be
+     * called from the head handler to pick a sink per message.
+     */
+    void set_body_sink(BodySink *sink);
+    /**
+     * Check if a body sink applied backpressure.
+     */
+    bool paused();
+    /**
+     * Bytes of the last parse() input that were consumed.
+     */
+    size_t parsed();
+    /**
+     * Offer the sink what it did not take, and unpause the parser if it
+     * takes all of it; then parse() the input from parsed() on. Returns
+     * false if still paused, or if the sink failed.
+     */
+    bool resume();
+    /**
+     * Check if the message being parsed has complete headers but not yet a
+     * complete body, e.g. to route a large upload between parse() calls.
+     */
+    bool headers_ready();
+    /**
+     * That message, still owned by the parser until result() returns it;
+     * its body() is not valid yet.
+     */
+    std::optional<HttpRequest*> head();
+    /**
+     * Change what is done with the rest of that message's body.
+     */
+    void set_body_action(BodyAction action);
+    /**
+     * The oldest completed message, or nullopt if there is none.
+     */
     std::optional<HttpRequest*> result();
+    /**
+     * Every completed message, oldest first.
+     */
+    std::vector<HttpRequest*> results();
+    /**
+     * Hand back a message taken from this parser once it is no longer
+     * used. Its memory is reused for a later message, so a pipelined
+     * connection on an arena stops growing it; messages of an arena that
+     * has since been reset are dropped instead.
+     */
+    void recycle(HttpRequest *req);
 };
 
 
@@ -200,13 +743,16 @@ class HttpParser<HttpResponse>
         CallBack last_callback;
         State state;
         std::vector<str_view_t> headers;
-        std::unique_ptr<HttpResponse> resp_ptr;
+        // http_header_id of each {field, value} pair in headers
+        std::vector<unsigned int> header_ids;
+        std::unique_ptr<HttpResponse, MessageDeleter> resp_ptr;
         bool complete;
     };
     instance_data_t data;
+    MessageArena *arena;
 
 public:
-    HttpParser();
+    HttpParser(MessageArena *arena = nullptr);
     void init();
     bool parse(const std::string_view &);
     bool complete();
@@ -222,8 +768,13 @@ class HttpRequest
     using uint = unsigned int;
 
     uint method_num;
-    std::string headers_str;
-    std::string body_str;
+    std::pmr::string headers_str;
+    /**
+     * The body as parsed, and a flat copy of it made by body() when it
+     * spans several segments.
+     */
+    BodyBuffer body_buf;
+    std::pmr::string body_str;
     /**
      * Reference to headers_str.
      */
@@ -231,26 +782,104 @@ class HttpRequest
     /**
      * Both field and value reference to headers_str
      */
-    std::map<std::string_view, std::string_view> headers;
+    HeaderTable headers;
+    /**
+     * References body_buf's only segment or body_str, or the caller's
+     * buffer in ZeroCopy mode.
+     */
+    std::string_view body_view;
+    /**
+     * False if the body was discarded or streamed instead of kept.
+     */
+    bool body_kept;
+    /**
+     * ZeroCopy mode: elements that were split across parse() calls, and the
+     * buffers the views point into. A deque, so adding to it never moves
+     * earlier strings.
+     */
+    std::pmr::deque<std::pmr::string> coalesced;
+    std::pmr::vector<std::shared_ptr<const void>> owners;
+    /**
+     * The decoded, normalized path of url(), filled in by the first call
+     * to path().
+     */
+    enum PathState
+    {
+        PathUnparsed, PathValid, PathInvalid,
+    };
+    std::pmr::string path_str;
+    PathState path_state;
+    /**
+     * The query of url(), split by the first call to query().
+     */
+    QueryIndex query_index;
+    bool query_indexed;
 
-    HttpRequest() {}
+    explicit HttpRequest(std::pmr::memory_resource *mr = std::pmr::get_default_resource());
+    HttpRequest(HttpRequest &&other, const char *old_headers);
+    /**
+     * Point url, header, body and query views that were in
+     * [from, from + len) into `to` instead.
+     */
+    void relocate(const char *from, size_t len, const char *to);
+    /**
+     * Empty the request for reuse, keeping the capacity of its members.
+     */
+    void clear();
 public:
     /**
      * Not copyable, only moveable.
      */
     HttpRequest(const HttpRequest&) = delete;
     /**
-     * Moveable
+     * Moveable: url, header and body views stay valid, as views into the
+     * request's own strings are rebased, so requests may be kept by value
+     * in containers. A request built in a MessageArena still lives in its
+     * memory, and must not outlive its reset().
+     *
+     * As with any pmr container, move assignment keeps this request's
+     * memory resource: if it differs from other's, other's contents are
+     * copied into it.
      */
     HttpRequest(HttpRequest&&);
+    HttpRequest &operator=(HttpRequest&&);
 
     uint method();
     std::string_view url();
+    /**
+     * The path of url(), percent-decoded and with "." and ".." segments and
+     * repeated slashes removed (see http_parser_normalize_path()), or
+     * nullopt if the url or an escape in it is malformed. Decoded on first
+     * use into the request's memory, i.e. its MessageArena if it has one.
+     */
+    std::optional<std::string_view> path();
+    /**
+     * The parameters of url()'s query string, empty if it has none or the
+     * url is malformed. Split on first use; values decode on lookup.
+     */
+    const QueryIndex &query();
     std::optional<std::string_view> header(const std::string &field);
     std::optional<std::string_view> header(const char *field, size_t len);
     std::optional<std::string_view> header(const std::string_view &field);
+    /**
+     * Lookup by id, without comparing names.
+     */
+    std::optional<std::string_view> header(HTTP_PARSER::http_header_id id);
+    /**
+     * All headers, in arrival order, duplicates included.
+     */
+    const HeaderTable &header_table();
+    /**
+     * nullopt if the parser was told to discard or stream the body. A body
+     * of several segments is copied into one string by the first call.
+     */
     std::optional<std::string_view> body();
+    /**
+     * The body segments, without copying (empty in ZeroCopy mode).
+     */
+    const BodyBuffer &body_buffer();
     friend HttpParser<HttpRequest>;
+    friend MessageArena;
 };
 
 
@@ -262,20 +891,46 @@ class HttpResponse
     using uint = unsigned int;
 
     uint status_num;
-    std::string headers_str;
-    std::string body_str;
-    std::map<std::string_view, std::string_view> headers;
+    std::pmr::string headers_str;
+    /**
+     * As in HttpRequest.
+     */
+    BodyBuffer body_buf;
+    std::pmr::string body_str;
+    HeaderTable headers;
 
-    HttpResponse() {}
+    explicit HttpResponse(std::pmr::memory_resource *mr = std::pmr::get_default_resource());
+    HttpResponse(HttpResponse &&other, const char *old_headers);
 public:
     HttpResponse(const HttpRequest&) = delete;
+    /**
+     * Moveable, as HttpRequest.
+     */
     HttpResponse(HttpResponse&&);
+    HttpResponse &operator=(HttpResponse&&);
 
     uint status();
     std::optional<std::string_view> header(const std::string &field);
     std::optional<std::string_view> header(const char *field, size_t len);
     std::optional<std::string_view> header(const std::string_view &field);
+    /**
+     * Lookup by id, without comparing names.
+     */
+    std::optional<std::string_view> header(HTTP_PARSER::http_header_id id);
+    /**
+     * All headers, in arrival order, duplicates included.
+     */
+    const HeaderTable &header_table();
+    /**
+     * A body of several segments is copied into one string by the first
+     * call.
+     */
     std::optional<std::string_view> body();
+    /**
+     * The body segments, without copying.
+     */
+    const BodyBuffer &body_buffer();
     friend HttpParser<HttpResponse>;
+    friend MessageArena;
 };
 
@@ -25,6 +25,7 @@
 #include <stdlib.h> /* rand */
 #include <string.h>
 #include <stdarg.h>
+#include <ctype.h> /* tolower */
 
 #if defined(__APPLE__)
 # undef strlncpy
@@ -1173,6 +1174,69 @@ const struct message requests[] =
   ,.headers= { { "Host", "example.com" } }
   ,.body= ""
   }
+
+/* Complete heads take the straight-line fast path; the special headers
+ * must still set the same flags as the state machine.
+ */
+#define FAST_PATH_KEEP_ALIVE_BODY 43
+, {.name = "fast path keep-alive with body"
+  ,.type= HTTP_REQUEST
+  ,.raw= "POST /api/v2/items?id=42&sig=0123456789abcdef HTTP/1.0\r\n"
+         "Host: api.example.com\r\n"
+         "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+         "CONNECTION:\tKeep-Alive\r\n"
+         "content-LENGTH: 11\r\n"
+         "X-Request-Id: 0123456789abcdef0123456789abcdef\r\n"
+         "\r\n"
+         "hello world"
+  ,.should_keep_alive= TRUE
+  ,.message_complete_on_eof= FALSE
+  ,.http_major= 1
+  ,.http_minor= 0
+  ,.method= HTTP_POST
+  ,.request_path= "/api/v2/items"
+  ,.request_url= "/api/v2/items?id=42&sig=0123456789abcdef"
+  ,.query_string= "id=42&sig=0123456789abcdef"
+  ,.fragment= ""
+  ,.num_headers= 5
+  ,.headers=
+    { { "Host", "api.example.com" }
+    , { "User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36" }
+    , { "CONNECTION", "Keep-Alive" }
+    , { "content-LENGTH", "11" }
+    , { "X-Request-Id", "0123456789abcdef0123456789abcdef" }
+    }
+  ,.body= "hello world"
+  }
+
+#define FAST_PATH_CHUNKED_CLOSE 44
+, {.name = "fast path chunked with proxy-connection close"
+  ,.type= HTTP_REQUEST
+  ,.raw= "PUT /upload HTTP/1.1\r\n"
+         "Proxy-Connection: close\r\n"
+         "Transfer-Encoding: Chunked\r\n"
+         "\r\n"
+         "5\r\nhello\r\n"
+         "0\r\n"
+         "\r\n"
+  ,.should_keep_alive= FALSE
+  ,.message_complete_on_eof= FALSE
+  ,.http_major= 1
+  ,.http_minor= 1
+  ,.method= HTTP_PUT
+  ,.request_path= "/upload"
+  ,.request_url= "/upload"
+  ,.query_string= ""
+  ,.fragment= ""
+  ,.num_headers= 2
+  ,.headers=
+    { { "Proxy-Connection", "close" }
+    , { "Transfer-Encoding", "Chunked" }
+    }
+  ,.body= "hello"
+  ,.num_chunks_complete= 2
+  ,.chunk_lengths= { 5 }
+  }
 };
 
 /* * R E S P O N S E S * */
@@ -2048,6 +2112,11 @@ header_value_cb (http_parser *p, const char *buf, size_t len)
            buf,
            len);
 
+  /* The name is complete by now, however it was split */
+  assert(p->header_id ==
+         http_header_lookup(m->headers[m->num_headers-1][0],
+                            strlen(m->headers[m->num_headers-1][0])));
+
   m->last_header_element = VALUE;
 
   return 0;
@@ -3269,6 +3338,39 @@ const struct url_test url_tests[] =
   ,.rv=1
   }
 
+/* Long enough to exercise the vectorized URL scanner in every field */
+, {.name="long path, query and fragment"
+  ,.url="/api/v1/objects/0123456789abcdef0123456789abcdef/versions"
+        "?sig=AbCdEfGhIjKlMnOpQrStUvWxYz0123456789-_.~%2F%3D&exp=1700000000"
+        "?again"
+        "#section-0123456789012345678901234567890123456789?x#y"
+  ,.is_connect=0
+  ,.u=
+    {.field_set=(1 << UF_PATH) | (1 << UF_QUERY) | (1 << UF_FRAGMENT)
+    ,.port=0
+    ,.field_data=
+      {{  0,  0 } /* UF_SCHEMA */
+      ,{  0,  0 } /* UF_HOST */
+      ,{  0,  0 } /* UF_PORT */
+      ,{  0, 57 } /* UF_PATH */
+      ,{ 58, 71 } /* UF_QUERY */
+      ,{130, 52 } /* UF_FRAGMENT */
+      ,{  0,  0 } /* UF_USERINFO */
+      }
+    }
+  ,.rv=0
+  }
+
+, {.name="DEL in long path"
+  ,.url="/0123456789abcdef0123456789abcdef0123456789\177abcdef"
+  ,.rv=1 /* s_dead */
+  }
+
+, {.name="space in long query"
+  ,.url="/?0123456789abcdef0123456789abcdef0123456789 abcdef"
+  ,.rv=1 /* s_dead */
+  }
+
 #if HTTP_PARSER_STRICT
 
 , {.name="tab in URL"
@@ -3386,6 +3488,347 @@ test_parse_url (void)
   }
 }
 
+/* `got` must be what http_parser_parse_url32() makes of `url`, shifted by
+ * `off`, and agree with http_parser_parse_url() where that applies.
+ */
+void
+check_url32 (const char *url, size_t len, int is_connect, uint32_t off,
+             const struct http_parser_url32 *got)
+{
+  struct http_parser_url32 u32;
+  struct http_parser_url u;
+  int rv, i;
+
+  rv = http_parser_parse_url32(url, len, is_connect, &u32);
+  assert(rv == 0 || u32.field_set == 0);
+  for (i = 0; i < UF_MAX; i++) {
+    if (u32.field_set & (1 << i)) {
+      u32.field_data[i].off += off;
+    }
+  }
+  assert(0 == memcmp(&u32, got, sizeof(u32)));
+
+  if (len > 0xffff) {
+    return;
+  }
+
+  memset(&u, 0, sizeof(u));
+  assert(http_parser_parse_url(url, len, is_connect, &u) == rv);
+  if (rv != 0) {
+    return;
+  }
+  assert(u.field_set == u32.field_set);
+  assert(u.port == u32.port);
+  for (i = 0; i < UF_MAX; i++) {
+    if (u.field_set & (1 << i)) {
+      assert(u.field_data[i].off + off == u32.field_data[i].off);
+      assert(u.field_data[i].len == u32.field_data[i].len);
+    }
+  }
+}
+
+/* http_parser_execute_head() must split each test URL the way
+ * http_parser_parse_url() does, in one buffer or a byte at a time.
+ */
+void
+test_parse_url32 (void)
+{
+  struct http_parser_url32 u32;
+  struct http_parser_head head;
+  const struct url_test *test;
+  static char buf[80 * 1024];
+  size_t i, j, url_len, len;
+  const char *method;
+
+  for (i = 0; i < (sizeof(url_tests) / sizeof(url_tests[0])); i++) {
+    test = &url_tests[i];
+    url_len = test->url ? strlen(test->url) : 0;
+    http_parser_parse_url32(test->url, url_len, test->is_connect, &u32);
+    check_url32(test->url, url_len, test->is_connect, 0, &u32);
+
+    if (url_len == 0 || strpbrk(test->url, " \r\n") != NULL) {
+      continue;
+    }
+
+    method = test->is_connect ? "CONNECT" : "GET";
+    len = sprintf(buf, "%s %s HTTP/1.1\r\n\r\n", method, test->url);
+
+    http_parser_init(&parser, HTTP_REQUEST);
+    http_parser_head_init(&head, NULL, 0);
+    http_parser_execute_head(&parser, &settings_null, buf, len, &head);
+    if (HTTP_PARSER_ERRNO(&parser) != HPE_OK) {
+      continue;
+    }
+    check_url32(test->url, url_len, test->is_connect,
+                (uint32_t) strlen(method) + 1, &head.url);
+
+    http_parser_init(&parser, HTTP_REQUEST);
+    http_parser_head_init(&head, NULL, 0);
+    for (j = 0; j < len; j++) {
+      assert(http_parser_execute_head(&parser, &settings_null, buf + j, 1,
+                                      &head) == 1);
+    }
+    check_url32(test->url, url_len, test->is_connect,
+                (uint32_t) strlen(method) + 1, &head.url);
+  }
+
+  /* Longer than a uint16_t offset can reach */
+  memcpy(buf, "GET /", 5);
+  memset(buf + 5, 'a', 70000);
+  len = 70005;
+  len += sprintf(buf + len, "?q=1#frag HTTP/1.1\r\n\r\n");
+  http_parser_init(&parser, HTTP_REQUEST);
+  http_parser_head_init(&head, NULL, 0);
+  assert(http_parser_execute_head(&parser, &settings_null, buf, len,
+                                  &head) == len);
+  assert(head.url.field_set ==
+         ((1 << UF_PATH) | (1 << UF_QUERY) | (1 << UF_FRAGMENT)));
+  assert(head.url.field_data[UF_PATH].off == 4);
+  assert(head.url.field_data[UF_PATH].len == 70001);
+  assert(head.url.field_data[UF_QUERY].off == 70006);
+  assert(head.url.field_data[UF_QUERY].len == 3);
+  assert(head.url.field_data[UF_FRAGMENT].off == 70010);
+  assert(head.url.field_data[UF_FRAGMENT].len == 4);
+  check_url32(buf + 4, head.url_len, 0, 4, &head.url);
+
+  /* A host name long enough for the vector scanner */
+  len = sprintf(buf, "GET http://%s:8080/x HTTP/1.1\r\n\r\n",
+                "a-rather-long-host-name.for-the-vector-scanner.example.com");
+  http_parser_init(&parser, HTTP_REQUEST);
+  http_parser_head_init(&head, NULL, 0);
+  assert(http_parser_execute_head(&parser, &settings_null, buf, len,
+                                  &head) == len);
+  assert(head.url.field_data[UF_HOST].len == 58);
+  assert(head.url.port == 8080);
+  check_url32(buf + 4, head.url_len, 0, 4, &head.url);
+}
+
+struct host_test {
+  const char *value;
+  int rv;
+  const char *host;
+  int port;                     /* -1 for none */
+};
+
+const struct host_test host_tests[] =
+  { { "example.com", 0, "example.com", -1 }
+  , { "example.com:8080", 0, "example.com", 8080 }
+  , { "example.com:8080 \t", 0, "example.com", 8080 }
+  , { "a-rather-long-host-name.for-the-vector-scanner.example.com:65535", 0,
+      "a-rather-long-host-name.for-the-vector-scanner.example.com", 65535 }
+  , { "127.0.0.1:0000080", 0, "127.0.0.1", 80 }
+  , { "127.0.0.1:00000080", 0, "127.0.0.1", 80 }
+  , { "[::1]:443", 0, "::1", 443 }
+  , { "[fe80::a%25eth0]", 0, "fe80::a%25eth0", -1 }
+  , { "example.com:65536", 1, NULL, -1 }
+  , { "example.com:", 1, NULL, -1 }
+  , { "example.com:80a", 1, NULL, -1 }
+  , { "user@example.com", 1, NULL, -1 }
+  , { "example.com/", 1, NULL, -1 }
+  , { "exa mple.com", 1, NULL, -1 }
+  , { "[::1", 1, NULL, -1 }
+  , { "", 1, NULL, -1 }
+  , { " ", 1, NULL, -1 }
+  };
+
+void
+test_parse_host (void)
+{
+  struct http_parser_url32 u;
+  const struct host_test *test;
+  unsigned int i;
+  int rv;
+
+  for (i = 0; i < ARRAY_SIZE(host_tests); i++) {
+    test = &host_tests[i];
+    rv = http_parser_parse_host(test->value, strlen(test->value), &u);
+    if (rv != test->rv) {
+      printf("\n*** http_parser_parse_host(\"%s\") returned %d ***\n\n",
+             test->value, rv);
+      abort();
+    }
+
+    if (rv != 0) {
+      assert(u.field_set == 0);
+      continue;
+    }
+
+    assert(u.field_data[UF_HOST].len == strlen(test->host));
+    assert(0 == memcmp(test->value + u.field_data[UF_HOST].off, test->host,
+                       u.field_data[UF_HOST].len));
+    if (test->port < 0) {
+      assert(u.field_set == (1 << UF_HOST));
+    } else {
+      assert(u.field_set == ((1 << UF_HOST) | (1 << UF_PORT)));
+      assert(u.port == test->port);
+    }
+  }
+}
+
+struct path_test {
+  const char *path;
+  const char *normalized;       /* NULL if it should be rejected */
+};
+
+const struct path_test path_tests[] =
+  { { "/", "/" }
+  , { "", "" }
+  , { "/index.html", "/index.html" }
+  , { "/a/b/c/", "/a/b/c/" }
+  , { "//a///b", "/a/b" }
+  , { "/a/./b/.", "/a/b/" }
+  , { "/a/b/../c", "/a/c" }
+  , { "/a/b/..", "/a/" }
+  , { "/../../a", "/a" }
+  , { "/a/..", "/" }
+  , { "/.hidden/..x/x..", "/.hidden/..x/x.." }
+  , { "/%61%62c", "/abc" }
+  , { "/a%2Fb%2f..%2F%2e%2E/c", "/c" }
+  , { "%2Fa", "/a" }
+  , { "a/../../b", "b" }
+  , { "/with%20space", "/with space" }
+  , { "/a-path-long-enough-for-the-vector-scanners/to-matter/at-all.html",
+      "/a-path-long-enough-for-the-vector-scanners/to-matter/at-all.html" }
+  , { "/a-path-long-enough-for-the-vector-scanners//to-matter/./at-all.html",
+      "/a-path-long-enough-for-the-vector-scanners/to-matter/at-all.html" }
+  , { "/bad%", NULL }
+  , { "/bad%4", NULL }
+  , { "/bad%4g", NULL }
+  , { "/nul%00", NULL }
+  };
+
+void
+test_normalize_path (void)
+{
+  char in[256];
+  char out[256];
+  size_t i, len, outlen;
+  int rv;
+
+  for (i = 0; i < ARRAY_SIZE(path_tests); i++) {
+    const struct path_test *test = &path_tests[i];
+
+    len = strlen(test->path);
+    rv = http_parser_normalize_path(test->path, len, out, &outlen);
+    if (test->normalized == NULL) {
+      assert(rv != 0);
+      continue;
+    }
+
+    if (rv != 0 || outlen != strlen(test->normalized) ||
+        memcmp(out, test->normalized, outlen) != 0) {
+      printf("\n*** http_parser_normalize_path(\"%s\") gave \"%.*s\" ***\n\n",
+             test->path, (int) outlen, out);
+      abort();
+    }
+
+    /* In place */
+    memcpy(in, test->path, len);
+    assert(http_parser_normalize_path(in, len, in, &outlen) == 0);
+    assert(outlen == strlen(test->normalized));
+    assert(memcmp(in, test->normalized, outlen) == 0);
+  }
+}
+
+struct query_test {
+  const char *query;
+  size_t count;
+  const char *params[8][2];     /* raw key and value of each */
+};
+
+const struct query_test query_tests[] =
+  { { "", 0, { { NULL, NULL } } }
+  , { "a=1", 1, { { "a", "1" } } }
+  , { "a=1&b=2&c", 3, { { "a", "1" }, { "b", "2" }, { "c", "" } } }
+  , { "&&a=&=b&", 2, { { "a", "" }, { "", "b" } } }
+  , { "a=b=c&d", 2, { { "a", "b=c" }, { "d", "" } } }
+  , { "q=a+b%20c&page=2", 2, { { "q", "a+b%20c" }, { "page", "2" } } }
+  , { "a-key-long-enough-for-the-vector-scanners=and-a-value-to-go-with-it"
+      "&x=1",
+      2,
+      { { "a-key-long-enough-for-the-vector-scanners",
+          "and-a-value-to-go-with-it" },
+        { "x", "1" } } }
+  };
+
+struct decode_test {
+  const char *in;
+  const char *out;              /* NULL if it should be rejected */
+};
+
+const struct decode_test decode_tests[] =
+  { { "", "" }
+  , { "plain", "plain" }
+  , { "a+b", "a b" }
+  , { "%41%62%2b%26", "Ab+&" }
+  , { "long-enough-for-the-vector-scanners-to-find+this%21",
+      "long-enough-for-the-vector-scanners-to-find this!" }
+  , { "%", NULL }
+  , { "%4", NULL }
+  , { "%zz", NULL }
+  };
+
+void
+test_split_query (void)
+{
+  struct http_parser_param params[8];
+  char in[256];
+  char out[256];
+  size_t i, j, len, outlen;
+
+  for (i = 0; i < ARRAY_SIZE(query_tests); i++) {
+    const struct query_test *test = &query_tests[i];
+
+    len = strlen(test->query);
+    if (http_parser_split_query(test->query, len, params, 8) != test->count) {
+      printf("\n*** http_parser_split_query(\"%s\") count ***\n\n",
+             test->query);
+      abort();
+    }
+
+    for (j = 0; j < test->count; j++) {
+      const char *key = test->params[j][0];
+      const char *value = test->params[j][1];
+
+      if (params[j].key_len != strlen(key) ||
+          memcmp(test->query + params[j].key_off, key, strlen(key)) != 0 ||
+          params[j].value_len != strlen(value) ||
+          memcmp(test->query + params[j].value_off, value, strlen(value)) != 0) {
+        printf("\n*** http_parser_split_query(\"%s\") param %u ***\n\n",
+               test->query, (unsigned) j);
+        abort();
+      }
+    }
+
+    /* The count does not depend on how many are stored */
+    if (test->count > 0) {
+      assert(http_parser_split_query(test->query, len, params, 1) ==
+             test->count);
+      assert(params[0].key_len == strlen(test->params[0][0]));
+    }
+  }
+
+  for (i = 0; i < ARRAY_SIZE(decode_tests); i++) {
+    const struct decode_test *test = &decode_tests[i];
+
+    len = strlen(test->in);
+    if (test->out == NULL) {
+      assert(http_parser_decode_param(test->in, len, out, &outlen) != 0);
+      continue;
+    }
+
+    assert(http_parser_decode_param(test->in, len, out, &outlen) == 0);
+    assert(outlen == strlen(test->out));
+    assert(memcmp(out, test->out, outlen) == 0);
+
+    /* In place */
+    memcpy(in, test->in, len);
+    assert(http_parser_decode_param(in, len, in, &outlen) == 0);
+    assert(outlen == strlen(test->out));
+    assert(memcmp(in, test->out, outlen) == 0);
+  }
+}
+
 void
 test_method_str (void)
 {
@@ -3393,6 +3836,38 @@ test_method_str (void)
   assert(0 == strcmp("<unknown>", http_method_str(1337)));
 }
 
+/* Every method must be recognized the same way whether it arrives in one
+ * buffer (word-at-a-time path) or one byte at a time.
+ */
+void
+test_method_parse (void)
+{
+  http_parser parser;
+  char buf[64];
+  size_t i, buflen, parsed;
+  int m;
+
+  for (m = HTTP_DELETE; m <= HTTP_SOURCE; m++) {
+    sprintf(buf, "%s %s HTTP/1.1\r\n\r\n", http_method_str(m),
+            m == HTTP_CONNECT ? "example.com:443" : "/");
+    buflen = strlen(buf);
+
+    http_parser_init(&parser, HTTP_REQUEST);
+    parsed = http_parser_execute(&parser, &settings_null, buf, buflen);
+    assert(parsed == buflen);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(parser.method == (unsigned) m);
+
+    http_parser_init(&parser, HTTP_REQUEST);
+    for (i = 0; i < buflen; i++) {
+      parsed = http_parser_execute(&parser, &settings_null, buf + i, 1);
+      assert(parsed == 1);
+    }
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(parser.method == (unsigned) m);
+  }
+}
+
 void
 test_status_str (void)
 {
@@ -3401,6 +3876,262 @@ test_status_str (void)
   assert(0 == strcmp("<unknown>", http_status_str(1337)));
 }
 
+void
+test_header_field_lower (void)
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
+    "!#$%&'*+-.^_`|~";
+  static const char stops[] = { ':', '@', '\0', '\177', '\200', '\t' };
+  char buf[128];
+  char out[128];
+  char expected[128];
+  size_t i, n, len;
+
+  for (i = 0; i < ARRAY_SIZE(stops); i++) {
+    for (n = 0; n < 100; n++) {
+      for (len = 0; len < n; len++) {
+        buf[len] = alphabet[(len * 7 + i) % (sizeof(alphabet) - 1)];
+        expected[len] = tolower((unsigned char) buf[len]);
+      }
+      buf[n] = stops[i];
+      memset(buf + n + 1, 'X', sizeof(buf) - n - 1);
+
+      len = http_header_field_lower(buf, sizeof(buf), out);
+      assert(len == n);
+      assert(0 == memcmp(out, expected, n));
+    }
+  }
+
+  /* Runs to the end of the buffer when there is no terminator */
+  memset(buf, 'Q', sizeof(buf));
+  assert(http_header_field_lower(buf, sizeof(buf), out) == sizeof(buf));
+  assert(out[0] == 'q' && out[sizeof(out) - 1] == 'q');
+}
+
+int
+pause_head_cb (http_parser *p)
+{
+  http_parser_pause(p, 1);
+  return 0;
+}
+
+static http_parser_settings settings_pause_head =
+  {.on_headers_complete = pause_head_cb
+  };
+
+/* http_parser_scan_head() on `buf` must come to the verdict that
+ * http_parser_execute_head() does: the same head, no head yet or the same
+ * error, bar the Content-Length errors the tables don't look for. `scanner`
+ * is set up by the caller and left as the scan leaves it. Returns the length
+ * of the head, or 0.
+ */
+size_t
+check_scan_head (http_parser *scanner, const char *buf, size_t len)
+{
+  struct http_parser_header scan[MAX_HEADERS];
+  struct http_parser_header split[MAX_HEADERS];
+  struct http_parser_head head;
+  struct http_parser_head head2;
+  http_parser p = *scanner;
+  size_t scanned, parsed;
+  enum http_errno err;
+  uint32_t i;
+
+  http_parser_head_init(&head, scan, MAX_HEADERS);
+  scanned = http_parser_scan_head(scanner, buf, len, &head);
+
+  /* A pause in on_headers_complete stops on the last byte of the head */
+  http_parser_head_init(&head2, split, MAX_HEADERS);
+  parsed = http_parser_execute_head(&p, &settings_pause_head, buf, len,
+                                    &head2);
+  err = HTTP_PARSER_ERRNO(&p);
+
+  if (err == HPE_INVALID_CONTENT_LENGTH ||
+      err == HPE_UNEXPECTED_CONTENT_LENGTH) {
+    return 0;
+  }
+
+  if (err != HPE_PAUSED) {
+    assert(scanned == 0);
+    assert(HTTP_PARSER_ERRNO(scanner) == err);
+    return 0;
+  }
+
+  assert(scanned == parsed + 1);
+  assert(HTTP_PARSER_ERRNO(scanner) == HPE_OK);
+  assert(head.url_len == head2.url_len);
+  assert(head.url_len == 0 || head.url_off == head2.url_off);
+  assert(0 == memcmp(&head.url, &head2.url, sizeof(head2.url)));
+  assert(head.status_len == head2.status_len);
+  assert(head.status_len == 0 || head.status_off == head2.status_off);
+  assert(head.nheaders == head2.nheaders);
+  for (i = 0; i < head.nheaders; i++) {
+    assert(scan[i].name_off == split[i].name_off);
+    assert(scan[i].name_len == split[i].name_len);
+    assert(scan[i].value_len == split[i].value_len);
+    assert(scan[i].value_len == 0 || scan[i].value_off == split[i].value_off);
+    assert(scan[i].id == split[i].id);
+  }
+  assert(scanner->http_major == p.http_major);
+  assert(scanner->http_minor == p.http_minor);
+  if (p.type == HTTP_REQUEST) {
+    assert(scanner->method == p.method);
+  } else {
+    assert(scanner->status_code == p.status_code);
+  }
+  return scanned;
+}
+
+void
+test_scan_head (void)
+{
+  static const char req[] = "HEAD /x HTTP/1.0\r\nHost: a\r\n\r\nrest";
+  static const char res[] = "HTTP/1.1 404 Not Found\nX:\n  y\n\n";
+  static const struct {
+    enum http_parser_type type;
+    const char *raw;
+    enum http_errno err;
+  } bad[] = {
+    { HTTP_REQUEST, "GET foo HTTP/1.1\r\n\r\n", HPE_INVALID_URL },
+    { HTTP_REQUEST, "GET http:/x HTTP/1.1\r\n\r\n", HPE_INVALID_URL },
+    { HTTP_REQUEST, "GET http://a@@b/ HTTP/1.1\r\n\r\n", HPE_INVALID_URL },
+    { HTTP_REQUEST, "CONNECT /x HTTP/1.1\r\n\r\n", HPE_OK },
+    { HTTP_REQUEST, "GET /\r\nHost: a\r\n\r\n", HPE_OK },
+    { HTTP_REQUEST, "GET / HTTP/1.1\r\nHost: a\001\r\n\r\n",
+      HPE_INVALID_HEADER_TOKEN },
+    { HTTP_REQUEST, "GET / HTTP/1.1\r\nHost: \001\r\n\r\n", HPE_OK },
+    { HTTP_REQUEST, "GET / HTTP/10.1\r\n\r\n", HPE_INVALID_VERSION },
+    { HTTP_REQUEST, "GET / HTTP/1.1\rX", HPE_LF_EXPECTED },
+    { HTTP_RESPONSE, "HTTP/10.1 200 OK\r\n\r\n", HPE_INVALID_VERSION },
+    { HTTP_RESPONSE, "HTTP/1.1 1000 OK\r\n\r\n", HPE_INVALID_STATUS },
+    { HTTP_RESPONSE, "HTTP/1.1 0200\r\n\r\n", HPE_OK },
+    { HTTP_RESPONSE, "HTTP/1.1  2 OK\r\n\r\n", HPE_OK },
+    { HTTP_BOTH, "HX", HPE_INVALID_CONSTANT },
+    { HTTP_BOTH, "HEX", HPE_INVALID_METHOD },
+  };
+  struct http_parser_header headers[2];
+  struct http_parser_head head;
+  http_parser p;
+  char *big;
+  size_t n;
+  int i;
+
+  /* HTTP_BOTH tells "HEAD " and "HTTP/" apart */
+  http_parser_init(&p, HTTP_BOTH);
+  http_parser_head_init(&head, headers, 2);
+  n = http_parser_scan_head(&p, req, sizeof(req) - 1, &head);
+  assert(n == sizeof(req) - 1 - strlen("rest"));
+  assert(p.method == HTTP_HEAD && p.http_major == 1 && p.http_minor == 0);
+  assert(head.url_len == 2 && 0 == memcmp(req + head.url_off, "/x", 2));
+  assert(head.nheaders == 1 && headers[0].id == HTTP_HEADER_HOST);
+  assert(headers[0].value_len == 1 && req[headers[0].value_off] == 'a');
+
+  http_parser_init(&p, HTTP_BOTH);
+  http_parser_head_init(&head, headers, 2);
+  n = http_parser_scan_head(&p, res, sizeof(res) - 1, &head);
+  assert(n == sizeof(res) - 1);
+  assert(p.status_code == 404);
+  assert(head.status_len == 9);
+  assert(0 == memcmp(res + head.status_off, "Not Found", 9));
+  assert(head.nheaders == 1 && headers[0].value_len == 1);
+  assert(res[headers[0].value_off] == 'y');
+
+  /* Every prefix is incomplete but fine */
+  for (n = 0; n < sizeof(req) - 1 - strlen("\r\nrest"); n++) {
+    http_parser_init(&p, HTTP_REQUEST);
+    http_parser_head_init(&head, headers, 2);
+    assert(0 == http_parser_scan_head(&p, req, n, &head));
+    assert(HTTP_PARSER_ERRNO(&p) == HPE_OK);
+  }
+
+  http_parser_init(&p, HTTP_REQUEST);
+  assert(0 == http_parser_scan_head(&p, res, sizeof(res) - 1, &head));
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_INVALID_METHOD);
+
+  http_parser_init(&p, HTTP_RESPONSE);
+  http_parser_head_init(&head, headers, 0);
+  assert(0 == http_parser_scan_head(&p, res, sizeof(res) - 1, &head));
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_TOO_MANY_HEADERS);
+
+  /* Heads the hand-written parser takes or turns down, and how */
+  for (n = 0; n < ARRAY_SIZE(bad); n++) {
+    http_parser_init(&p, bad[n].type);
+    check_scan_head(&p, bad[n].raw, strlen(bad[n].raw));
+    assert(HTTP_PARSER_ERRNO(&p) == bad[n].err);
+  }
+
+  /* A control byte inside a value is fine with lenient_http_headers */
+  http_parser_init(&p, HTTP_REQUEST);
+  p.lenient_http_headers = 1;
+  n = strlen("GET / HTTP/1.1\r\nHost: a\001\r\n\r\n");
+  assert(n == check_scan_head(&p, "GET / HTTP/1.1\r\nHost: a\001\r\n\r\n",
+                              n));
+
+  /* A whole head is too large, and so is one that goes wrong only after
+   * HTTP_MAX_HEADER_SIZE
+   */
+  big = malloc(HTTP_MAX_HEADER_SIZE + 32);
+  assert(big != NULL);
+  for (i = 0; i < 2; i++) {
+    n = sprintf(big, "GET / HTTP/1.1\r\nX: ");
+    memset(big + n, 'x', HTTP_MAX_HEADER_SIZE);
+    n += HTTP_MAX_HEADER_SIZE;
+    n += sprintf(big + n, i == 0 ? "\r\n\r\n" : "\001\r\n\r\n");
+    http_parser_init(&p, HTTP_REQUEST);
+    assert(check_scan_head(&p, big, n) == 0);
+    assert(HTTP_PARSER_ERRNO(&p) == HPE_HEADER_OVERFLOW);
+  }
+  free(big);
+}
+
+void
+test_header_lookup (void)
+{
+  static const char *names[] = {
+#define XX(num, name, string) string,
+  HTTP_HEADER_MAP(XX)
+#undef XX
+  };
+  char buf[64];
+  size_t i, n, len;
+  enum http_header_id id;
+
+  assert(0 == strcmp("<unknown>", http_header_name(HTTP_HEADER_OTHER)));
+  assert(0 == strcmp("<unknown>", http_header_name(ARRAY_SIZE(names) + 1)));
+  assert(http_header_lookup("", 0) == HTTP_HEADER_OTHER);
+  assert(http_header_lookup("X", 1) == HTTP_HEADER_OTHER);
+
+  for (i = 0; i < ARRAY_SIZE(names); i++) {
+    id = (enum http_header_id) (i + 1);
+    len = strlen(names[i]);
+    assert(0 == strcmp(names[i], http_header_name(id)));
+    assert(http_header_lookup(names[i], len) == id);
+
+    for (n = 0; n < len; n++) {
+      buf[n] = toupper((unsigned char) names[i][n]);
+    }
+    assert(http_header_lookup(buf, len) == id);
+
+    /* Prefixes and extensions only match if they are names themselves */
+    for (n = 1; n < len; n++) {
+      id = http_header_lookup(names[i], n);
+      assert(id == HTTP_HEADER_OTHER ||
+             (strlen(http_header_name(id)) == n &&
+              0 == memcmp(http_header_name(id), names[i], n)));
+    }
+    memcpy(buf, names[i], len);
+    buf[len] = 's';
+    assert(http_header_lookup(buf, len + 1) == HTTP_HEADER_OTHER);
+    buf[len - 1] ^= 1;
+    assert(http_header_lookup(buf, len) == HTTP_HEADER_OTHER);
+  }
+
+  /* Only letters fold: CR | 0x20 is '-' */
+  assert(http_header_lookup("Content\rType", 12) == HTTP_HEADER_OTHER);
+  assert(http_header_lookup("te\r", 3) == HTTP_HEADER_OTHER);
+}
+
 void
 test_message (const struct message *message)
 {
@@ -3468,6 +4199,450 @@ test_message (const struct message *message)
   }
 }
 
+void
+test_message_head (const struct message *message)
+{
+  /* Bytes that mean something somewhere in a head */
+  static const char noise[] = "\0\t\n\r #%/0:?@AHT\177\200";
+  struct http_parser_header headers[MAX_HEADERS];
+  struct http_parser_header split[MAX_HEADERS];
+  struct http_parser_head head;
+  struct http_parser_head head2;
+  http_parser scanner;
+  const char *raw = message->raw;
+  size_t raw_len = strlen(raw);
+  size_t parsed, scanned, i;
+  const struct http_parser_header *h;
+  char *corrupt;
+  int k;
+
+  http_parser_init(&parser, message->type);
+  http_parser_head_init(&head, headers, MAX_HEADERS);
+  parsed = http_parser_execute_head(&parser, &settings_null, raw, raw_len,
+                                    &head);
+  assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+  assert(head.base == parsed);
+
+  if (message->type == HTTP_REQUEST) {
+    assert(head.url_len == strlen(message->request_url));
+    assert(0 == memcmp(raw + head.url_off, message->request_url,
+                       head.url_len));
+    check_url32(raw + head.url_off, head.url_len,
+                message->method == HTTP_CONNECT, head.url_off, &head.url);
+  } else {
+    assert(head.status_len == strlen(message->response_status));
+    assert(0 == memcmp(raw + head.status_off, message->response_status,
+                       head.status_len));
+  }
+
+  assert(head.nheaders == (uint32_t) message->num_headers);
+  for (k = 0; k < message->num_headers; k++) {
+    h = &headers[k];
+    assert(h->name_len == strlen(message->headers[k][0]));
+    assert(0 == memcmp(raw + h->name_off, message->headers[k][0],
+                       h->name_len));
+    assert(h->id == (uint32_t) http_header_lookup(raw + h->name_off,
+                                                  h->name_len));
+    /* Folded values span their line breaks */
+    if (memchr(raw + h->value_off, '\n', h->value_len) == NULL) {
+      assert(h->value_len == strlen(message->headers[k][1]));
+      assert(0 == memcmp(raw + h->value_off, message->headers[k][1],
+                         h->value_len));
+    }
+  }
+
+  /* The table-driven engine must take the head the way the hand-written
+   * one does, and turn down every corruption of it the same way
+   */
+  http_parser_init(&scanner, message->type);
+  scanned = check_scan_head(&scanner, raw, raw_len);
+  assert(scanned > 0 && scanned <= parsed);
+  assert(scanner.http_major == message->http_major);
+  assert(scanner.http_minor == message->http_minor);
+  if (message->type == HTTP_REQUEST) {
+    assert(scanner.method == message->method);
+  } else {
+    assert(scanner.status_code == message->status_code);
+  }
+
+  http_parser_init(&scanner, HTTP_BOTH);
+  assert(check_scan_head(&scanner, raw, raw_len) == scanned);
+
+  corrupt = malloc(raw_len);
+  assert(corrupt != NULL);
+  memcpy(corrupt, raw, raw_len);
+  for (i = 0; i < scanned; i++) {
+    for (k = 0; k < (int) sizeof(noise) - 1; k++) {
+      corrupt[i] = noise[k];
+      http_parser_init(&scanner, message->type);
+      scanner.lenient_http_headers = (i + k) & 1;
+      check_scan_head(&scanner, corrupt, raw_len);
+    }
+    corrupt[i] = raw[i];
+  }
+  free(corrupt);
+
+  /* The index must not depend on how the input is split */
+  for (i = 1; i < parsed; i++) {
+    http_parser_init(&parser, message->type);
+    http_parser_head_init(&head2, split, MAX_HEADERS);
+    assert(http_parser_execute_head(&parser, &settings_null, raw, i,
+                                    &head2) == i);
+    http_parser_execute_head(&parser, &settings_null, raw + i, raw_len - i,
+                             &head2);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(head2.base == parsed);
+    assert(head2.url_off == head.url_off && head2.url_len == head.url_len);
+    assert(0 == memcmp(&head2.url, &head.url, sizeof(head.url)));
+    assert(head2.status_off == head.status_off &&
+           head2.status_len == head.status_len);
+    assert(head2.nheaders == head.nheaders);
+    assert(0 == memcmp(split, headers, head.nheaders * sizeof(*headers)));
+  }
+
+  /* One entry short */
+  if (message->num_headers > 0) {
+    http_parser_init(&parser, message->type);
+    http_parser_head_init(&head2, split, message->num_headers - 1);
+    http_parser_execute_head(&parser, &settings_null, raw, raw_len, &head2);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_TOO_MANY_HEADERS);
+  }
+}
+
+static char dechunked[MAX_ELEMENT_SIZE];
+static size_t dechunked_len;
+static int dechunk_body_calls;
+static int dechunk_messages;
+
+int
+dechunk_body_cb (http_parser *p, const char *buf, size_t len)
+{
+  assert(p == &parser);
+  assert(dechunked_len + len <= sizeof(dechunked));
+  memcpy(dechunked + dechunked_len, buf, len);
+  dechunked_len += len;
+  dechunk_body_calls++;
+  return 0;
+}
+
+int
+dechunk_message_complete_cb (http_parser *p)
+{
+  assert(p == &parser);
+  dechunk_messages++;
+  return 0;
+}
+
+int
+dechunk_chunk_cb (http_parser *p)
+{
+  (void) p;
+  assert(0 && "no chunk callbacks when dechunking");
+  return -1;
+}
+
+static http_parser_settings settings_dechunk =
+  {.on_body = dechunk_body_cb
+  ,.on_message_complete = dechunk_message_complete_cb
+  ,.on_chunk_header = dechunk_chunk_cb
+  ,.on_chunk_complete = dechunk_chunk_cb
+  };
+
+/* Decode chunked messages in place, split in two at every offset */
+void
+test_dechunk (const struct message *message)
+{
+  size_t raw_len = strlen(message->raw);
+  size_t body_len = strlen(message->body);
+  char *buf;
+  size_t i;
+
+  if (message->num_chunks_complete == 0 || message->upgrade) {
+    return;
+  }
+
+  buf = malloc(raw_len);
+  assert(buf != NULL);
+
+  for (i = 0; i <= raw_len; i++) {
+    memcpy(buf, message->raw, raw_len);
+    http_parser_init(&parser, message->type);
+    dechunked_len = 0;
+    dechunk_body_calls = 0;
+    dechunk_messages = 0;
+
+    assert(http_parser_execute_dechunk(&parser, &settings_dechunk,
+                                       buf, i) == i);
+    assert(http_parser_execute_dechunk(&parser, &settings_dechunk,
+                                       buf + i, raw_len - i) == raw_len - i);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+
+    /* One body range per call at most */
+    assert(dechunk_body_calls <= 2);
+    assert(dechunked_len == body_len);
+    assert(0 == memcmp(dechunked, message->body, body_len));
+    assert(dechunk_messages == 1);
+  }
+
+  free(buf);
+}
+
+static int ranges_calls;
+static int ranges_pause;
+
+int
+ranges_cb (http_parser *p, const struct http_parser_range *r, size_t n)
+{
+  size_t i;
+
+  assert(p == &parser);
+  assert(n > 0);
+  for (i = 0; i < n; i++) {
+    assert(r[i].length > 0);
+    assert(dechunked_len + r[i].length <= sizeof(dechunked));
+    memcpy(dechunked + dechunked_len, r[i].at, r[i].length);
+    dechunked_len += r[i].length;
+  }
+  ranges_calls++;
+  if (ranges_pause) {
+    http_parser_pause(p, 1);
+  }
+  return 0;
+}
+
+int
+ranges_body_cb (http_parser *p, const char *buf, size_t len)
+{
+  (void) p;
+  (void) buf;
+  (void) len;
+  assert(0 && "chunk payloads go to on_body_ranges");
+  return -1;
+}
+
+static http_parser_settings settings_ranges =
+  {.on_body = ranges_body_cb
+  ,.on_message_complete = dechunk_message_complete_cb
+  ,.on_chunk_header = dechunk_chunk_cb
+  ,.on_chunk_complete = dechunk_chunk_cb
+  ,.on_body_ranges = ranges_cb
+  };
+
+/* Collect the body ranges of chunked messages, split in two at every
+ * offset
+ */
+void
+test_body_ranges (const struct message *message)
+{
+  size_t raw_len = strlen(message->raw);
+  size_t body_len = strlen(message->body);
+  size_t i;
+
+  if (message->num_chunks_complete == 0 || message->upgrade) {
+    return;
+  }
+
+  for (i = 0; i <= raw_len; i++) {
+    http_parser_init(&parser, message->type);
+    dechunked_len = 0;
+    ranges_calls = 0;
+    ranges_pause = 0;
+    dechunk_messages = 0;
+
+    assert(http_parser_execute(&parser, &settings_ranges,
+                               message->raw, i) == i);
+    assert(http_parser_execute(&parser, &settings_ranges,
+                               message->raw + i, raw_len - i) == raw_len - i);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+
+    /* One call per execute */
+    assert(ranges_calls <= 2);
+    assert(dechunked_len == body_len);
+    assert(0 == memcmp(dechunked, message->body, body_len));
+    assert(dechunk_messages == 1);
+  }
+}
+
+/* Many one-byte chunks: more ranges than fit in one call, with the parser
+ * paused after every call
+ */
+void
+test_body_ranges_many (void)
+{
+  char raw[2048];
+  char body[256];
+  size_t raw_len, done, n;
+  int i, calls;
+
+  raw_len = (size_t) sprintf(raw,
+                             "HTTP/1.1 200 OK\r\n"
+                             "Transfer-Encoding: chunked\r\n"
+                             "\r\n");
+  for (i = 0; i < 100; i++) {
+    body[i] = (char) ('a' + i % 26);
+    raw_len += (size_t) sprintf(raw + raw_len, "1\r\n%c\r\n", body[i]);
+  }
+  raw_len += (size_t) sprintf(raw + raw_len, "0\r\n\r\n");
+
+  for (ranges_pause = 0; ranges_pause <= 1; ranges_pause++) {
+    http_parser_init(&parser, HTTP_RESPONSE);
+    dechunked_len = 0;
+    ranges_calls = 0;
+    dechunk_messages = 0;
+
+    done = 0;
+    for (calls = 0; done < raw_len; calls++) {
+      assert(calls < 10);
+      n = http_parser_execute(&parser, &settings_ranges,
+                              raw + done, raw_len - done);
+      if (HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED) {
+        http_parser_pause(&parser, 0);
+      }
+      assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+      done += n;
+    }
+
+    assert(ranges_calls == 4);
+    assert(calls == (ranges_pause ? 5 : 1));
+    assert(dechunked_len == 100);
+    assert(0 == memcmp(dechunked, body, 100));
+    assert(dechunk_messages == 1);
+  }
+  ranges_pause = 0;
+}
+
+static int
+only_crlf (const char *raw, size_t from, size_t to)
+{
+  for (; from < to; from++) {
+    if (raw[from] != '\r' && raw[from] != '\n') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Check batch entry `k` against `message`, which starts at offset `start`
+ * of the pipeline `raw`
+ */
+static void
+check_batch_message (const struct http_parser_batch *batch, uint32_t k,
+                     const char *raw, size_t start,
+                     const struct message *message)
+{
+  const struct http_parser_message *m = batch->messages + k;
+  char body[MAX_ELEMENT_SIZE];
+  size_t body_len = 0;
+  uint32_t i;
+
+  /* Empty lines around a message aren't part of it */
+  assert(m->start >= start && m->end <= start + strlen(message->raw));
+  assert(only_crlf(raw, start, m->start));
+  assert(only_crlf(raw, m->end, start + strlen(message->raw)));
+  assert(m->head_end > m->start && m->head_end <= m->end);
+  assert(raw[m->head_end - 1] == '\n');
+  assert(m->http_major == message->http_major);
+  assert(m->http_minor == message->http_minor);
+  assert(m->keep_alive == message->should_keep_alive);
+  assert(!m->upgrade);
+  if (message->type == HTTP_REQUEST) {
+    assert(m->method == message->method);
+  } else {
+    assert(m->status_code == message->status_code);
+  }
+
+  for (i = 0; i < m->body_count; i++) {
+    const struct http_parser_span *b = batch->bodies + m->body_first + i;
+
+    assert(b->off >= m->head_end && b->off + b->len <= m->end);
+    assert(body_len + b->len <= sizeof(body));
+    memcpy(body + body_len, raw + b->off, b->len);
+    body_len += b->len;
+  }
+  assert(body_len == strlen(message->body));
+  assert(0 == memcmp(body, message->body, body_len));
+}
+
+/* Pipeline every keep-alive message of `list` that ends on its own and
+ * parse the run with http_parser_execute_batch(): all at once, a few
+ * messages per call, and with the input arriving a few bytes at a time.
+ */
+void
+test_batch (const struct message *list, size_t n, enum http_parser_type type)
+{
+  const struct message *picked[64];
+  size_t offsets[65];
+  struct http_parser_message messages[64];
+  struct http_parser_span bodies[64];
+  struct http_parser_batch batch;
+  char *raw;
+  size_t npicked = 0, total = 0, done, avail, nparsed, i;
+  uint32_t k, seen;
+
+  for (i = 0; i < n && npicked < ARRAY_SIZE(picked); i++) {
+    if (list[i].should_keep_alive && !list[i].upgrade &&
+        !list[i].message_complete_on_eof &&
+        list[i].num_chunks <= (int) ARRAY_SIZE(bodies) / 4) {
+      offsets[npicked] = total;
+      picked[npicked++] = &list[i];
+      total += strlen(list[i].raw);
+    }
+  }
+  offsets[npicked] = total;
+  assert(npicked > 1);
+
+  raw = malloc(total);
+  assert(raw != NULL);
+  for (i = 0; i < npicked; i++) {
+    memcpy(raw + offsets[i], picked[i]->raw, strlen(picked[i]->raw));
+  }
+
+  /* The whole run, in calls of up to 4 messages and 16 body spans */
+  http_parser_init(&parser, type);
+  http_parser_batch_init(&batch, messages, 4, bodies, 16);
+  for (done = 0, seen = 0; seen < npicked; done += nparsed) {
+    nparsed = http_parser_execute_batch(&parser, raw + done, total - done,
+                                        &batch);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(batch.base == done + nparsed);
+    assert(batch.nmessages > 0 && batch.nmessages <= 4);
+    for (k = 0; k < batch.nmessages; k++, seen++) {
+      check_batch_message(&batch, k, raw, offsets[seen], picked[seen]);
+    }
+  }
+  assert(only_crlf(raw, done, total));
+
+  /* Input arriving 7 bytes at a time; only whole messages are taken */
+  http_parser_init(&parser, type);
+  http_parser_batch_init(&batch, messages, ARRAY_SIZE(messages),
+                         bodies, ARRAY_SIZE(bodies));
+  done = 0;
+  seen = 0;
+  for (avail = 0; avail < total; ) {
+    avail = MIN(avail + 7, total);
+    nparsed = http_parser_execute_batch(&parser, raw + done, avail - done,
+                                        &batch);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    for (k = 0; k < batch.nmessages; k++, seen++) {
+      check_batch_message(&batch, k, raw, offsets[seen], picked[seen]);
+    }
+    done += nparsed;
+    assert(done <= offsets[seen]);
+  }
+  assert(seen == npicked);
+  assert(only_crlf(raw, done, total));
+
+  /* Room for one message only */
+  http_parser_init(&parser, type);
+  http_parser_batch_init(&batch, messages, 1, bodies, ARRAY_SIZE(bodies));
+  nparsed = http_parser_execute_batch(&parser, raw, total, &batch);
+  assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+  assert(batch.nmessages == 1);
+  assert(nparsed == messages[0].end);
+
+  free(raw);
+}
+
 void
 test_message_count_body (const struct message *message)
 {
@@ -3507,6 +4682,8 @@ test_simple_type (const char *buf,
                   enum http_errno err_expected,
                   enum http_parser_type type)
 {
+  http_parser scanner;
+
   parser_init(type);
 
   enum http_errno err;
@@ -3527,6 +4704,9 @@ test_simple_type (const char *buf,
         http_errno_name(err_expected), http_errno_name(err), buf);
     abort();
   }
+
+  http_parser_init(&scanner, type);
+  check_scan_head(&scanner, buf, strlen(buf));
 }
 
 void
@@ -3567,6 +4747,48 @@ test_invalid_header_field_content_error (int req)
 {
   test_invalid_header_content(req, "Foo: F\01ailure");
   test_invalid_header_content(req, "Foo: B\02ar");
+  test_invalid_header_content(req, "Foo: Bar\177");
+}
+
+/* Invalid bytes have to be caught anywhere in a header value, not only
+ * right after the colon. Walk the bad byte over enough offsets to hit every
+ * lane of the vectorized scanners as well as the scalar tail.
+ */
+void
+test_invalid_header_value_offsets (int req)
+{
+  static const char bad[] = { '\0', '\01', '\b', '\v', '\037', '\177' };
+  const char *start = req ? "GET / HTTP/1.1\r\n" : "HTTP/1.1 200 OK\r\n";
+  char buf[128];
+  size_t i, j, buflen, parsed;
+  http_parser parser;
+
+  for (i = 0; i < ARRAY_SIZE(bad); i++) {
+    for (j = 1; j < 80; j++) {
+      memcpy(buf, "Foo: ", 5);
+      memset(buf + 5, 'x', j);
+      buf[5 + j] = bad[i];
+      memcpy(buf + 6 + j, "\txx\200xx\r\n\r\n", 10);
+      buflen = 6 + j + 10;
+
+      http_parser_init(&parser, req ? HTTP_REQUEST : HTTP_RESPONSE);
+      parsed = http_parser_execute(&parser, &settings_null, start,
+                                   strlen(start));
+      assert(parsed == strlen(start));
+      parsed = http_parser_execute(&parser, &settings_null, buf, buflen);
+      assert(parsed == 5 + j);
+      assert(HTTP_PARSER_ERRNO(&parser) == HPE_INVALID_HEADER_TOKEN);
+
+      http_parser_init(&parser, req ? HTTP_REQUEST : HTTP_RESPONSE);
+      parser.lenient_http_headers = 1;
+      parsed = http_parser_execute(&parser, &settings_null, start,
+                                   strlen(start));
+      assert(parsed == strlen(start));
+      parsed = http_parser_execute(&parser, &settings_null, buf, buflen);
+      assert(parsed == buflen);
+      assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    }
+  }
 }
 
 void
@@ -3781,6 +5003,88 @@ test_header_content_length_overflow_error (void)
   test_content_length_overflow(c, sizeof(c) - 1, 0); /* expect failure */
 }
 
+/* Content-Length values around the word sizes of the fast path, in one
+ * buffer and split after every byte
+ */
+void
+test_content_length_digits (void)
+{
+  static const char *const values[] =
+    { "1", "7", "42", "1234567", "12345678", "123456789", "999999999999999"
+    , "1234567890123456", "12345678901234567", "1844674407370955160"
+    };
+  char buf[128];
+  size_t i, j, len;
+
+  for (i = 0; i < ARRAY_SIZE(values); i++) {
+    uint64_t expected = strtoull(values[i], NULL, 10);
+
+    len = (size_t) sprintf(buf,
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Length: %s\r\n"
+                           "\r\n", values[i]);
+
+    for (j = 0; j < len; j++) {
+      http_parser parser;
+
+      http_parser_init(&parser, HTTP_RESPONSE);
+      assert(http_parser_execute(&parser, &settings_null, buf, j) == j);
+      assert(http_parser_execute(&parser, &settings_null,
+                                 buf + j, len - j) == len - j);
+      assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+      assert(parser.content_length == expected);
+    }
+  }
+}
+
+/* Versions and status codes with and without the word-at-a-time paths */
+void
+test_version_status_words (void)
+{
+  static const struct {
+    enum http_parser_type type;
+    const char *line;
+    enum http_errno err;
+    unsigned short major, minor, status;
+  } cases[] =
+    { { HTTP_RESPONSE, "HTTP/1.1 200 OK\r\n", HPE_OK, 1, 1, 200 }
+    , { HTTP_RESPONSE, "HTTP/1.0 404 Not Found\r\n", HPE_OK, 1, 0, 404 }
+    , { HTTP_RESPONSE, "HTTP/1.1 999\r\n", HPE_OK, 1, 1, 999 }
+    , { HTTP_RESPONSE, "HTTP/2.0 101 \r\n", HPE_OK, 2, 0, 101 }
+    , { HTTP_RESPONSE, "HTTP/1.1 20 Short\r\n", HPE_OK, 1, 1, 20 }
+    , { HTTP_RESPONSE, "HTTP/1.1 2000 OK\r\n", HPE_INVALID_STATUS, 1, 1, 0 }
+    , { HTTP_RESPONSE, "HTTP/1.1 2x0 OK\r\n", HPE_INVALID_STATUS, 1, 1, 0 }
+    , { HTTP_RESPONSE, "HTTP/1.1 /00 OK\r\n", HPE_INVALID_STATUS, 1, 1, 0 }
+    , { HTTP_BOTH, "HTTP/1.0 304 Not Modified\r\n", HPE_OK, 1, 0, 304 }
+    , { HTTP_REQUEST, "GET / HTTP/1.0\r\n", HPE_OK, 1, 0, 0 }
+    , { HTTP_REQUEST, "GET / HTTP/1.1\r\n", HPE_OK, 1, 1, 0 }
+    , { HTTP_REQUEST, "GET / HTTP/1.11\r\n", HPE_INVALID_VERSION, 1, 1, 0 }
+    };
+  char buf[128];
+  size_t i, j, len;
+
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    len = (size_t) sprintf(buf, "%s\r\n", cases[i].line);
+
+    for (j = 0; j < len; j++) {
+      http_parser parser;
+
+      http_parser_init(&parser, cases[i].type);
+      http_parser_execute(&parser, &settings_null, buf, j);
+      if (HTTP_PARSER_ERRNO(&parser) == HPE_OK) {
+        http_parser_execute(&parser, &settings_null, buf + j, len - j);
+      }
+      assert(HTTP_PARSER_ERRNO(&parser) == cases[i].err);
+      if (cases[i].err != HPE_OK) {
+        continue;
+      }
+      assert(parser.http_major == cases[i].major);
+      assert(parser.http_minor == cases[i].minor);
+      assert(parser.status_code == cases[i].status);
+    }
+  }
+}
+
 void
 test_chunk_content_length_overflow_error (void)
 {
@@ -4130,8 +5434,17 @@ main (void)
   //// API
   test_preserve_data();
   test_parse_url();
+  test_parse_url32();
+  test_parse_host();
+  test_normalize_path();
+  test_split_query();
   test_method_str();
+  test_method_parse();
   test_status_str();
+  test_header_field_lower();
+  test_header_lookup();
+  test_scan_head();
+  test_body_ranges_many();
 
   //// NREAD
   test_header_nread_value();
@@ -4149,6 +5462,8 @@ main (void)
 
   test_header_content_length_overflow_error();
   test_chunk_content_length_overflow_error();
+  test_content_length_digits();
+  test_version_status_words();
 
   //// HEADER FIELD CONDITIONS
   test_double_content_length_error(HTTP_REQUEST);
@@ -4156,11 +5471,13 @@ main (void)
   test_header_cr_no_lf_error(HTTP_REQUEST);
   test_invalid_header_field_token_error(HTTP_REQUEST);
   test_invalid_header_field_content_error(HTTP_REQUEST);
+  test_invalid_header_value_offsets(HTTP_REQUEST);
   test_double_content_length_error(HTTP_RESPONSE);
   test_chunked_content_length_error(HTTP_RESPONSE);
   test_header_cr_no_lf_error(HTTP_RESPONSE);
   test_invalid_header_field_token_error(HTTP_RESPONSE);
   test_invalid_header_field_content_error(HTTP_RESPONSE);
+  test_invalid_header_value_offsets(HTTP_RESPONSE);
 
   test_simple_type(
       "POST / HTTP/1.1\r\n"
@@ -4196,6 +5513,17 @@ main (void)
     test_message(&responses[i]);
   }
 
+  for (i = 0; i < ARRAY_SIZE(responses); i++) {
+    test_message_head(&responses[i]);
+  }
+
+  for (i = 0; i < ARRAY_SIZE(responses); i++) {
+    test_dechunk(&responses[i]);
+    test_body_ranges(&responses[i]);
+  }
+
+  test_batch(responses, ARRAY_SIZE(responses), HTTP_RESPONSE);
+
   for (i = 0; i < ARRAY_SIZE(responses); i++) {
     test_message_pause(&responses[i]);
   }
@@ -4270,6 +5598,36 @@ main (void)
 
   test_simple("GET / HTP/1.1\r\n\r\n", HPE_INVALID_VERSION);
   test_simple("GET / HTTP/01.1\r\n\r\n", HPE_INVALID_VERSION);
+
+  // Header errors inside a complete head
+  test_simple("POST / HTTP/1.1\r\n"
+              "Content-Length: 0\r\n"
+              "Content-Length: 1\r\n"
+              "\r\n",
+              HPE_UNEXPECTED_CONTENT_LENGTH);
+  test_simple("POST / HTTP/1.1\r\n"
+              "Content-Length: 1\r\n"
+              "Transfer-Encoding: chunked\r\n"
+              "\r\n",
+              HPE_UNEXPECTED_CONTENT_LENGTH);
+  test_simple("POST / HTTP/1.1\r\n"
+              "Content-Length: 1x\r\n"
+              "\r\n",
+              HPE_INVALID_CONTENT_LENGTH);
+
+  // Invalid bytes past the start of long URL runs
+  test_simple("GET /0123456789abcdef0123456789abcdef0123456789\001 HTTP/1.1\r\n"
+              "\r\n",
+              HPE_INVALID_URL);
+  test_simple("GET /?0123456789abcdef0123456789abcdef0123456789\177 HTTP/1.1\r\n"
+              "\r\n",
+              HPE_INVALID_URL);
+  test_simple("GET /0123456789abcdef0123456789abcdef0123456789?"
+              "0123456789abcdef0123456789abcdef0123456789?"
+              "0123456789abcdef0123456789abcdef0123456789#"
+              "0123456789abcdef0123456789abcdef0123456789 HTTP/1.1\r\n"
+              "\r\n",
+              HPE_OK);
   test_simple("GET / HTTP/11.1\r\n\r\n", HPE_INVALID_VERSION);
   test_simple("GET / HTTP/1.01\r\n\r\n", HPE_INVALID_VERSION);
 
@@ -4428,6 +5786,17 @@ main (void)
     test_message(&requests[i]);
   }
 
+  for (i = 0; i < ARRAY_SIZE(requests); i++) {
+    test_message_head(&requests[i]);
+  }
+
+  for (i = 0; i < ARRAY_SIZE(requests); i++) {
+    test_dechunk(&requests[i]);
+    test_body_ranges(&requests[i]);
+  }
+
+  test_batch(requests, ARRAY_SIZE(requests), HTTP_REQUEST);
+
   for (i = 0; i < ARRAY_SIZE(requests); i++) {
     test_message_pause(&requests[i]);
   }
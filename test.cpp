@@ -6,6 +6,7 @@
 #include <string_view>
 #include <cstring>
 #include <cassert>
+#include <sys/uio.h>
 
 using namespace std;
 
@@ -27,10 +28,22 @@ size_t read(string& fd, size_t &index, void *buf, size_t count);
 bool request_test1();
 bool request_test2();
 bool request_test3();
+bool request_test4();
+bool request_test5();
+bool request_test6();
+bool request_test7();
+bool request_test8();
+bool request_test9();
+bool request_test10();
+bool request_test11();
+bool request_test12();
+bool request_test13();
+bool request_test14();
 
 bool response_test1();
 bool response_test2();
 bool response_test3();
+bool response_test4();
 
 int main()
 {
@@ -38,10 +51,22 @@ int main()
     request_test1();
     request_test2();
     request_test3();
+    request_test4();
+    request_test5();
+    request_test6();
+    request_test7();
+    request_test8();
+    request_test9();
+    request_test10();
+    request_test11();
+    request_test12();
+    request_test13();
+    request_test14();
 
     response_test1();
     response_test2();
     response_test3();
+    response_test4();
 
     return 0;
 }
@@ -82,6 +107,12 @@ bool request_test1()
 
     assert(ptr->header(string("Content-Length")).value().compare("40") == 0);
 
+    assert(ptr->header(HTTP_PARSER::HTTP_HEADER_HOST).value().compare("test.com") == 0);
+
+    assert(ptr->header(HTTP_PARSER::HTTP_HEADER_CONTENT_LENGTH).value().compare("40") == 0);
+
+    assert(!ptr->header(HTTP_PARSER::HTTP_HEADER_COOKIE).has_value());
+
     assert(ptr->header(string("Field-1AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA")).value().compare("BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB") == 0);
 
     assert(ptr->body().value().compare("0123456789012345678901234567890123456789") == 0);
@@ -168,6 +199,190 @@ bool request_test3()
     return true;
 }
 
+bool request_test4()
+{
+    string request = "GET / HTTP/1.1\r\n"
+        "Accept: text/html\r\n"
+        "X-Dup: one\r\n"
+        "accept: text/plain\r\n"
+        "x-dup: two\r\n";
+    // Push past the inline capacity of the header table
+    for(int i = 0; i < 40; i++)
+        request += "X-Field-" + std::to_string(i) + ": " + std::to_string(i * i) + "\r\n";
+    request += "X-DUP: three\r\n"
+        "\r\n";
+
+    HttpRequest *ptr;
+    {
+        HttpParser<HttpRequest> parser;
+
+        parser.init();
+
+        size_t index = 0;
+        string buffer(10, 0);
+        size_t byte_read = 0;
+        while((byte_read = read(request, index, &buffer[0], 10)) > 0)
+        {
+            assert(parser.parse(string_view(&buffer[0], byte_read)));
+        }
+        ptr = parser.result().value();
+    }
+
+    // Lookups ignore case and return the first of duplicate headers
+    assert(ptr->header(string("ACCEPT")).value().compare("text/html") == 0);
+    assert(ptr->header(string("x-DUP")).value().compare("one") == 0);
+    assert(ptr->header(HTTP_PARSER::HTTP_HEADER_ACCEPT).value().compare("text/html") == 0);
+    assert(ptr->header(string("x-field-39")).value().compare("1521") == 0);
+    assert(!ptr->header(string("X-Field-40")).has_value());
+    assert(!ptr->header(string("X-Du")).has_value());
+
+    const HeaderTable &headers = ptr->header_table();
+    assert(headers.size() == 45);
+    assert(headers[1].field.compare("X-Dup") == 0);
+    assert(headers[2].id == HTTP_PARSER::HTTP_HEADER_ACCEPT);
+    assert(headers[44].value.compare("three") == 0);
+
+    auto dups = headers.find_all("X-Dup");
+    assert(dups.size() == 3);
+    assert(dups[0].compare("one") == 0);
+    assert(dups[1].compare("two") == 0);
+    assert(dups[2].compare("three") == 0);
+    assert(headers.find_all("accept").size() == 2);
+
+    delete ptr;
+
+    return true;
+}
+
+bool request_test5()
+{
+    constexpr char req[] = "POST /zero/copy?x=1 HTTP/1.1\r\n"
+        "Host: test.com\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "X-Long-Field-Name: a value that spans several reads\r\n"
+        "\r\n"
+        "5\r\nhello\r\n"
+        "6\r\n world\r\n"
+        "0\r\n\r\n";
+
+    // One buffer: everything points into it
+    string request(req);
+    HttpRequest *ptr;
+    {
+        HttpParser<HttpRequest> parser;
+
+        parser.init(HttpParser<HttpRequest>::ZeroCopy);
+        assert(parser.parse(string_view(request)));
+        ptr = parser.result().value();
+    }
+
+    const char *begin = request.data(), *end = begin + request.length();
+    assert(ptr->url().compare("/zero/copy?x=1") == 0);
+    assert(ptr->url().data() >= begin && ptr->url().data() < end);
+    string_view host = ptr->header(HTTP_PARSER::HTTP_HEADER_HOST).value();
+    assert(host.compare("test.com") == 0);
+    assert(host.data() >= begin && host.data() < end);
+    // The chunk framing splits the body, so it is coalesced
+    assert(ptr->body().value().compare("hello world") == 0);
+
+    delete ptr;
+
+    // Ref-counted reads of 10 bytes, released by the caller straight away
+    {
+        HttpParser<HttpRequest> parser;
+
+        parser.init(HttpParser<HttpRequest>::ZeroCopy);
+
+        size_t index = 0;
+        size_t byte_read = 0;
+        while(!parser.complete())
+        {
+            auto buffer = std::make_shared<string>(10, 0);
+            byte_read = read(request, index, &(*buffer)[0], 10);
+            assert(byte_read > 0);
+            assert(parser.parse(string_view(buffer->data(), byte_read), buffer));
+        }
+        ptr = parser.result().value();
+    }
+
+    assert(ptr->method() == (int)HTTP_PARSER::HTTP_POST);
+    assert(ptr->url().compare("/zero/copy?x=1") == 0);
+    assert(ptr->header(string("host")).value().compare("test.com") == 0);
+    assert(ptr->header(string("X-Long-Field-Name")).value().compare("a value that spans several reads") == 0);
+    assert(ptr->body().value().compare("hello world") == 0);
+
+    HttpRequest moved(std::move(*ptr));
+    delete ptr;
+    assert(moved.header(string("x-long-field-name")).value().compare("a value that spans several reads") == 0);
+    assert(moved.body().value().compare("hello world") == 0);
+
+    return true;
+}
+
+bool request_test6()
+{
+    constexpr char req[] = "POST /arena HTTP/1.1\r\n"
+        "Host: test.com\r\n"
+        "X-Request-Field: some value long enough to need the heap\r\n"
+        "Content-Length: 26\r\n"
+        "\r\n"
+        "abcdefghijklmnopqrstuvwxyz";
+
+    MessageArena arena;
+    HttpParser<HttpRequest> parser(&arena);
+    HttpRequest *first = nullptr;
+
+    // One message per reset: the arena hands out the same memory every time
+    for(int round = 0; round < 100; round++)
+    {
+        string request(req);
+        HttpRequest *ptr;
+
+        parser.init();
+
+        size_t index = 0;
+        string buffer(10, 0);
+        size_t byte_read = 0;
+        while((byte_read = read(request, index, &buffer[0], 10)) > 0
+            && !parser.complete())
+        {
+            assert(parser.parse(string_view(&buffer[0], byte_read)));
+        }
+        ptr = parser.result().value();
+
+        if(first == nullptr)
+            first = ptr;
+        assert(ptr == first);
+
+        assert(ptr->url().compare("/arena") == 0);
+        assert(ptr->header(HTTP_PARSER::HTTP_HEADER_HOST).value().compare("test.com") == 0);
+        assert(ptr->header(string("x-request-field")).value().compare("some value long enough to need the heap") == 0);
+        assert(ptr->body().value().compare("abcdefghijklmnopqrstuvwxyz") == 0);
+
+        // Owned by the arena; not deleted
+        arena.reset();
+    }
+
+    // Messages that are never reset are destroyed with the arena
+    {
+        MessageArena scoped(64);
+        HttpParser<HttpRequest> parser2(&scoped);
+        string request(req);
+
+        parser2.init();
+        assert(parser2.parse(string_view(request)));
+        HttpRequest *ptr = parser2.result().value();
+        assert(ptr->body().value().compare("abcdefghijklmnopqrstuvwxyz") == 0);
+
+        // Moving out of the arena keeps the moved views valid
+        HttpRequest moved(std::move(*ptr));
+        assert(moved.header(string("Host")).value().compare("test.com") == 0);
+        assert(moved.body().value().compare("abcdefghijklmnopqrstuvwxyz") == 0);
+    }
+
+    return true;
+}
+
 bool response_test1()
 {
     constexpr char resp[] = "HTTP/1.1 200 OK\r\n"
@@ -227,6 +442,8 @@ bool response_test2()
 
     assert(ptr->header(string("Date")).value().compare("Mon, 18 Jul 2016 16:06:00 GMT") == 0);
 
+    assert(ptr->header(HTTP_PARSER::HTTP_HEADER_DATE).value().compare("Mon, 18 Jul 2016 16:06:00 GMT") == 0);
+
     // body should be empty
     assert(ptr->body().value().empty());
 
@@ -270,6 +487,482 @@ bool response_test3()
     return true;
 }
 
+bool response_test4()
+{
+    constexpr char resp[] = "HTTP/1.1 204 No Content\r\n"
+        "A: b\r\n"
+        "\r\n";
+
+    HttpParser<HttpResponse> parser;
+    string response(resp);
+    parser.init();
+    assert(parser.parse(string_view(response)));
+    HttpResponse *ptr = parser.result().value();
+
+    std::vector<HttpResponse> resps;
+    resps.push_back(std::move(*ptr));
+    delete ptr;
+    resps.reserve(resps.capacity() * 4);
+
+    assert(resps[0].status() == 204);
+    assert(resps[0].header(string("A")).value() == "b");
+
+    return true;
+}
+
+bool request_test7()
+{
+    constexpr char req[] = "GET /static/./css/../%69mg//logo%2Epng?v=1 HTTP/1.1\r\n"
+        "Host: test.com\r\n"
+        "\r\n";
+
+    MessageArena arena;
+    HttpParser<HttpRequest> parser(&arena);
+    string request(req);
+
+    parser.init();
+    assert(parser.parse(string_view(request)));
+    HttpRequest *ptr = parser.result().value();
+
+    assert(ptr->url().compare("/static/./css/../%69mg//logo%2Epng?v=1") == 0);
+    assert(ptr->path().value().compare("/static/img/logo.png") == 0);
+    // Decoded once
+    assert(ptr->path().value().data() == ptr->path().value().data());
+
+    constexpr char bad[] = "GET /bad%zz HTTP/1.1\r\n"
+        "\r\n";
+    request = bad;
+    parser.init();
+    assert(parser.parse(string_view(request)));
+    ptr = parser.result().value();
+    assert(!ptr->path().has_value());
+
+    arena.reset();
+
+    return true;
+}
+
+bool request_test8()
+{
+    constexpr char req[] = "GET /search?q=http+parser%21&page=2&tag=a&tag=b&fl%61g HTTP/1.1\r\n"
+        "Host: test.com\r\n"
+        "\r\n";
+
+    HttpParser<HttpRequest> parser;
+    string request(req);
+
+    parser.init();
+    assert(parser.parse(string_view(request)));
+    HttpRequest *ptr = parser.result().value();
+
+    const QueryIndex &query = ptr->query();
+    assert(query.size() == 5);
+    assert(query.key(0).compare("q") == 0);
+    assert(query.value(0).compare("http+parser%21") == 0);
+    assert(query.get("q").value().compare("http parser!") == 0);
+    assert(query.get("page").value().compare("2") == 0);
+    assert(query.get_all("tag") == std::vector<string>({"a", "b"}));
+    // Keys are matched decoded
+    assert(query.contains("flag"));
+    assert(query.get("flag").value().empty());
+    assert(!query.get("missing").has_value());
+    // Indexed once
+    assert(&ptr->query() == &query);
+
+    QueryIndex many(string_view("a=1&b=2&c=3&d=4&e=5&f=6&g=7&h=8&i=9&j=10"
+                                "&k=11&l=12&m=13&n=14&o=15&p=16&q=17&bad=%zz"));
+    assert(many.size() == 18);
+    assert(many.get("q").value().compare("17") == 0);
+    assert(!many.get("bad").has_value());
+
+    delete ptr;
+
+    return true;
+}
+
+bool request_test9()
+{
+    constexpr char req[] = "GET /one HTTP/1.1\r\n"
+        "Host: test.com\r\n"
+        "\r\n"
+        "POST /two HTTP/1.1\r\n"
+        "Content-Length: 4\r\n"
+        "\r\n"
+        "body"
+        "GET /three HTTP/1.1\r\n"
+        "Host: te";
+    constexpr char rest[] = "st.com\r\n"
+        "\r\n";
+
+    MessageArena arena;
+    HttpParser<HttpRequest> parser(&arena);
+    string request(req);
+
+    parser.init();
+    assert(parser.parse(string_view(request)));
+    assert(parser.complete());
+
+    std::vector<HttpRequest*> reqs = parser.results();
+    assert(reqs.size() == 2);
+    assert(reqs[0]->url().compare("/one") == 0);
+    assert(reqs[0]->header(string("Host")).value().compare("test.com") == 0);
+    assert(reqs[1]->url().compare("/two") == 0);
+    assert(reqs[1]->body().value().compare("body") == 0);
+    assert(!reqs[1]->header(string("Host")).has_value());
+    // The third is still under way
+    assert(!parser.result().has_value());
+
+    HttpRequest *done = reqs[0];
+    parser.recycle(reqs[1]);
+    request = rest;
+    assert(parser.parse(string_view(request)));
+    HttpRequest *ptr = parser.result().value();
+    assert(ptr->url().compare("/three") == 0);
+    assert(ptr->header(string("Host")).value().compare("test.com") == 0);
+    assert(!ptr->body().value().length());
+    // Earlier messages are untouched
+    assert(done->url().compare("/one") == 0);
+
+    // A recycled message is reused for the next one
+    HttpRequest *recycled = ptr;
+    parser.recycle(ptr);
+    request = "GET /four HTTP/1.1\r\n\r\nGET /five HTTP/1.1\r\n\r\n";
+    assert(parser.parse(string_view(request)));
+    ptr = parser.result().value();
+    assert(ptr == recycled);
+    assert(ptr->url().compare("/four") == 0);
+    assert(!ptr->header(string("Host")).has_value());
+    assert(parser.result().value()->url().compare("/five") == 0);
+
+    // ZeroCopy: each message keeps the buffer it began in alive
+    std::shared_ptr<string> buf = std::make_shared<string>("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n");
+    std::weak_ptr<string> weak = buf;
+    parser.init(HttpParser<HttpRequest>::ZeroCopy);
+    assert(parser.parse(string_view(*buf), buf));
+    buf.reset();
+    reqs = parser.results();
+    assert(reqs.size() == 2);
+    assert(!weak.expired());
+    assert(reqs[0]->url().compare("/a") == 0);
+    assert(reqs[1]->url().compare("/b") == 0);
+
+    arena.reset();
+    assert(weak.expired());
+
+    return true;
+}
+
+bool request_test10()
+{
+    using Parser = HttpParser<HttpRequest>;
+    constexpr char req[] = "POST /upload HTTP/1.1\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "0123456789"
+        "POST /drop HTTP/1.1\r\n"
+        "Content-Length: 3\r\n"
+        "\r\n"
+        "abc";
+
+    Parser parser;
+    string streamed;
+    std::vector<string> heads;
+
+    // The head handler runs before any of the body arrives
+    parser.set_head_handler([&](HttpRequest &req) {
+        heads.emplace_back(req.url());
+        assert(req.header(string("Content-Length")).has_value());
+        return req.url() == "/upload" ? Parser::Stream : Parser::Discard;
+    });
+    parser.set_body_handler([&](HttpRequest &req, string_view fragment) {
+        assert(req.url() == "/upload");
+        streamed.append(fragment);
+    });
+
+    parser.init();
+    string request(req);
+    for(size_t i = 0; i < request.length(); i += 4)
+        assert(parser.parse(string_view(request).substr(i, 4)));
+
+    std::vector<HttpRequest*> reqs = parser.results();
+    assert(reqs.size() == 2);
+    assert(heads == std::vector<string>({"/upload", "/drop"}));
+    assert(streamed == "0123456789");
+    assert(!reqs[0]->body().has_value());
+    assert(!reqs[1]->body().has_value());
+    delete reqs[0];
+    delete reqs[1];
+
+    // Rejecting a message fails the parse before its body is read
+    parser.set_head_handler([](HttpRequest &) { return Parser::Reject; });
+    parser.init();
+    assert(!parser.parse(string_view(request)));
+    assert(!parser.result().has_value());
+
+    // Without a handler, the head can be inspected between parse() calls
+    Parser poll;
+    poll.init();
+    assert(poll.parse(string_view(request).substr(0, 47)));
+    assert(poll.headers_ready());
+    assert(!poll.complete());
+    assert(poll.head().value()->url() == "/upload");
+    poll.set_body_action(Parser::Discard);
+    assert(poll.parse(string_view(request).substr(47)));
+    assert(!poll.headers_ready());
+
+    HttpRequest *ptr = poll.result().value();
+    assert(!ptr->body().has_value());
+    delete ptr;
+    // The next message is buffered again
+    ptr = poll.result().value();
+    assert(ptr->body().value() == "abc");
+    delete ptr;
+
+    return true;
+}
+
+bool request_test11()
+{
+    using Parser = HttpParser<HttpRequest>;
+    string body;
+    for(int i = 0; body.length() < 1000; i++)
+        body += std::to_string(i) + ",";
+    string request = "PUT /big HTTP/1.1\r\n"
+        "Content-Length: " + std::to_string(body.length()) + "\r\n"
+        "\r\n" + body +
+        "GET /next HTTP/1.1\r\n"
+        "\r\n";
+
+    // A 64-byte ring takes the whole body through backpressure
+    RingBufferSink ring(64);
+    Parser parser;
+    parser.set_head_handler([](HttpRequest &) { return Parser::Stream; });
+    parser.set_body_sink(&ring);
+    parser.init();
+
+    string received;
+    string_view input(request);
+    int pauses = 0;
+    assert(parser.parse(input));
+    while(parser.paused())
+    {
+        pauses++;
+        assert(ring.size() == ring.capacity());
+        char out[24];
+        size_t n;
+        while((n = ring.read(out, sizeof(out))) > 0)
+            received.append(out, n);
+        if(!parser.resume())
+            continue;
+        input = input.substr(parser.parsed());
+        assert(parser.parse(input));
+    }
+    received.append(ring.peek());
+    ring.consume(ring.peek().length());
+    assert(ring.done());
+    assert(pauses >= 15);
+    assert(received == body);
+
+    std::vector<HttpRequest*> reqs = parser.results();
+    assert(reqs.size() == 2);
+    assert(!reqs[0]->body().has_value());
+    assert(reqs[1]->url() == "/next");
+    delete reqs[0];
+    delete reqs[1];
+
+    // Small bodies stay in memory, large ones go to a file
+    SpillSink small(4096), large(100);
+    DiscardSink discard;
+    for(BodySink *sink : {static_cast<BodySink*>(&small), static_cast<BodySink*>(&large),
+                          static_cast<BodySink*>(&discard)})
+    {
+        Parser other;
+        other.set_head_handler([](HttpRequest &) { return Parser::Stream; });
+        other.set_body_sink(sink);
+        other.init();
+        assert(other.parse(string_view(request)));
+        assert(!other.paused());
+        for(HttpRequest *req : other.results())
+            delete req;
+    }
+    assert(!small.spilled() && small.memory() == body);
+    assert(large.spilled() && large.memory().empty() && large.size() == body.length());
+    string from_file(body.length(), 0);
+    assert(fread(&from_file[0], 1, from_file.length(), large.file()) == body.length());
+    assert(from_file == body);
+    assert(discard.size() == body.length());
+
+    return true;
+}
+
+bool request_test12()
+{
+    string body;
+    for(int i = 0; body.length() < 40000; i++)
+        body += std::to_string(i) + ",";
+    string request = "POST /big HTTP/1.1\r\n"
+        "Content-Length: " + std::to_string(body.length()) + "\r\n"
+        "\r\n" + body +
+        "POST /small HTTP/1.1\r\n"
+        "Content-Length: 5\r\n"
+        "\r\n"
+        "hello";
+
+    HttpParser<HttpRequest> parser;
+    parser.init();
+    for(size_t i = 0; i < request.length(); i += 1000)
+        assert(parser.parse(string_view(request).substr(i, 1000)));
+    std::vector<HttpRequest*> reqs = parser.results();
+    assert(reqs.size() == 2);
+
+    // Full segments, then one cut to the Content-Length
+    const BodyBuffer &big = reqs[0]->body_buffer();
+    assert(big.size() == body.length());
+    assert(big.segment_count() == (body.length() + BodyBuffer::segment_size - 1) / BodyBuffer::segment_size);
+    struct iovec iov[8];
+    size_t n = big.fill_iovec(iov, 8);
+    assert(n == big.segment_count());
+    string joined;
+    for(size_t i = 0; i < n; i++)
+        joined.append((const char*)iov[i].iov_base, iov[i].iov_len);
+    assert(joined == body);
+    // Flattened on request
+    assert(reqs[0]->body().value() == body);
+
+    // A body in one segment is read in place
+    const BodyBuffer &small = reqs[1]->body_buffer();
+    assert(small.segment_count() == 1);
+    assert(reqs[1]->body().value().data() == small.segment(0).data());
+    assert(reqs[1]->body().value() == "hello");
+
+    delete reqs[0];
+    delete reqs[1];
+
+    return true;
+}
+
+bool request_test13()
+{
+    // Short enough for the strings to keep their characters inline
+    constexpr char req[] = "GET /?a=1 HTTP/1.1\r\n"
+        "X: y\r\n"
+        "\r\n"
+        "GET /b HTTP/1.1\r\n"
+        "\r\n";
+
+    HttpParser<HttpRequest> parser;
+    string request(req);
+    parser.init();
+    assert(parser.parse(string_view(request)));
+
+    std::vector<HttpRequest> reqs;
+    for(HttpRequest *ptr : parser.results())
+    {
+        ptr->query();
+        reqs.push_back(std::move(*ptr));
+        delete ptr;
+    }
+    // Grow past the first allocation, moving the requests again
+    reqs.reserve(reqs.capacity() * 4);
+
+    assert(reqs[0].url() == "/?a=1");
+    assert(reqs[0].header(string("X")).value() == "y");
+    assert(reqs[0].header_table()[0].field == "X");
+    assert(reqs[0].query().get("a").value() == "1");
+    assert(reqs[1].url() == "/b");
+
+    reqs[0] = std::move(reqs[1]);
+    reqs.pop_back();
+    assert(reqs[0].url() == "/b");
+    assert(!reqs[0].header(string("X")).has_value());
+
+    // Assigning across memory resources copies, and the source may go away
+    std::unique_ptr<MessageArena> from(new MessageArena());
+    MessageArena to;
+    HttpParser<HttpRequest> a(from.get()), b(&to);
+    string split1 = "POST /s?k=v HTTP/1.1\r\nSpl", split2 = "it: 1\r\nContent-Length: 2\r\n\r\nok";
+    a.init(HttpParser<HttpRequest>::ZeroCopy);
+    assert(a.parse(string_view(split1)));
+    assert(a.parse(string_view(split2)));
+    HttpRequest *zero = a.result().value();
+    zero->query();
+
+    b.init();
+    assert(b.parse(string_view(request)));
+    HttpRequest *dst = b.result().value();
+    HttpRequest *dst2 = b.result().value();
+    *dst = std::move(*zero);
+
+    string copied = "PUT /c HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc";
+    HttpParser<HttpRequest> c(from.get());
+    c.init();
+    assert(c.parse(string_view(copied)));
+    *dst2 = std::move(*c.result().value());
+    // Frees the arena's memory, not just rewinds it
+    from.reset();
+
+    assert(dst->url() == "/s?k=v");
+    assert(dst->header(string("Split")).value() == "1");
+    assert(dst->body().value() == "ok");
+    assert(dst->query().get("k").value() == "v");
+    assert(dst2->url() == "/c");
+    assert(dst2->body().value() == "abc");
+    to.reset();
+
+    return true;
+}
+
+bool request_test14()
+{
+    constexpr char req[] = "GET /one HTTP/1.1\r\n"
+        "\r\n"
+        "GET /two HTTP/1.1\r\n"
+        "X-Long-Enough-To-Need-The-Heap: ";
+    constexpr char rest[] = "some value\r\n"
+        "\r\n"
+        "GET /three HTTP/1.1\r\n"
+        "\r\n";
+
+    MessageArena arena;
+    HttpParser<HttpRequest> parser(&arena);
+    string request(req), more(rest);
+
+    // Reset under a message being parsed: it cannot be continued
+    parser.init();
+    assert(parser.parse(string_view(request)));
+    assert(parser.result().value()->url() == "/one");
+    arena.reset();
+    assert(!parser.parse(string_view(more)));
+    assert(!parser.result().has_value());
+
+    // Reset under queued messages: they are dropped, parsing goes on
+    parser.init();
+    assert(parser.parse(string_view(request)));
+    assert(parser.parse(string_view(more)));
+    arena.reset();
+    assert(!parser.result().has_value());
+    assert(parser.parse(string_view(request)));
+    assert(parser.result().value()->url() == "/one");
+    arena.reset();
+    assert(!parser.parse(string_view(more)));
+
+    // Reset between messages: the next one begins afresh
+    parser.init();
+    arena.reset();
+    assert(parser.parse(string_view(request)));
+    assert(parser.results().size() == 1);
+    arena.reset();
+    parser.init();
+    assert(parser.parse(string_view(request)));
+    assert(parser.parse(string_view(more)));
+    assert(parser.result().value()->url() == "/one");
+    HttpRequest *two = parser.result().value();
+    assert(two->header(string("X-Long-Enough-To-Need-The-Heap")).value() == "some value");
+    assert(parser.result().value()->url() == "/three");
+
+    return true;
+}
+
 string read_n_from(const string& input, size_t n)
 {
     static size_t index = 0;